@@ -33,14 +33,29 @@ namespace llvm {
 		FunRet=12,    //011 0               0
 		MemOp=18,  //100 1               0
 		BBEOF=20,        //101 0               0
+		Burst=24,        //110 0               0
 	};
 		  
+	//The kinds of memory operations
+	enum MemOpKind {
+		MemLoad=0,
+		MemStore=1,
+		MemCmpXchg=2,
+		MemAtomicRMW=3,
+		MemUnknown=15, //In traces without memory records
+	};
+
 	struct Packet {
 		PacketType ptype;
 		union {
 			BasicBlock* BB;
 			uint64_t MemAddr;
+			uint64_t EventIndex; //Of the first event of a Burst, among all events
 		};
+		//Of MemOp packets
+		MemOpKind memKind;
+		uint32_t memSize; //In bytes, 0 if unknown
+		Instruction* memInstr; //Null if unknown
 	};
 		  
 	//The special trace labels for function calls and returns.
@@ -50,6 +65,24 @@ namespace llvm {
 
 	//The special trace labels for memory tracing.   Followed by the memory address read or written.
 	static const uint64_t MemOpID=-4;
+
+	//A memory record starts with MemRecordTag in its top four bits, then the MemOpKind in
+	//four bits, the size of the access in bytes in 24 bits and the index of the instruction
+	//among the memory operations of the module in the low 32 bits.  Followed by the address.
+	static const uint64_t MemRecordTag=0xE;
+
+	static uint64_t encodeMemRecord(MemOpKind kind, uint64_t size, uint64_t instr) {
+		if(size>0xFFFFFF) size=0; //Too large to tell
+		return MemRecordTag<<60 | uint64_t(kind)<<56 | size<<32 | (instr & 0xFFFFFFFF);
+	}
+	static bool isMemRecord(uint64_t word) { return word>>60==MemRecordTag; }
+	static MemOpKind getMemRecordKind(uint64_t word) { return MemOpKind((word>>56) & 0xF); }
+	static uint32_t getMemRecordSize(uint64_t word) { return (word>>32) & 0xFFFFFF; }
+	static uint32_t getMemRecordInstr(uint64_t word) { return word & 0xFFFFFFFF; }
+
+	//The special trace label for the start of a burst of a sampled trace.  Followed by
+	//the index of the first event of the burst.  Events between bursts are not traced.
+	static const uint64_t BurstID=-5;
 			  
     static char ID; // Class identification, replacement for typeinfo
    BBTraceStream() {};
@@ -0,0 +1,69 @@
+//===- CallSiteProfileInfo.h ----------------------------------*- C++ -*---===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file outlines the interface used by optimizers to load call site
+// profiles: how often every call site was executed, and the most frequent
+// targets of indirect call sites.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_ANALYSIS_CALLSITEPROFILEINFO_H
+#define LLVM_ANALYSIS_CALLSITEPROFILEINFO_H
+
+#include "llvm/ADT/DenseMap.h"
+#include <utility>
+#include <vector>
+
+namespace llvm {
+
+class Function;
+class Instruction;
+class Module;
+
+class CallSiteProfileInfo {
+public:
+  // The targets of an indirect call site with their call counts, most
+  // frequent first.  A null function stands for any function outside of the
+  // module.
+  typedef std::vector<std::pair<Function*, uint64_t> > TargetVector;
+
+  CallSiteProfileInfo();
+  virtual ~CallSiteProfileInfo();
+
+  static char ID; // Pass identification
+
+  // The calls and invokes counted by -insert-callsite-profiling, which are
+  // all calls except those of intrinsics and inline assembly.
+  static bool isProfiledCallSite(const Instruction* I);
+
+  // Whether a profiled call site calls through a function pointer.
+  static bool isIndirectCallSite(const Instruction* I);
+
+  // The functions indirect call targets are numbered by, from 1.
+  static void getTargetFunctions(Module& M, std::vector<Function*>& targets);
+
+  // The number of times the call site was executed, 0 if it was not
+  // profiled.
+  uint64_t getCallCount(const Instruction* I) const;
+
+  // The recorded targets of an indirect call site.  Calls of targets which
+  // did not fit the runtime's table make up the difference to
+  // getCallCount().
+  const TargetVector& getIndirectTargets(const Instruction* I) const;
+
+protected:
+  DenseMap<const Instruction*, uint64_t> _callCounts;
+  DenseMap<const Instruction*, TargetVector> _indirectTargets;
+
+private:
+  TargetVector _noTargets;
+};
+} // end namespace llvm
+
+#endif
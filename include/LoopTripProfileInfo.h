@@ -0,0 +1,61 @@
+//===- LoopTripProfileInfo.h ----------------------------------*- C++ -*---===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file outlines the interface used by optimizers to load loop trip count
+// profiles: for every loop, how many of its invocations ran how many
+// iterations, in log2 sized buckets.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_ANALYSIS_LOOPTRIPPROFILEINFO_H
+#define LLVM_ANALYSIS_LOOPTRIPPROFILEINFO_H
+
+#include "llvm/ADT/DenseMap.h"
+#include <vector>
+
+namespace llvm {
+
+class BasicBlock;
+class Loop;
+class LoopInfo;
+
+class LoopTripProfileInfo {
+public:
+  // The trip counts of a loop.  Buckets[i] is the number of invocations with
+  // 2^i <= trip count < 2^(i+1), the last bucket counts all longer ones.
+  struct Histogram {
+    uint64_t Iterations;  // sum of the trip counts
+    uint64_t Invocations; // sum of the buckets
+    std::vector<uint64_t> Buckets;
+
+    double getAverageTripCount() const {
+      return Invocations ? double(Iterations) / Invocations : 0;
+    }
+  };
+
+  LoopTripProfileInfo();
+  virtual ~LoopTripProfileInfo();
+
+  static char ID; // Pass identification
+
+  // The loops of a function in the order -insert-looptrip-profiling numbers
+  // them: top level loops in LoopInfo order, each followed by its subloops.
+  static void getProfiledLoops(LoopInfo& LI, std::vector<Loop*>& loops);
+
+  // The histogram of a loop, or null if the loop was not profiled.  Loops
+  // are identified by their header, so the result stays valid while the
+  // loop structure is recomputed.
+  const Histogram* getHistogram(const Loop* L) const;
+
+protected:
+  DenseMap<const BasicBlock*, Histogram> _histograms;
+};
+} // end namespace llvm
+
+#endif
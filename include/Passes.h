@@ -6,6 +6,9 @@ namespace llvm {
 	
 extern char &ProfileEstimatorPassID;
 extern char &PathProfileLoaderPassID;
+extern char &CallSiteProfileLoaderPassID;
+extern char &ValueProfileLoaderPassID;
+extern char &LoopTripProfileLoaderPassID;
 extern char &ProfileMetadataLoaderPassID;
 extern char &ProfileInfoLoaderPassID;
 }
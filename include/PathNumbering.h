@@ -26,11 +26,16 @@
 #ifndef LLVM_ANALYSIS_PATHNUMBERING_H
 #define LLVM_ANALYSIS_PATHNUMBERING_H
 
+#include "ProfileInfo.h"
 #include "ProfileInfoTypes.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/Pass.h"
 #include "llvm/IR/CFG.h"
+#include "llvm/Support/Allocator.h"
 #include <map>
 #include <stack>
 #include <vector>
@@ -43,9 +48,10 @@ class BallLarusDag;
 // typedefs for storage/ interators of various DAG components
 typedef std::vector<BallLarusNode*> BLNodeVector;
 typedef std::vector<BallLarusNode*>::iterator BLNodeIterator;
-typedef std::vector<BallLarusEdge*> BLEdgeVector;
-typedef std::vector<BallLarusEdge*>::iterator BLEdgeIterator;
-typedef std::map<BasicBlock*, BallLarusNode*> BLBlockNodeMap;
+typedef SmallVector<BallLarusEdge*, 4> BLEdgeVector;
+typedef BLEdgeVector::iterator BLEdgeIterator;
+typedef DenseMap<BasicBlock*, BallLarusNode*> BLBlockNodeMap;
+typedef DenseSet<std::pair<BasicBlock*, BasicBlock*> > BLColdEdgeSet;
 typedef std::stack<BallLarusNode*> BLNodeStack;
 
 // Represents a basic block with information necessary for the BallLarus
@@ -61,6 +67,8 @@ public:
     _uid = nextUID++;
   }
 
+  virtual ~BallLarusNode() {}
+
   // Returns the basic block for the BallLarusNode
   BasicBlock* getBlock();
 
@@ -87,13 +95,15 @@ public:
   // Add an edge to the predecessor list.
   void addPredEdge(BallLarusEdge* edge);
 
-  // Remove an edge from the predecessor list.
+  // Remove an edge from the predecessor list in constant time.  The last
+  // predecessor edge takes its place.
   void removePredEdge(BallLarusEdge* edge);
 
   // Add an edge to the successor list.
   void addSuccEdge(BallLarusEdge* edge);
 
-  // Remove an edge from the successor list.
+  // Remove an edge from the successor list in constant time.  The last
+  // successor edge takes its place.
   void removeSuccEdge(BallLarusEdge* edge);
 
   // Returns the name of the BasicBlock being represented.  If BasicBlock
@@ -119,10 +129,6 @@ private:
 
   // Unique ID to ensure naming difference with dotgraphs
   unsigned _uid;
-
-  // Removes an edge from an edgeVector.  Used by removePredEdge and
-  // removeSuccEdge.
-  void removeEdge(BLEdgeVector& v, BallLarusEdge* e);
 };
 
 // Represents an edge in the Dag.  For an edge, v -> w, v is the source, and
@@ -136,7 +142,10 @@ public:
   BallLarusEdge(BallLarusNode* source, BallLarusNode* target,
                                 unsigned duplicateNumber)
     : _source(source), _target(target), _weight(0), _edgeType(NORMAL),
-      _realEdge(NULL), _duplicateNumber(duplicateNumber) {}
+      _realEdge(NULL), _duplicateNumber(duplicateNumber), _succIndex(0),
+      _predIndex(0) {}
+
+  virtual ~BallLarusEdge() {}
 
   // Returns the source/ target node of this edge.
   BallLarusNode* getSource() const;
@@ -202,6 +211,13 @@ private:
   // An ID to differentiate between those edges which have the same source
   // and destination blocks.
   unsigned _duplicateNumber;
+
+  // Positions of this edge in the successor list of its source and the
+  // predecessor list of its target, for constant time removal.
+  unsigned _succIndex;
+  unsigned _predIndex;
+
+  friend class BallLarusNode;
 };
 
 // Represents the Ball Larus DAG for a given Function.  Can calculate
@@ -211,9 +227,10 @@ class BallLarusDag {
 public:
   // Initializes a BallLarusDag from the CFG of a given function.  Must
   // call init() after creation, since some initialization requires
-  // virtual functions.
-  BallLarusDag(Function &F)
-    : _root(NULL), _exit(NULL), _function(F) {}
+  // virtual functions.  The CFG edges in coldEdges, if given, are cut from
+  // the DAG like split edges.
+  BallLarusDag(Function &F, const BLColdEdgeSet* coldEdges = 0)
+    : _root(NULL), _exit(NULL), _function(F), _coldEdges(coldEdges) {}
 
   // Initialization that requires virtual functions which are not fully
   // functional in the constructor.
@@ -223,8 +240,10 @@ public:
   virtual ~BallLarusDag();
 
   // Calculate the path numbers by assigning edge increments as prescribed
-  // in Ball-Larus path profiling.
-  void calculatePathNumbers();
+  // in Ball-Larus path profiling.  Returns false if the paths from the root
+  // overflow a uint64_t even though the DAG was split, then the function can
+  // not be profiled.
+  bool calculatePathNumbers();
 
   // Returns the number of paths for the DAG.
   uint64_t getNumberOfPaths();
@@ -241,6 +260,18 @@ public:
   // Clears the node colors.
   void clearColors(BallLarusNode::NodeColor color);
 
+  // Returns true for targeted path profiling, where a prior edge profile
+  // selects the functions to profile and the edges to cut from their DAGs.
+  static bool isTargeted();
+
+  // Returns true if the edge profile PI shows F too cold to profile.
+  static bool isColdFunction(ProfileInfo& PI, const Function& F);
+
+  // Collects the CFG edges of F that the edge profile PI shows too cold to
+  // be part of any profiled path.
+  static void findColdEdges(ProfileInfo& PI, Function& F,
+                            BLColdEdgeSet& coldEdges);
+
 protected:
   // All nodes in the DAG.
   BLNodeVector _nodes;
@@ -251,18 +282,22 @@ protected:
   // All backedges in the DAG.
   BLEdgeVector _backEdges;
 
+  // Arena holding all nodes and edges of the DAG.  It is released at once
+  // when the DAG is destroyed.
+  BumpPtrAllocator _allocator;
+
   // Allows subclasses to determine which type of Node is created.
   // Override this method to produce subclasses of BallLarusNode if
-  // necessary. The destructor of BallLarusDag will call free on each pointer
-  // created.
+  // necessary.  Nodes must be allocated from _allocator; the destructor of
+  // BallLarusDag will destroy each node created.
   virtual BallLarusNode* createNode(BasicBlock* BB);
 
   // Allows subclasses to determine which type of Edge is created.
   // Override this method to produce subclasses of BallLarusEdge if
   // necessary.  Parameters source and target will have been created by
   // createNode and can be cast to the subclass of BallLarusNode*
-  // returned by createNode. The destructor of BallLarusDag will call free
-  // on each pointer created.
+  // returned by createNode.  Edges must be allocated from _allocator; the
+  // destructor of BallLarusDag will destroy each edge created.
   virtual BallLarusEdge* createEdge(BallLarusNode* source, BallLarusNode*
                                     target, unsigned duplicateNumber);
 
@@ -283,21 +318,50 @@ private:
   // The function represented by this DAG.
   Function& _function;
 
-  // Processes one node and its imediate edges for building the DAG.
-  void buildNode(BLBlockNodeMap& inDag, std::stack<BallLarusNode*>& dfsStack);
+  // CFG edges cut from the DAG, or null.
+  const BLColdEdgeSet* _coldEdges;
+
+  // A node on the explicit DFS stack used to build the DAG, together with
+  // the next CFG successor of its block still to be visited.
+  struct BuildFrame {
+    BuildFrame(BallLarusNode* N, BasicBlock* BB)
+      : node(N), next(succ_begin(BB)), end(succ_end(BB)), oldSuccessor(0),
+        duplicateNumber(0) {}
+
+    BallLarusNode* node;
+    succ_iterator next;
+    succ_iterator end;
+    BasicBlock* oldSuccessor;
+    unsigned duplicateNumber;
+  };
+  typedef std::vector<BuildFrame> BuildStack;
+
+  // Processes one node and its imediate edges for building the DAG, and
+  // pushes it on the DFS stack.
+  void buildNode(BLBlockNodeMap& inDag, BuildStack& dfsStack,
+                 BallLarusNode* currentNode);
 
   // Process an edge in the CFG for DAG building.
-  void buildEdge(BLBlockNodeMap& inDag, std::stack<BallLarusNode*>& dfsStack,
+  void buildEdge(BLBlockNodeMap& inDag, BuildStack& dfsStack,
                  BallLarusNode* currentNode, BasicBlock* succBB,
                  unsigned duplicateNumber);
 
   // The weight on each edge is the increment required along any path that
-  // contains that edge.
+  // contains that edge.  The number of paths of all successors must be known.
   void calculatePathNumbersFrom(BallLarusNode* node);
 
+  // Splits the DAG at node, whose number of paths is too large, by turning
+  // its outgoing edges leading to the most paths into split edges.
+  void splitAt(BallLarusNode* node);
+
   // Adds a backedge with its phony edges.  Updates the DAG state.
   void addBackedge(BallLarusNode* source, BallLarusNode* target,
                    unsigned duplicateCount);
+
+  // Adds a cold edge as a split edge with its phony edges.  Updates the DAG
+  // state.
+  void addColdEdge(BallLarusNode* source, BallLarusNode* target,
+                   unsigned duplicateCount);
 };
 } // end namespace llvm
 
@@ -32,6 +32,9 @@ typedef std::vector<BasicBlock*>::iterator ProfilePathBlockIterator;
 typedef std::map<uint64_t,ProfilePath*> ProfilePathMap;
 typedef std::map<uint64_t,ProfilePath*>::iterator ProfilePathIterator;
 
+class ExtendedProfilePath;
+typedef std::vector<ExtendedProfilePath> ExtendedProfilePathVector;
+
 typedef std::map<Function*,unsigned int> FunctionPathCountMap;
 typedef std::map<Function*,ProfilePathMap> FunctionPathMap;
 typedef std::map<Function*,ProfilePathMap>::iterator FunctionPathIterator;
@@ -76,6 +79,32 @@ private:
   PathProfileInfo* _ppi;
 };
 
+// A sequence of Ball-Larus paths counted together: k consecutive paths of
+// one function activation, or a caller's path followed by the first path of
+// a function it called.
+class ExtendedProfilePath {
+public:
+  enum Kind { LOOP_ITERATION, CALL_SPANNING };
+
+  ExtendedProfilePath(Kind kind, uint64_t count) : _kind(kind),
+                                                   _count(count) {}
+
+  inline Kind getKind() const { return _kind; }
+  inline uint64_t getCount() const { return _count; }
+  inline unsigned getLength() const { return _paths.size(); }
+  inline Function* getFunction(unsigned i) const { return _paths[i].first; }
+  inline uint64_t getPathNumber(unsigned i) const { return _paths[i].second; }
+
+  inline void addPath(Function* F, uint64_t number) {
+    _paths.push_back(std::make_pair(F, number));
+  }
+
+private:
+  Kind _kind;
+  uint64_t _count;
+  std::vector<std::pair<Function*, uint64_t> > _paths;
+};
+
 // TODO: overload [] operator for getting path
 // Add: getFunctionCallCount()
 class PathProfileInfo {
@@ -94,6 +123,15 @@ class PathProfileInfo {
   ProfilePathIterator pathEnd();
   uint64_t pathsRun();
 
+  // Extended paths of all functions, empty unless the program was profiled
+  // with -path-profile-extended.
+  const ExtendedProfilePathVector& getExtendedPaths() const;
+
+  // The blocks executed along an extended path.  Changes the current
+  // function.
+  ProfilePathBlockVector* getExtendedPathBlocks(
+    const ExtendedProfilePath& path);
+
   static char ID; // Pass identification
   std::string argList;
 
@@ -101,6 +139,11 @@ protected:
   FunctionPathMap _functionPaths;
   FunctionPathCountMap _functionPathCounts;
 
+  ExtendedProfilePathVector _extendedPaths;
+
+  // Edges cut from the DAGs by targeted path profiling
+  std::map<Function*, BLColdEdgeSet> _coldEdges;
+
 private:
   BallLarusDag* _currentDag;
   Function* _currentFunction;
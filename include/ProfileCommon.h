@@ -1,12 +1,119 @@
 #ifndef PROFILE_COMMON_H
 #define PROFILE_COMMON_H
 
+#include "map"
 #include "vector"
 #include "unordered_map"
 
 #include "llvm/IR/Module.h"
 #include "llvm/IR/BasicBlock.h"
+#include "ProfileInfoTypes.h"
 
 void label_basic_blocks(llvm::Module& M,std::vector<llvm::BasicBlock*>& map, std::unordered_map<llvm::BasicBlock*, int>& reverse_map);
 
-#endif
\ No newline at end of file
+// label_memory_operations - Number the loads, stores and atomic operations of
+// M in order, as in the memory records of basic block traces.
+void label_memory_operations(llvm::Module& M,std::vector<llvm::Instruction*>& map, std::unordered_map<llvm::Instruction*, int>& reverse_map);
+
+// The FunctionMapInfo record of one kind of counters, indexed by GUID.
+typedef std::map<uint64_t, FunctionMapEntry> FunctionMap;
+
+// getFunctionGUID - A hash of the name of F, qualified by the name of its
+// module if F is local to it.
+uint64_t getFunctionGUID(const llvm::Function& F);
+
+// getFunctionCFGHash - A hash of the blocks of F and of their successors,
+// which changes whenever the counters of F would be laid out differently.
+uint64_t getFunctionCFGHash(const llvm::Function& F);
+
+// findProfiledFunction - The entry of F in Map, or null if F was not profiled.
+// If the control flow graph of F changed since, the entry is returned with
+// *Stale set if Stale is given, else null is returned and the change reported.
+const FunctionMapEntry* findProfiledFunction(const FunctionMap& Map, const llvm::Function& F, bool* Stale=0);
+
+// The control flow graph of a function as it was profiled: a hash of every
+// block and the indices of the successors of every block.
+struct ProfiledCFG {
+	std::vector<uint64_t> BlockHashes;
+	std::vector<std::vector<uint64_t> > Successors;
+};
+
+// The BlockMapInfo record of one kind of counters, indexed by GUID.
+typedef std::map<uint64_t, ProfiledCFG> BlockMap;
+
+// getBlockHash - A hash of the opcodes of the instructions of BB and of the
+// number of its successors.
+uint64_t getBlockHash(const llvm::BasicBlock& BB);
+
+// appendBlockMap - Append the control flow graph of F to the words of a
+// BlockMapInfo record.
+void appendBlockMap(const llvm::Function& F, std::vector<uint64_t>& Words);
+
+// parseBlockMap - Read the words of a BlockMapInfo record following its
+// type into Map.  Returns false if the record is malformed.
+bool parseBlockMap(const std::vector<uint64_t>& Words, BlockMap& Map);
+
+// matchStaleBlocks - Find the blocks of F which correspond to the blocks of
+// Old, the graph F was profiled with: first blocks with the same hash, in
+// order, then the unmatched successors of matched blocks in the same
+// position.  Unmatched blocks map to null.  Returns false if too few blocks
+// were matched for the profile to be of use.
+bool matchStaleBlocks(const llvm::Function& F, const ProfiledCFG& Old, std::vector<const llvm::BasicBlock*>& OldToNew);
+
+// The edges of a function as in ProfileInfo and ProfileData.
+typedef std::pair<const llvm::BasicBlock*, const llvm::BasicBlock*> ProfiledEdge;
+
+// mapStaleEdges - The edges of F matching the counters of Old, in the order
+// of the edge profiling counters, including the exit edges (BB,0) of blocks
+// without successors if ExitEdges is set as in optimal edge profiles.
+// Counters whose edge does not exist in F any more map to (0,0).
+void mapStaleEdges(const ProfiledCFG& Old, const std::vector<const llvm::BasicBlock*>& OldToNew, bool ExitEdges, std::vector<ProfiledEdge>& Edges);
+
+// BlockCountSolver - Infers the counts of all blocks of a function, numbered
+// in function order, from the counts of some of them.  A block runs as often
+// as the blocks of its class, see getBlockClasses, and as often as its
+// incoming edges and its outgoing edges run in total.  The entry block has a
+// virtual incoming edge, blocks without successors a virtual outgoing one.
+// The block profiler places its counters by the same inference the loader
+// completes the counts with.
+class BlockCountSolver {
+	std::vector<unsigned> Classes;
+	std::vector<std::vector<unsigned> > Members;
+	std::vector<std::vector<unsigned> > InEdges, OutEdges;
+	std::vector<std::pair<int,int> > Edges; // -1 for the virtual ends
+
+	std::vector<bool> BlockKnown, EdgeKnown;
+	std::vector<uint64_t> BlockCounts, EdgeCounts;
+	std::vector<unsigned> Worklist;
+	unsigned NumUnknown;
+
+	void setEdgeCount(unsigned E, uint64_t Count);
+	void solveBlock(unsigned B, const std::vector<unsigned>& Flow);
+public:
+	explicit BlockCountSolver(llvm::Function& F);
+
+	unsigned getNumBlocks() const { return Classes.size(); }
+
+	// reset - Forget all counts.
+	void reset();
+
+	// setCount - Make the count of block B known.
+	void setCount(unsigned B, uint64_t Count);
+
+	// solve - Infer all counts which follow from the known ones.  Returns the
+	// number of blocks whose count is still unknown.
+	unsigned solve();
+
+	bool isKnown(unsigned B) const { return BlockKnown[B]; }
+	uint64_t getCount(unsigned B) const { return BlockCounts[B]; }
+};
+
+// getBlockClasses - The class of every block of F in function order, the
+// number of the first block of the class.  A block is in the class of its
+// immediate dominator if it postdominates it and both are in the same loop,
+// which no iteration leaves between them, so both always run equally often.
+// Blocks of irreducible functions, whose loops are not known, are in classes
+// of their own.
+void getBlockClasses(llvm::Function& F, std::vector<unsigned>& Classes);
+
+#endif
@@ -16,6 +16,7 @@
 #ifndef LLVM_ANALYSIS_PROFILEDATALOADER_H
 #define LLVM_ANALYSIS_PROFILEDATALOADER_H
 
+#include "ProfileCommon.h"
 #include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/SmallVector.h"
@@ -82,6 +83,18 @@ public:
     return weights.find(e)->second;
   }
 
+  /// hasProfile - Return true if edge weights were loaded for function 'f'.
+  bool hasProfile(const FType *f) const {
+    return EdgeInformation.find(f) != EdgeInformation.end();
+  }
+
+  /// hasEdgeWeight - Return true if a weight was loaded for edge 'e'.
+  bool hasEdgeWeight(Edge e) const {
+    typename DenseMap<const FType*, EdgeWeights>::const_iterator I =
+      EdgeInformation.find(getFunction(e));
+    return I != EdgeInformation.end() && I->second.count(e);
+  }
+
   /// addEdgeWeight - Add 'weight' to the already stored execution count for
   /// this edge.
   void addEdgeWeight(Edge e, uint64_t weight) {
@@ -107,6 +120,16 @@ private:
   /// multiple program runs are accumulated.
   SmallVector<uint64_t, 32> EdgeCounts;
 
+  /// The identities of the functions of the edge counters, if the profile
+  /// has them.
+  FunctionMap EdgeFunctions;
+  bool HasEdgeFunctions;
+
+  /// The control flow graphs the functions of the edge counters were
+  /// profiled with, if the profile has them.
+  std::vector<uint64_t> EdgeBlocks;
+  bool HasEdgeBlocks;
+
 public:
   /// ProfileDataLoader ctor - Read the specified profiling data file, exiting
   /// the program if the file is invalid or broken.
@@ -129,6 +152,18 @@ public:
   /// getRawEdgeCounts - Return the raw profiling data, this is just a list of
   /// numbers with no mappings to edges.
   ArrayRef<uint64_t> getRawEdgeCounts() const { return EdgeCounts; }
+
+  /// getEdgeFunctionMap - Return the identities of the functions of the edge
+  /// counters, or null if the counters follow each other in module order.
+  const FunctionMap *getEdgeFunctionMap() const {
+    return HasEdgeFunctions ? &EdgeFunctions : 0;
+  }
+
+  /// getRawEdgeBlockMap - Return the words of the block map of the edge
+  /// counters, or null if the profile has none.  See parseBlockMap().
+  const std::vector<uint64_t> *getRawEdgeBlockMap() const {
+    return HasEdgeBlocks ? &EdgeBlocks : 0;
+  }
 };
 
 /// createProfileMetadataLoaderPass - This function returns a Pass that loads
@@ -29,7 +29,18 @@ enum ProfilingType {
   EdgeInfo      = 4,   /* Edge profiling information      */
   PathInfo      = 5,   /* Path profiling information      */
   BBTraceInfo   = 6,   /* Basic block trace information   */
-  OptEdgeInfo   = 7    /* Edge profiling information, optimal version */
+  OptEdgeInfo   = 7,   /* Edge profiling information, optimal version */
+  ExtendedPathInfo = 8, /* Loop-iteration and call-spanning paths */
+  CallSiteInfo  = 9,   /* Call site execution counts      */
+  IndirectCallInfo = 10, /* Most frequent indirect call targets */
+  ValueInfo     = 11,  /* Most frequent values of instruction operands */
+  LoopTripInfo  = 12,  /* Loop trip count histograms      */
+  TimingInfo    = 13,  /* Function cycle counts           */
+  EdgeCoverageInfo = 14, /* Bitmap of the executed edges  */
+  BlockCoverageInfo = 15, /* Bitmap of the executed blocks */
+  FunctionMapInfo = 16, /* Identities of the profiled functions */
+  BlockMapInfo  = 17,  /* Blocks of the profiled functions */
+  RegionTimingInfo = 18 /* Time spent in the timed regions */
 };
 
 #if defined(__cplusplus)
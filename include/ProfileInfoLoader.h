@@ -16,6 +16,8 @@
 #ifndef LLVM_ANALYSIS_PROFILEINFOLOADER_H
 #define LLVM_ANALYSIS_PROFILEINFOLOADER_H
 
+#include "ProfileCommon.h"
+#include <map>
 #include <string>
 #include <utility>
 #include <vector>
@@ -26,6 +28,31 @@ namespace llvm {
 	class Function;
 	class BasicBlock;
 
+	// Path counters of one function, indexed by path number.
+	typedef std::map<uint64_t, uint64_t> PathCounterMap;
+
+	// Call counts of the targets of one indirect call site, indexed by function
+	// number.
+	typedef std::map<uint64_t, uint64_t> IndirectCallTargetMap;
+
+	// The counts of extended paths, indexed by their ExtendedPathKind followed
+	// by the function and path number of each of their Ball-Larus paths.
+	typedef std::map<std::vector<uint64_t>, uint64_t> ExtendedPathCounterMap;
+
+	// The executions and cycles of timed regions, indexed by the GUID of their
+	// function and the index of their block.
+	typedef std::map<std::pair<uint64_t, uint64_t>,
+	                 std::pair<uint64_t, uint64_t> > RegionTimingMap;
+
+	// The recorded values of one value profiling site with their counts.
+	struct ValueSiteCounts {
+		uint64_t Kind;
+		uint64_t Total;
+		std::map<uint64_t, uint64_t> Values;
+
+		ValueSiteCounts() : Kind(0), Total(0) {}
+	};
+
 	class ProfileInfoLoader {
 		const std::string &Filename;
 		std::vector<std::string> CommandLines;
@@ -34,6 +61,18 @@ namespace llvm {
 		std::vector<uint64_t>    EdgeCounts;
 		std::vector<uint64_t>    OptimalEdgeCounts;
 		std::vector<uint64_t>    BBTrace;
+		std::map<uint64_t, PathCounterMap> PathCounts;
+		ExtendedPathCounterMap   ExtendedPathCounts;
+		std::vector<uint64_t>    CallSiteCounts;
+		std::map<uint64_t, IndirectCallTargetMap> IndirectCallTargets;
+		std::vector<ValueSiteCounts> ValueCounts;
+		std::vector<uint64_t>    LoopTripCounts;
+		std::vector<uint64_t>    FunctionTimings;
+		RegionTimingMap          RegionTimings;
+		std::vector<bool>        EdgeCoverage;
+		std::vector<bool>        BlockCoverage;
+		std::map<uint64_t, FunctionMap> FunctionMaps;
+		std::map<uint64_t, std::vector<uint64_t> > BlockMaps;
 		private:
 			//This variable makes sure we don't append basic block traces to each other
 			bool BBTraceFinished=false;
@@ -77,6 +116,114 @@ namespace llvm {
 				return OptimalEdgeCounts;
 			}
 
+			// getRawPathCounts - This method is used by consumers of path counting
+			// information.  Functions are numbered from 1 in module order.
+			//
+			const std::map<uint64_t, PathCounterMap> &getRawPathCounts() const {
+				return PathCounts;
+			}
+
+			// getRawExtendedPathCounts - This method is used by consumers of
+			// extended path counting information.
+			//
+			const ExtendedPathCounterMap &getRawExtendedPathCounts() const {
+				return ExtendedPathCounts;
+			}
+
+			// getRawCallSiteCounts - This method is used by consumers of call site
+			// counting information.
+			//
+			const std::vector<uint64_t> &getRawCallSiteCounts() const {
+				return CallSiteCounts;
+			}
+
+			// getRawIndirectCallTargets - This method is used by consumers of
+			// indirect call target information, indexed by call site number.
+			// Functions are numbered from 1 in module order, skipping intrinsics;
+			// 0 stands for any function outside of the module.
+			//
+			const std::map<uint64_t, IndirectCallTargetMap> &
+			getRawIndirectCallTargets() const {
+				return IndirectCallTargets;
+			}
+
+			// getRawValueCounts - This method is used by consumers of value
+			// profiling information, indexed by site number.
+			//
+			const std::vector<ValueSiteCounts> &getRawValueCounts() const {
+				return ValueCounts;
+			}
+
+			// getRawLoopTripCounts - This method is used by consumers of loop trip
+			// count histograms, one LoopTripEntry per loop.
+			//
+			const std::vector<uint64_t> &getRawLoopTripCounts() const {
+				return LoopTripCounts;
+			}
+
+			// getRawFunctionTimings - This method is used by consumers of function
+			// timing information, one FunctionTimingEntry per defined function.
+			//
+			const std::vector<uint64_t> &getRawFunctionTimings() const {
+				return FunctionTimings;
+			}
+
+			// getRawRegionTimings - This method is used by consumers of region
+			// timing information, accumulated over all executions.
+			//
+			const RegionTimingMap &getRawRegionTimings() const {
+				return RegionTimings;
+			}
+
+			// getRawEdgeCoverage - This method is used by consumers of edge
+			// coverage information, one flag per edge in the order of the edge
+			// counters.  A flag is set if the edge ran in any execution.
+			//
+			const std::vector<bool> &getRawEdgeCoverage() const {
+				return EdgeCoverage;
+			}
+
+			// getRawBlockCoverage - This method is used by consumers of block
+			// coverage information, one flag per block in the order of the
+			// basic block trace numbers.
+			//
+			const std::vector<bool> &getRawBlockCoverage() const {
+				return BlockCoverage;
+			}
+
+			// getFunctionMap - The identities of the functions profiled by the
+			// counters of type PT, or null if the profile has no map of them and
+			// the counters follow each other in module order.
+			//
+			const FunctionMap *getFunctionMap(uint64_t PT) const {
+				std::map<uint64_t, FunctionMap>::const_iterator I =
+					FunctionMaps.find(PT);
+				return I == FunctionMaps.end() ? 0 : &I->second;
+			}
+
+			// getFunctionMaps - The function maps of all types of counters.
+			//
+			const std::map<uint64_t, FunctionMap> &getFunctionMaps() const {
+				return FunctionMaps;
+			}
+
+			// getRawBlockMap - The words of the block map of the counters of type
+			// PT following its type, or null if the profile has none.  See
+			// parseBlockMap().
+			//
+			const std::vector<uint64_t> *getRawBlockMap(uint64_t PT) const {
+				std::map<uint64_t, std::vector<uint64_t> >::const_iterator I =
+					BlockMaps.find(PT);
+				return I == BlockMaps.end() ? 0 : &I->second;
+			}
+
+			// getRawBlockMaps - The block maps of all types of counters.
+			//
+			const std::map<uint64_t, std::vector<uint64_t> > &
+			getRawBlockMaps() const {
+				return BlockMaps;
+			}
+
 			const std::vector<uint64_t> &getRawBBTrace() const {
 				return BBTrace;
 			}
@@ -95,9 +242,28 @@ namespace llvm {
 			((Var & (255UL<<56U)) >> 56U);
 	}
 
+	// ByteSwapCounts - Byteswap 'NumEntries' counters in place.
+	//
+	void ByteSwapCounts(uint64_t *Data, uint64_t NumEntries);
+
+	// AccumulateCounts - Add the 'NumEntries' counters in 'Src', byteswapped if
+	// 'ShouldByteSwap' is true, to 'Data'.  An Uncounted value on either side
+	// takes the value of the other side.
+	//
+	void AccumulateCounts(uint64_t *Data, const uint64_t *Src,
+	                      uint64_t NumEntries, bool ShouldByteSwap);
+
 	void ReadProfilingBlock(const char *ToolName, FILE *F,bool ShouldByteSwap, std::vector<uint64_t> &Data);
 	bool ReadBBTraceProfilingBlock(const char *ToolName, FILE *F, bool ShouldByteSwap,  std::vector<uint64_t> &Data);
+	void ReadPathProfilingBlock(const char *ToolName, FILE *F, bool ShouldByteSwap, std::map<uint64_t, PathCounterMap> &Data);
+	void ReadIndirectCallProfilingBlock(const char *ToolName, FILE *F, bool ShouldByteSwap, std::map<uint64_t, IndirectCallTargetMap> &Data);
+	void ReadValueProfilingBlock(const char *ToolName, FILE *F, bool ShouldByteSwap, std::vector<ValueSiteCounts> &Data);
+	void ReadCoverageProfilingBlock(const char *ToolName, FILE *F, bool ShouldByteSwap, std::vector<bool> &Data);
+	void ReadFunctionMapBlock(const char *ToolName, FILE *F, bool ShouldByteSwap, std::map<uint64_t, FunctionMap> &Data);
+	void ReadBlockMapBlock(const char *ToolName, FILE *F, bool ShouldByteSwap, std::map<uint64_t, std::vector<uint64_t> > &Data);
 	void SkipProfilingBlock(const char *ToolName, FILE *F,  bool ShouldByteSwap);
+	void ReadExtendedPathProfilingBlock(const char *ToolName, FILE *F, bool ShouldByteSwap, ExtendedPathCounterMap &Data);
+	void ReadRegionTimingBlock(const char *ToolName, FILE *F, bool ShouldByteSwap, RegionTimingMap &Data);
 } // End llvm namespace
 
 #endif
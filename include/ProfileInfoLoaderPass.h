@@ -4,20 +4,34 @@
 #include "llvm/Pass.h"
 
 #include "ProfileInfo.h"
+#include "ProfileCommon.h"
 #include "BBTraceStream.h"
 
 namespace llvm {
   class ProfileInfoLoaderPass : public ModulePass, public ProfileInfo, public BBTraceStream {
     std::string Filename;
     std::set<Edge> SpanningTree;
-    std::set<const BasicBlock*> BBisUnvisited;
     unsigned ReadCount;
 
-	 // recurseBasicBlock() - Calculates the edge weights for as much basic
-    // blocks as possbile.
-    virtual void recurseBasicBlock(const BasicBlock *BB);
+    // calculateSpanningTreeEdges() - Calculates the weights of the uncounted
+    // edges of F from flow conservation, visiting every edge only once.
+    virtual void calculateSpanningTreeEdges(const Function *F);
+    virtual bool calculateMissingEdge(const BasicBlock *BB, Edge &removed);
+    // verifyEdgeFlow() - Reports the blocks of F whose edge weights do not
+    // conserve flow, in debug output.
+    void verifyEdgeFlow(const Function *F);
     virtual void readEdgeOrRemember(Edge, Edge&, unsigned &, double &);
     virtual void readEdge(ProfileInfo::Edge, std::vector<uint64_t>&);
+    virtual void readBlockCounts(Function *F, std::vector<uint64_t> &Counters);
+    virtual bool findFunctionCounters(const Function *F,
+                                      const FunctionMap *Map,
+                                      const BlockMap *Blocks,
+                                      std::vector<uint64_t> &ECs,
+                                      bool ExitEdges);
+    virtual void readStaleEdges(const Function *F,
+                                const FunctionMapEntry &Entry,
+                                const BlockMap &Blocks,
+                                std::vector<uint64_t> &ECs, bool ExitEdges);
 
 	 uint64_t BBTraceIndex=0;
 	 
@@ -46,6 +46,150 @@ typedef struct {
   uint64_t pathCounter;
 } PathProfileTableEntry;
 
+/* Kinds of extended paths, which are sequences of Ball-Larus paths */
+enum ExtendedPathKind {
+  LoopIterationPath = 1, /* k consecutive paths of one function activation */
+  CallSpanningPath = 2   /* a caller's path, then the first path of a callee
+                            it called */
+};
+
+/*
+ * The header of an extended path record, followed by length
+ * ExtendedPathEntry.
+ */
+typedef struct {
+  uint64_t kind;   /* ExtendedPathKind */
+  uint64_t length; /* number of Ball-Larus paths */
+  uint64_t count;  /* number of times the sequence was executed */
+} ExtendedPathHeader;
+
+/*
+ * One Ball-Larus path of an extended path.
+ */
+typedef struct {
+  uint64_t fnNumber;
+  uint64_t pathNumber;
+} ExtendedPathEntry;
+
+/* Number of targets recorded per indirect call site */
+#define INDIRECT_CALL_TOP_TARGETS 4
+
+/*
+ * The most frequent targets of an indirect call site, ordered by count and
+ * found with the space-saving algorithm like profiled values, so counts are
+ * upper bounds.  While the program runs the targets are function addresses,
+ * in the profile they are function numbers: 1 + the index of the function
+ * among the non-intrinsic functions of the module, or 0 for a function
+ * outside of it.  Unused targets have a zero count.
+ */
+typedef struct {
+  uint64_t siteNumber; /* index of the call site in the CallSiteInfo counts */
+  struct {
+    uint64_t target;
+    uint64_t count;
+  } targets[INDIRECT_CALL_TOP_TARGETS];
+} IndirectCallSiteEntry;
+
+/* Number of values recorded per value profiling site */
+#define VALUE_PROFILE_TOP_VALUES 4
+
+/* The operands recorded by value profiling */
+enum ValueProfileKind {
+  MemIntrinsicSizeValue = 1, /* length of a memcpy, memmove or memset */
+  SwitchConditionValue = 2,  /* condition of a switch */
+  DivisorValue = 3           /* divisor of a division or remainder */
+};
+
+/*
+ * The most frequent values of a value profiling site, found with the
+ * space-saving algorithm: a value missing from the full table replaces the
+ * least frequent one and inherits its count, so counts are upper bounds.
+ * Unused values have a zero count.
+ */
+typedef struct {
+  uint64_t kind;  /* ValueProfileKind */
+  uint64_t total; /* number of times the site was executed */
+  struct {
+    uint64_t value;
+    uint64_t count;
+  } values[VALUE_PROFILE_TOP_VALUES];
+} ValueProfileSiteEntry;
+
+/* Number of buckets of a loop trip count histogram */
+#define LOOP_TRIP_BUCKETS 32
+
+/*
+ * The trip counts of a loop.  Bucket i counts the invocations of the loop
+ * with 2^i <= trip count < 2^(i+1), the last bucket all longer ones.  The
+ * trip count of an invocation is the number of times its header ran.
+ */
+typedef struct {
+  uint64_t iterations; /* sum of the trip counts */
+  uint64_t buckets[LOOP_TRIP_BUCKETS];
+} LoopTripEntry;
+
+/*
+ * The time spent in a function, in time stamp counter cycles on x86 and in
+ * nanoseconds elsewhere, with the cost of the instrumentation subtracted.
+ * Inclusive time counts recursive activations once.
+ */
+typedef struct {
+  uint64_t calls;
+  uint64_t inclusive; /* including the functions it called */
+  uint64_t exclusive; /* excluding the functions it called */
+} FunctionTimingEntry;
+
+/*
+ * The time spent in a timed region, a block selected with -timing-regions,
+ * from its first instruction up to its terminator.  It is measured as the
+ * time of functions is, so it includes the functions called from the block.
+ */
+typedef struct {
+  uint64_t guid;       /* GUID of the function of the block */
+  uint64_t block;      /* index of the block in its function */
+  uint64_t executions;
+  uint64_t cycles;
+} RegionTimingEntry;
+
+/*
+ * The trace handle of a module traced by -trace-basic-blocks.  The runtime
+ * stores the trace of the module in it once its tracing starts.  A non-zero
+ * burst samples the trace: only bursts of that many events are recorded, one
+ * every period events, or every timerMs milliseconds if that is non-zero.
+ * Every burst starts with the burst label, followed by the index of its first
+ * event among all events of the module.
+ */
+typedef struct {
+  uint64_t trace;   /* set by the runtime */
+  uint64_t burst;   /* events per burst, or 0 to record all events */
+  uint64_t period;  /* events from the start of one burst to the next */
+  uint64_t timerMs; /* milliseconds from one burst to the next, or 0 */
+} BBTraceHandle;
+
+/*
+ * The identity of a profiled function: a hash of its name, which survives
+ * changes to the rest of the module, and a hash of its control flow graph,
+ * which changes with the layout of its counters.  A FunctionMapInfo record
+ * starts with the ProfilingType of the counters it describes, followed by
+ * one entry per profiled function.
+ */
+typedef struct {
+  uint64_t guid;         /* hash of the name of the function */
+  uint64_t cfgHash;      /* hash of the control flow graph of the function */
+  uint64_t firstCounter; /* index of its first counter, or its function
+                            number in path profiles */
+  uint64_t numCounters;  /* number of its counters, or of its paths */
+} FunctionMapEntry;
+
+/*
+ * A BlockMapInfo record starts with the ProfilingType of the counters it
+ * describes, followed by the control flow graph of every profiled function
+ * as it was instrumented: its GUID and number of blocks, then for every
+ * block in function order a hash of its instructions, its number of
+ * successors and their block indices.  Loaders use it to match the counters
+ * of a function with a changed control flow graph.
+ */
+
 #if defined(__cplusplus)
 }
 #endif
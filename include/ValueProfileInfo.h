@@ -0,0 +1,62 @@
+//===- ValueProfileInfo.h -------------------------------------*- C++ -*---===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file outlines the interface used by optimizers to load value profiles:
+// the most frequent values of memory intrinsic lengths, switch conditions and
+// divisors, for specializing hot code on them.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_ANALYSIS_VALUEPROFILEINFO_H
+#define LLVM_ANALYSIS_VALUEPROFILEINFO_H
+
+#include "llvm/ADT/DenseMap.h"
+#include <utility>
+#include <vector>
+
+namespace llvm {
+
+class Instruction;
+class Value;
+
+class ValueProfileInfo {
+public:
+  // The recorded values of a site with their counts, most frequent first.
+  // The counts are upper bounds, see ValueProfileSiteEntry.
+  typedef std::vector<std::pair<uint64_t, uint64_t> > ValueVector;
+
+  ValueProfileInfo();
+  virtual ~ValueProfileInfo();
+
+  static char ID; // Pass identification
+
+  // The operand of I recorded by -insert-value-profiling, or null if I is
+  // not a value profiling site.  Constant operands are not recorded.  Sets
+  // kind to the ValueProfileKind of the site.
+  static Value* getProfiledValue(Instruction* I, unsigned& kind);
+
+  // Whether the recorded value is sign extended to 64 bits.
+  static bool isSignedValue(unsigned kind);
+
+  // The number of times the site was executed, 0 if it was not profiled.
+  uint64_t getExecutionCount(const Instruction* I) const;
+
+  // The most frequent values of the site.
+  const ValueVector& getValues(const Instruction* I) const;
+
+protected:
+  DenseMap<const Instruction*, uint64_t> _executionCounts;
+  DenseMap<const Instruction*, ValueVector> _values;
+
+private:
+  ValueVector _noValues;
+};
+} // end namespace llvm
+
+#endif
@@ -11,61 +11,239 @@
 |* instrumentation pass.  This should be used with the -trace-basic-blocks
 |* LLVM pass.
 |*
+|* Sampled traces only record bursts of events.  The sampling chosen by the
+|* pass is overridden by LLVMPROF_TRACE_SAMPLE, set to N/M for bursts of N
+|* events every M events, to N/Tms for bursts every T milliseconds, or to 0
+|* to record everything.  Events are labels with their operands, which are
+|* never split by a burst.
+|*
 \*===----------------------------------------------------------------------===*/
 
 #include "Profiling.h"
+#include "ProfileInfoTypes.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 
-//The special trace label for end of trace
+//The special trace labels, as in BBTraceStream
 static const uint64_t BBEOF=-1;
+static const uint64_t BBFunCall=-2;
+static const uint64_t BBMemOp=-4;
+static const uint64_t BBBurst=-5;
+
+/* The clock is only read every this many events between timed bursts. */
+#define TRACE_CLOCK_EVENTS 1024
 
-static uint64_t *ArrayStart, *ArrayEnd, *ArrayCursor;
+/* The trace of one instrumented module, written to its profile file. */
+typedef struct BBTrace {
+  ProfiledModule *Module;
+  uint64_t *ArrayStart, *ArrayEnd, *ArrayCursor;
+  uint64_t Burst, Period, TimerMs; /* sampling, Burst is 0 without */
+  uint64_t Events;    /* events seen so far */
+  uint64_t Left;      /* events left in the current burst */
+  uint64_t NextBurst; /* event, or time in milliseconds, of the next burst */
+  int Operand;        /* the next word is the operand of the last label */
+  int Sampled;        /* the last label was recorded */
+  struct BBTrace *Next;
+} BBTrace;
+
+static BBTrace *Traces;
+static int BBTraceAtExitRegistered;
 
 /* WriteAndFlushBBTraceData - write out the currently accumulated trace data
  * and reset the cursor to point to the beginning of the buffer.
  */
-static void WriteAndFlushBBTraceData () {
-  write_profiling_data(BBTraceInfo, ArrayStart, (ArrayCursor - ArrayStart));
-  ArrayCursor = ArrayStart;
+static void WriteAndFlushBBTraceData (BBTrace *Trace) {
+  ProfiledModule *Current = get_current_module();
+  set_current_module(Trace->Module);
+  write_profiling_data(BBTraceInfo, Trace->ArrayStart,
+                       (Trace->ArrayCursor - Trace->ArrayStart));
+  set_current_module(Current);
+  Trace->ArrayCursor = Trace->ArrayStart;
+}
+
+/* EndBBTrace - Write out the remaining data of a trace and free it. */
+static void EndBBTrace (BBTrace *Trace) {
+  *Trace->ArrayCursor++=BBEOF; //We put in a -1 to indicate the end of a trace
+  WriteAndFlushBBTraceData (Trace);
+  free (Trace->ArrayStart);
+  free (Trace);
 }
 
 /* BBTraceAtExitHandler - When the program exits, just write out any remaining 
- * data and free the trace buffer.
+ * data and free the traces.
  */
 static void BBTraceAtExitHandler(void) {
- *ArrayCursor++=BBEOF; //We put in a -1 to indicate the end of a trace
-  WriteAndFlushBBTraceData ();
-  free (ArrayStart);
+  BBTrace *Trace;
+  while ((Trace = Traces)) {
+    Traces = Trace->Next;
+    EndBBTrace (Trace);
+  }
+}
+
+/* BBTraceModuleExitHandler - End the traces of a module being unloaded. */
+static void BBTraceModuleExitHandler(ProfiledModule *M) {
+  BBTrace **Link = &Traces;
+  while (*Link) {
+    BBTrace *Trace = *Link;
+    if (Trace->Module != M) {
+      Link = &Trace->Next;
+      continue;
+    }
+    *Link = Trace->Next;
+    EndBBTrace (Trace);
+  }
+}
+
+static void AppendBBTraceWord (BBTrace *Trace, uint64_t Word) {
+  *Trace->ArrayCursor++ = Word;
+  if (Trace->ArrayCursor == Trace->ArrayEnd)
+    WriteAndFlushBBTraceData (Trace);
+}
+
+static uint64_t readMilliseconds(void) {
+  struct timespec Now;
+  clock_gettime(CLOCK_MONOTONIC, &Now);
+  return (uint64_t)Now.tv_sec * 1000 + Now.tv_nsec / 1000000;
+}
+
+/* SampleBBTraceEvent - Decide whether the event starting with the next label
+ * is recorded, and start a burst when one is due.
+ */
+static int SampleBBTraceEvent (BBTrace *Trace) {
+  uint64_t Event = Trace->Events++;
+
+  if (!Trace->Left) {
+    if (Trace->TimerMs) {
+      uint64_t Now;
+      if (Event % TRACE_CLOCK_EVENTS)
+        return 0;
+      Now = readMilliseconds();
+      if (Now < Trace->NextBurst)
+        return 0;
+      Trace->NextBurst = Now + Trace->TimerMs;
+    } else {
+      if (Event < Trace->NextBurst)
+        return 0;
+      Trace->NextBurst = Event + Trace->Period;
+    }
+    Trace->Left = Trace->Burst;
+    AppendBBTraceWord (Trace, BBBurst);
+    AppendBBTraceWord (Trace, Event);
+  }
+
+  Trace->Left--;
+  return 1;
+}
+
+/* llvm_trace_basic_block - called upon hitting a new basic block.  Module
+ * points to the trace handle of the module, which is null until the tracing
+ * of the module has been started.
+ */
+void llvm_trace_basic_block (uint64_t *Module, uint64_t BBNum) {
+  BBTrace *Trace = (BBTrace *)(uintptr_t)*Module;
+  if (!Trace)
+    return;
+
+  if (Trace->Burst) {
+    if (Trace->Operand)
+      Trace->Operand = 0;
+    else {
+      Trace->Operand = BBNum == BBFunCall || BBNum == BBMemOp;
+      Trace->Sampled = SampleBBTraceEvent (Trace);
+    }
+    if (!Trace->Sampled)
+      return;
+  }
+
+  AppendBBTraceWord (Trace, BBNum);
 }
 
-/* llvm_trace_basic_block - called upon hitting a new basic block. */
-void llvm_trace_basic_block (uint64_t BBNum) {
-  *ArrayCursor++ = BBNum;
-  if (ArrayCursor == ArrayEnd)
-    WriteAndFlushBBTraceData ();
+/* llvm_trace_memop - called before every traced memory operation, with its
+ * memory record and the address it accesses.
+ */
+void llvm_trace_memop (uint64_t *Module, uint64_t Record, uint64_t Address) {
+  BBTrace *Trace = (BBTrace *)(uintptr_t)*Module;
+  if (!Trace)
+    return;
+
+  if (Trace->Burst && !(Trace->Sampled = SampleBBTraceEvent (Trace)))
+    return;
+
+  AppendBBTraceWord (Trace, Record);
+  AppendBBTraceWord (Trace, Address);
+}
+
+/* SetBBTraceSampling - Take the sampling of the trace from its handle, or
+ * from LLVMPROF_TRACE_SAMPLE if it is set.
+ */
+static void SetBBTraceSampling (BBTrace *Trace, uint64_t *arrayStart,
+                                uint64_t numElements) {
+  const char *Spec = getenv("LLVMPROF_TRACE_SAMPLE");
+
+  Trace->Burst = Trace->Period = Trace->TimerMs = 0;
+  if (numElements * sizeof(uint64_t) >= sizeof(BBTraceHandle)) {
+    BBTraceHandle *Handle = (BBTraceHandle *)arrayStart;
+    Trace->Burst = Handle->burst;
+    Trace->Period = Handle->period;
+    Trace->TimerMs = Handle->timerMs;
+  }
+
+  if (Spec) {
+    unsigned long long Burst = 0, Period = 0;
+    char Unit[3] = "";
+    int Fields = sscanf(Spec, "%llu/%llu%2s", &Burst, &Period, Unit);
+    if (Fields == 1 && Burst == 0)
+      Trace->Burst = 0;
+    else if (Fields >= 2 && Burst && Period &&
+             (Fields == 2 || !strcmp(Unit, "ms"))) {
+      Trace->Burst = Burst;
+      Trace->Period = Fields == 2 ? Period : 0;
+      Trace->TimerMs = Fields == 2 ? 0 : Period;
+    } else
+      fprintf(stderr, "LLVM profiling runtime: ignoring LLVMPROF_TRACE_SAMPLE "
+              "'%s', expected N/M or N/Tms.\n", Spec);
+  }
+
+  Trace->Events = Trace->Left = Trace->NextBurst = 0;
+  Trace->Operand = Trace->Sampled = 0;
 }
 
 /* llvm_start_basic_block_tracing - This is the main entry point of the basic
  * block tracing library.  It is responsible for setting up the atexit
- * handler and allocating the trace buffer.
+ * handler and allocating the trace buffer of the module, which is stored in
+ * its trace handle.
  */
 int llvm_start_basic_block_tracing(int argc, const char **argv,
                               uint64_t *arrayStart,uint64_t numElements) {
   int Ret;
   const unsigned BufferSize = 128 * 1024;
   uint64_t ArraySize;
+  BBTrace *Trace;
 
   Ret = save_arguments(argc, argv);
+  if (!arrayStart || numElements == 0)
+    return Ret;
 
   /* Allocate a buffer to contain BB tracing data */
+  Trace = malloc (sizeof (BBTrace));
   ArraySize = BufferSize / sizeof (uint64_t);
-  ArrayStart = malloc (ArraySize * sizeof (uint64_t));
-  ArrayEnd = ArrayStart + ArraySize;
-  ArrayCursor = ArrayStart;
+  Trace->Module = get_current_module();
+  Trace->ArrayStart = malloc (ArraySize * sizeof (uint64_t));
+  Trace->ArrayEnd = Trace->ArrayStart + ArraySize;
+  Trace->ArrayCursor = Trace->ArrayStart;
+  SetBBTraceSampling (Trace, arrayStart, numElements);
 
   /* Set up the atexit handler. */
-  atexit (BBTraceAtExitHandler);
+  if (!BBTraceAtExitRegistered) {
+    atexit (BBTraceAtExitHandler);
+    BBTraceAtExitRegistered = 1;
+  }
+  register_module_exit_handler (BBTraceModuleExitHandler);
+  Trace->Next = Traces;
+  Traces = Trace;
+  *arrayStart = (uintptr_t)Trace;
 
   return Ret;
 }
@@ -0,0 +1,31 @@
+/*===-- BlockProfiling.c - Support library for block profiling ------------===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+|*===----------------------------------------------------------------------===*|
+|*
+|* This file implements the call back routines for the block profiling
+|* instrumentation pass.  This should be used with the
+|* -insert-block-profiling LLVM pass.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "Profiling.h"
+
+/* llvm_start_block_profiling - This is the main entry point of the block
+ * profiling library.  It is responsible for registering the counters of the
+ * module, which are written out when the program exits.
+ */
+int llvm_start_block_profiling(int argc, const char **argv,
+                               uint64_t *arrayStart, uint64_t numElements) {
+  int Ret = save_arguments(argc, argv);
+  /* Only the blocks whose count cannot be inferred from the others are
+   * counted, the counters of the others are initialised with -1 and are
+   * calculated when the profile is loaded.
+   */
+  register_profiling_array(BlockInfo, arrayStart, numElements);
+  return Ret;
+}
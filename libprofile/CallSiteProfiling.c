@@ -0,0 +1,134 @@
+/*===-- CallSiteProfiling.c - Support library for call site profiling -----===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+|*===----------------------------------------------------------------------===*|
+|*
+|* This file implements the call back routines for the call site profiling
+|* instrumentation pass.  This should be used with the
+|* -insert-callsite-profiling LLVM pass.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "Profiling.h"
+#include "ProfileInfoTypes.h"
+#include <stdlib.h>
+
+static uint64_t *ArrayStart;
+static uint64_t NumElements;
+
+static IndirectCallSiteEntry *IndirectSites;
+static uint64_t NumIndirectSites;
+static void **TargetFunctions;
+static uint64_t NumTargetFunctions;
+
+typedef struct {
+  uint64_t address;
+  uint64_t number;
+} targetNumber_t;
+
+static int compareTargets(const void *LHS, const void *RHS) {
+  uint64_t L = ((const targetNumber_t *)LHS)->address;
+  uint64_t R = ((const targetNumber_t *)RHS)->address;
+  return L < R ? -1 : L > R;
+}
+
+/* translateTargets - Replace the target addresses recorded while the program
+ * ran by function numbers.
+ */
+static void translateTargets(void) {
+  targetNumber_t *Numbers;
+  uint64_t i, j;
+
+  Numbers = malloc(NumTargetFunctions * sizeof(targetNumber_t));
+  for (i = 0; i != NumTargetFunctions; ++i) {
+    Numbers[i].address = (uint64_t)(uintptr_t)TargetFunctions[i];
+    Numbers[i].number = i + 1;
+  }
+  qsort(Numbers, NumTargetFunctions, sizeof(targetNumber_t), compareTargets);
+
+  for (i = 0; i != NumIndirectSites; ++i) {
+    for (j = 0; j != INDIRECT_CALL_TOP_TARGETS; ++j) {
+      targetNumber_t Key, *Found;
+      if (!IndirectSites[i].targets[j].count)
+        break;
+      Key.address = IndirectSites[i].targets[j].target;
+      Found = bsearch(&Key, Numbers, NumTargetFunctions,
+                      sizeof(targetNumber_t), compareTargets);
+      IndirectSites[i].targets[j].target = Found ? Found->number : 0;
+    }
+  }
+
+  free(Numbers);
+}
+
+/* CallSiteProfAtExitHandler - When the program exits, write out the call
+ * counts and the indirect call targets.
+ */
+static void CallSiteProfAtExitHandler(void) {
+  write_profiling_data(CallSiteInfo, ArrayStart, NumElements);
+
+  if (NumIndirectSites) {
+    translateTargets();
+    write_profiling_data(IndirectCallInfo, (uint64_t *)IndirectSites,
+                         NumIndirectSites * sizeof(IndirectCallSiteEntry) /
+                         sizeof(uint64_t));
+  }
+}
+
+/* llvm_profile_indirect_call - Called before every indirect call with the
+ * call site's target table.  Keeps the most frequent targets with the
+ * space-saving algorithm, as llvm_profile_value does: a target missing from
+ * the full table replaces the least frequent one, the last, and inherits its
+ * count.  Targets move up the table as their count passes the ones before
+ * them, so the table stays ordered by count.
+ */
+void llvm_profile_indirect_call(IndirectCallSiteEntry *Site, void *Target) {
+  uint64_t Address = (uint64_t)(uintptr_t)Target;
+  unsigned i;
+
+  for (i = 0; i != INDIRECT_CALL_TOP_TARGETS - 1; ++i) {
+    if (!Site->targets[i].count || Site->targets[i].target == Address)
+      break;
+  }
+
+  Site->targets[i].target = Address;
+  Site->targets[i].count++;
+
+  for (; i && Site->targets[i].count > Site->targets[i-1].count; --i) {
+    uint64_t Count = Site->targets[i].count;
+    Site->targets[i].target = Site->targets[i-1].target;
+    Site->targets[i].count = Site->targets[i-1].count;
+    Site->targets[i-1].target = Address;
+    Site->targets[i-1].count = Count;
+  }
+}
+
+/* llvm_start_indirect_call_profiling - Called from main with the target
+ * tables of the indirect call sites and the functions they may call.
+ */
+void llvm_start_indirect_call_profiling(IndirectCallSiteEntry *Sites,
+                                        uint64_t NumSites,
+                                        void **Functions,
+                                        uint64_t NumFunctions) {
+  IndirectSites = Sites;
+  NumIndirectSites = NumSites;
+  TargetFunctions = Functions;
+  NumTargetFunctions = NumFunctions;
+}
+
+/* llvm_start_callsite_profiling - This is the main entry point of the call
+ * site profiling library.  It is responsible for setting up the atexit
+ * handler.
+ */
+int llvm_start_callsite_profiling(int argc, const char **argv,
+                                  uint64_t *arrayStart, uint64_t numElements) {
+  int Ret = save_arguments(argc, argv);
+  ArrayStart = arrayStart;
+  NumElements = numElements;
+  atexit(CallSiteProfAtExitHandler);
+  return Ret;
+}
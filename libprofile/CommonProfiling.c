@@ -10,6 +10,14 @@
 |* This file implements functions used by the various different types of
 |* profiling implementations.
 |*
+|* The main program writes its profile to llvmprof.out, or to the file given
+|* by LLVMPROF_OUTPUT or -llvmprof-output.  Every other instrumented module
+|* appends its name to that file name.
+|*
+|* Dormant instrumentation only runs while llvm_profile_enabled is set.  It
+|* is set by LLVMPROF_ENABLE, by llvm_profile_set_enabled, or toggled by the
+|* signal given in LLVMPROF_TOGGLE_SIGNAL.
+|*
 \*===----------------------------------------------------------------------===*/
 
 #include "Profiling.h"
@@ -17,6 +25,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <stdio.h>
 #include <string.h>
 #if !defined(_MSC_VER) && !defined(__MINGW32__)
@@ -32,6 +41,45 @@ static const char *SavedEnvVar = 0;
 
 static const char *OutputFilename = "llvmprof.out";
 
+/* Counted down by the checks of sampled instrumentation, shared by all
+ * modules.  A check which counts it down to 0 or below runs instrumented code
+ * until the burst is over, so starting at 1 makes the first check start a
+ * burst.
+ */
+int64_t llvm_profile_sample_countdown = 1;
+
+/* Checked by the probes of dormant instrumentation. */
+volatile int32_t llvm_profile_enabled = 0;
+static int EnableChecked = 0;
+
+struct ProfiledModule {
+  const char *Name;  /* null for the main program */
+  int OutFile;
+  int Unloaded;      /* its destructor ran */
+  struct ProfiledModule *Next;
+};
+
+/* The main program heads the list of registered modules. */
+static ProfiledModule MainProgram = { 0, -1, 0, 0 };
+static ProfiledModule *CurrentModule = &MainProgram;
+
+/* One handler per kind of per-module data in the runtime. */
+#define MAX_MODULE_EXIT_HANDLERS 8
+static ModuleExitHandler ModuleExitHandlers[MAX_MODULE_EXIT_HANDLERS];
+static unsigned NumModuleExitHandlers = 0;
+
+/* The arrays written out by ProfilingArraysAtExitHandler. */
+typedef struct RegisteredArray {
+  ProfiledModule *Module;
+  enum ProfilingType Type;
+  uint64_t *Start;
+  uint64_t NumElements;
+  struct RegisteredArray *Next;
+} RegisteredArray;
+
+static RegisteredArray *RegisteredArrays = 0;
+static int ArraysAtExitRegistered = 0;
+
 /* check_environment_variable - Check to see if the LLVMPROF_OUTPUT environment
  * variable is set.  If it is then save it and set OutputFilename.
  */
@@ -48,6 +96,39 @@ static void check_environment_variable(void) {
   }
 }
 
+void llvm_profile_set_enabled(int Enabled) {
+  llvm_profile_enabled = Enabled != 0;
+}
+
+int llvm_profile_is_enabled(void) {
+  return llvm_profile_enabled;
+}
+
+static void toggle_profiling(int Signal) {
+  llvm_profile_enabled = !llvm_profile_enabled;
+  signal(Signal, toggle_profiling); /* Some systems reset the handler. */
+}
+
+/* check_enable_variables - Enable dormant instrumentation from the start if
+ * LLVMPROF_ENABLE is set to anything but 0, and install the toggle handler
+ * for the signal number in LLVMPROF_TOGGLE_SIGNAL.
+ */
+static void check_enable_variables(void) {
+  const char *EnvVar;
+  if (EnableChecked) return;
+  EnableChecked = 1;
+
+  if ((EnvVar = getenv("LLVMPROF_ENABLE")) != NULL && strcmp(EnvVar, "0"))
+    llvm_profile_enabled = 1;
+
+  if ((EnvVar = getenv("LLVMPROF_TOGGLE_SIGNAL")) != NULL) {
+    int Signal = atoi(EnvVar);
+    if (Signal <= 0 || signal(Signal, toggle_profiling) == SIG_ERR)
+      fprintf(stderr, "LLVM profiling runtime: cannot toggle profiling with "
+              "signal '%s'.\n", EnvVar);
+  }
+}
+
 /* save_arguments - Save argc and argv as passed into the program for the file
  * we output.
  * If either the LLVMPROF_OUTPUT environment variable or the -llvmprof-output
@@ -57,6 +138,7 @@ static void check_environment_variable(void) {
 int save_arguments(int argc, const char **argv) {
   uint64_t Length, i;
   if (!SavedEnvVar && !SavedArgs) check_environment_variable();
+  check_enable_variables();
   if (SavedArgs || !argv) return argc;  /* This can be called multiple times */
 
   /* Check to see if there are any arguments passed into the program for the
@@ -111,45 +193,134 @@ int save_arguments(int argc, const char **argv) {
 }
 
 
+/* llvm_profiling_module - Modules are registered once per name, modules of
+ * the same name share a profile file.  A module loaded again after it was
+ * unloaded appends to its profile file.
+ */
+void llvm_profiling_module(const char *Name) {
+  ProfiledModule *M;
+
+  if (!Name) {
+    CurrentModule = &MainProgram;
+    return;
+  }
+
+  for (M = MainProgram.Next; M; M = M->Next)
+    if (!strcmp(M->Name, Name)) {
+      if (!M->Unloaded)
+        fprintf(stderr, "LLVM profiling runtime: two modules named '%s', "
+                "their profiles are written to the same file.\n", Name);
+      M->Unloaded = 0;
+      CurrentModule = M;
+      return;
+    }
+
+  /* The name lives in the module, which may be unloaded. */
+  M = (ProfiledModule*)malloc(sizeof(ProfiledModule));
+  M->Name = strdup(Name);
+  M->OutFile = -1;
+  M->Unloaded = 0;
+  M->Next = MainProgram.Next;
+  MainProgram.Next = M;
+  CurrentModule = M;
+}
+
+/* llvm_profiling_module_exit - The exit handlers run in the reverse order of
+ * their registration.  The profile file of the module is closed.
+ */
+void llvm_profiling_module_exit(const char *Name) {
+  ProfiledModule *M;
+  unsigned i;
+
+  for (M = MainProgram.Next; M; M = M->Next)
+    if (!M->Unloaded && !strcmp(M->Name, Name))
+      break;
+  if (!M)
+    return;
+
+  CurrentModule = M;
+  for (i = NumModuleExitHandlers; i != 0; --i)
+    ModuleExitHandlers[i-1](M);
+  CurrentModule = &MainProgram;
+
+  if (M->OutFile != -1) {
+    close(M->OutFile);
+    M->OutFile = -1;
+  }
+  M->Unloaded = 1;
+}
+
+void register_module_exit_handler(ModuleExitHandler Handler) {
+  unsigned i;
+
+  for (i = 0; i != NumModuleExitHandlers; ++i)
+    if (ModuleExitHandlers[i] == Handler)
+      return;
+
+  assert(NumModuleExitHandlers != MAX_MODULE_EXIT_HANDLERS &&
+         "Too many module exit handlers!");
+  ModuleExitHandlers[NumModuleExitHandlers++] = Handler;
+}
+
+ProfiledModule *get_current_module(void) {
+  return CurrentModule;
+}
+
+void set_current_module(ProfiledModule *M) {
+  CurrentModule = M ? M : &MainProgram;
+}
+
 /*
- * Retrieves the file descriptor for the profile file.
+ * Retrieves the file descriptor for the profile file of the current module.
  */
 int getOutFile() {
-  static int OutFile = -1;
+  ProfiledModule *M = CurrentModule;
 
   /* If this is the first time this function is called, open the output file
    * for appending, creating it if it does not already exist.
    */
-  if (OutFile == -1) {
-    OutFile = open(OutputFilename, O_CREAT | O_WRONLY, 0666);
-    lseek(OutFile, 0, SEEK_END); /* O_APPEND prevents seeking */
-    if (OutFile == -1) {
+  if (M->OutFile == -1) {
+    const char *Filename = OutputFilename;
+    char *ModuleFilename = 0;
+
+    if (M->Name) {
+      ModuleFilename = (char*)malloc(strlen(OutputFilename) +
+                                     strlen(M->Name) + 2);
+      sprintf(ModuleFilename, "%s.%s", OutputFilename, M->Name);
+      Filename = ModuleFilename;
+    }
+
+    M->OutFile = open(Filename, O_CREAT | O_WRONLY, 0666);
+    lseek(M->OutFile, 0, SEEK_END); /* O_APPEND prevents seeking */
+    if (M->OutFile == -1) {
       fprintf(stderr, "LLVM profiling runtime: while opening '%s': ",
-              OutputFilename);
+              Filename);
       perror("");
-      return(OutFile);
+      free(ModuleFilename);
+      return(M->OutFile);
     }
+    free(ModuleFilename);
 
     /* Output the command line arguments to the file. */
     {
       uint64_t PTy = ArgumentInfo;
       int Zeros = 0;
-      if (write(OutFile, &PTy, sizeof(uint64_t)) < 0 ||
-          write(OutFile, &SavedArgsLength, sizeof(uint64_t)) < 0 ||
-          write(OutFile, SavedArgs, SavedArgsLength) < 0 ) {
+      if (write(M->OutFile, &PTy, sizeof(uint64_t)) < 0 ||
+          write(M->OutFile, &SavedArgsLength, sizeof(uint64_t)) < 0 ||
+          write(M->OutFile, SavedArgs, SavedArgsLength) < 0 ) {
         fprintf(stderr,"error: unable to write to output file.");
         exit(0);
       }
       /* Pad out to a multiple of eight bytes */
       if (SavedArgsLength & 7) {
-        if (write(OutFile, &Zeros, 8-(SavedArgsLength&7)) < 0) {
+        if (write(M->OutFile, &Zeros, 8-(SavedArgsLength&7)) < 0) {
           fprintf(stderr,"error: unable to write to output file.");
           exit(0);
         }
       }
     }
   }
-  return(OutFile);
+  return(M->OutFile);
 }
 
 /* write_profiling_data - Write a raw block of profiling counters out to the
@@ -171,3 +342,82 @@ void write_profiling_data(enum ProfilingType PT, uint64_t *Start,
     exit(0);
   }
 }
+
+/* ProfilingArraysAtExitHandler - Write out the registered arrays, each to the
+ * profile file of its module.  They are forgotten, so that the destructors of
+ * modules which run later do not write them again.
+ */
+static void ProfilingArraysAtExitHandler(void) {
+  RegisteredArray *A;
+
+  while ((A = RegisteredArrays)) {
+    set_current_module(A->Module);
+    write_profiling_data(A->Type, A->Start, A->NumElements);
+    RegisteredArrays = A->Next;
+    free(A);
+  }
+  set_current_module(0);
+}
+
+/* ProfilingArraysModuleExitHandler - Write out and forget the arrays of a
+ * module being unloaded.
+ */
+static void ProfilingArraysModuleExitHandler(ProfiledModule *M) {
+  RegisteredArray **Link = &RegisteredArrays;
+
+  while (*Link) {
+    RegisteredArray *A = *Link;
+    if (A->Module != M) {
+      Link = &A->Next;
+      continue;
+    }
+    write_profiling_data(A->Type, A->Start, A->NumElements);
+    *Link = A->Next;
+    free(A);
+  }
+}
+
+/* register_profiling_array - Arrays are written in the order they were
+ * registered.
+ */
+void register_profiling_array(enum ProfilingType PT, uint64_t *Start,
+                              uint64_t NumElements) {
+  RegisteredArray *A = (RegisteredArray*)malloc(sizeof(RegisteredArray));
+  RegisteredArray **Last = &RegisteredArrays;
+
+  if (!ArraysAtExitRegistered) {
+    atexit(ProfilingArraysAtExitHandler);
+    ArraysAtExitRegistered = 1;
+  }
+  register_module_exit_handler(ProfilingArraysModuleExitHandler);
+
+  A->Module = CurrentModule;
+  A->Type = PT;
+  A->Start = Start;
+  A->NumElements = NumElements;
+  A->Next = 0;
+  while (*Last)
+    Last = &(*Last)->Next;
+  *Last = A;
+}
+
+/* llvm_register_function_map - Entry point of the function maps emitted
+ * along with the counters, see FunctionMapEntry.  The map is written out
+ * with the profile of the current module.
+ */
+int llvm_register_function_map(int argc, const char **argv,
+                               uint64_t *arrayStart, uint64_t numElements) {
+  int Ret = save_arguments(argc, argv);
+  register_profiling_array(FunctionMapInfo, arrayStart, numElements);
+  return Ret;
+}
+
+/* llvm_register_block_map - Entry point of the block maps emitted along with
+ * the function maps.
+ */
+int llvm_register_block_map(int argc, const char **argv,
+                            uint64_t *arrayStart, uint64_t numElements) {
+  int Ret = save_arguments(argc, argv);
+  register_profiling_array(BlockMapInfo, arrayStart, numElements);
+  return Ret;
+}
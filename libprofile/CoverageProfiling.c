@@ -0,0 +1,128 @@
+/*===-- CoverageProfiling.c - Support library for coverage profiling ------===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+|*===----------------------------------------------------------------------===*|
+|*
+|* This file implements the call back routines for the coverage modes of the
+|* edge profiling and basic block tracing passes.  This should be used with the
+|* -insert-edge-profiling -edge-coverage or -trace-basic-blocks -trace-coverage
+|* LLVM passes.
+|*
+|* The instrumented program sets one byte flag per edge or block, which is
+|* packed into a bitmap when the program exits: the number of flags followed
+|* by one bit per flag, 64 to a word, lowest bit first.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "Profiling.h"
+#include <stdlib.h>
+
+/* The flags of one module. */
+typedef struct CoverageFlags {
+  ProfiledModule *Module;
+  enum ProfilingType Type;
+  uint8_t *Flags;
+  uint64_t NumFlags;
+  struct CoverageFlags *Next;
+} CoverageFlags;
+
+static CoverageFlags *RegisteredFlags;
+static int CoverageAtExitRegistered;
+
+/* WriteCoverageBitmap - Pack the flags and write them out as a record of the
+ * given type.
+ */
+static void WriteCoverageBitmap(enum ProfilingType PT, const uint8_t *Flags,
+                                uint64_t NumFlags) {
+  uint64_t NumWords = 1 + (NumFlags + 63) / 64;
+  uint64_t *Bitmap = calloc(NumWords, sizeof(uint64_t));
+  uint64_t i;
+
+  if (!Bitmap)
+    return;
+
+  Bitmap[0] = NumFlags;
+  for (i = 0; i != NumFlags; ++i)
+    if (Flags[i])
+      Bitmap[1 + i / 64] |= 1ULL << (i % 64);
+
+  write_profiling_data(PT, Bitmap, NumWords);
+  free(Bitmap);
+}
+
+/* CoverageAtExitHandler - Write out the flags of every module to its
+ * profile file, and forget them.
+ */
+static void CoverageAtExitHandler(void) {
+  CoverageFlags *C;
+
+  while ((C = RegisteredFlags)) {
+    set_current_module(C->Module);
+    WriteCoverageBitmap(C->Type, C->Flags, C->NumFlags);
+    RegisteredFlags = C->Next;
+    free(C);
+  }
+  set_current_module(0);
+}
+
+/* CoverageModuleExitHandler - Write out and forget the flags of a module
+ * being unloaded.
+ */
+static void CoverageModuleExitHandler(ProfiledModule *M) {
+  CoverageFlags **Link = &RegisteredFlags;
+
+  while (*Link) {
+    CoverageFlags *C = *Link;
+    if (C->Module != M) {
+      Link = &C->Next;
+      continue;
+    }
+    WriteCoverageBitmap(C->Type, C->Flags, C->NumFlags);
+    *Link = C->Next;
+    free(C);
+  }
+}
+
+static void registerCoverageFlags(enum ProfilingType PT, uint8_t *Flags,
+                                  uint64_t NumFlags) {
+  CoverageFlags *C = malloc(sizeof(CoverageFlags));
+
+  if (!CoverageAtExitRegistered) {
+    atexit(CoverageAtExitHandler);
+    CoverageAtExitRegistered = 1;
+  }
+  register_module_exit_handler(CoverageModuleExitHandler);
+
+  C->Module = get_current_module();
+  C->Type = PT;
+  C->Flags = Flags;
+  C->NumFlags = NumFlags;
+  C->Next = RegisteredFlags;
+  RegisteredFlags = C;
+}
+
+/* llvm_start_edge_coverage - This is the main entry point of the edge
+ * coverage library.  It is responsible for registering the flags of the
+ * module, which are written out when the program exits.
+ */
+int llvm_start_edge_coverage(int argc, const char **argv,
+                             uint8_t *arrayStart, uint64_t numElements) {
+  int Ret = save_arguments(argc, argv);
+  registerCoverageFlags(EdgeCoverageInfo, arrayStart, numElements);
+  return Ret;
+}
+
+/* llvm_start_block_coverage - This is the main entry point of the block
+ * coverage library.  It is responsible for registering the flags of the
+ * module, which are written out when the program exits.
+ */
+int llvm_start_block_coverage(int argc, const char **argv,
+                              uint8_t *arrayStart, uint64_t numElements) {
+  int Ret = save_arguments(argc, argv);
+  registerCoverageFlags(BlockCoverageInfo, arrayStart, numElements);
+  return Ret;
+}
@@ -14,32 +14,19 @@
 \*===----------------------------------------------------------------------===*/
 
 #include "Profiling.h"
-#include <stdlib.h>
-
-static uint64_t *ArrayStart;
-static uint64_t NumElements;
-
-/* EdgeProfAtExitHandler - When the program exits, just write out the profiling
- * data.
- */
-static void EdgeProfAtExitHandler(void) {
-  /* Note that if this were doing something more intelligent with the
-   * instrumentation, we could do some computation here to expand what we
-   * collected into simple edge profiles.  Since we directly count each edge, we
-   * just write out all of the counters directly.
-   */
-  write_profiling_data(EdgeInfo, ArrayStart, NumElements);
-}
-
 
 /* llvm_start_edge_profiling - This is the main entry point of the edge
- * profiling library.  It is responsible for setting up the atexit handler.
+ * profiling library.  It is responsible for registering the counters of the
+ * module, which are written out when the program exits.
  */
 int llvm_start_edge_profiling(int argc, const char **argv,
                               uint64_t *arrayStart, uint64_t numElements) {
   int Ret = save_arguments(argc, argv);
-  ArrayStart = arrayStart;
-  NumElements = numElements;
-  atexit(EdgeProfAtExitHandler);
+  /* Note that if this were doing something more intelligent with the
+   * instrumentation, we could do some computation at exit to expand what we
+   * collected into simple edge profiles.  Since we directly count each edge, we
+   * just write out all of the counters directly.
+   */
+  register_profiling_array(EdgeInfo, arrayStart, numElements);
   return Ret;
 }
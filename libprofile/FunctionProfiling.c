@@ -0,0 +1,27 @@
+/*===-- FunctionProfiling.c - Support library for function profiling ------===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+|*===----------------------------------------------------------------------===*|
+|*
+|* This file implements the call back routines for the function profiling
+|* instrumentation pass.  This should be used with the
+|* -insert-function-profiling LLVM pass.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "Profiling.h"
+
+/* llvm_start_function_profiling - This is the main entry point of the
+ * function profiling library.  It is responsible for registering the entry
+ * counters of the module, which are written out when the program exits.
+ */
+int llvm_start_function_profiling(int argc, const char **argv,
+                                  uint64_t *arrayStart, uint64_t numElements) {
+  int Ret = save_arguments(argc, argv);
+  register_profiling_array(FunctionInfo, arrayStart, numElements);
+  return Ret;
+}
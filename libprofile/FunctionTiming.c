@@ -0,0 +1,249 @@
+/*===-- FunctionTiming.c - Support library for function timing ------------===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+|*===----------------------------------------------------------------------===*|
+|*
+|* This file implements the call back routines for the function timing
+|* instrumentation pass.  This should be used with the -insert-function-timing
+|* LLVM pass.
+|*
+|* Time is read from the time stamp counter on x86 and from the monotonic
+|* clock elsewhere.  The cost of the instrumentation is measured when the
+|* profiling starts and subtracted from every activation and its caller.  Not
+|* thread safe, like the other counters.
+|*
+|* Timed regions read the clock minus the cost of all the probes run so far,
+|* so that the probes of the functions they call are not counted in them.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "Profiling.h"
+#include "ProfileInfoTypes.h"
+#include <stdlib.h>
+#if !defined(__i386__) && !defined(__x86_64__)
+#include <time.h>
+#endif
+
+#define TIMING_MAX_DEPTH 4096
+#define TIMING_CALIBRATION_ROUNDS 1000
+
+typedef struct {
+  uint64_t function;
+  char *frame;
+  uint64_t start;
+  uint64_t children; /* time of the callees, including their probes */
+} timingFrame_t;
+
+static FunctionTimingEntry *Timings;
+static uint64_t NumFunctions;
+static uint64_t *ActiveCounts; /* activations of every function on the stack */
+
+static timingFrame_t Stack[TIMING_MAX_DEPTH];
+static uint64_t Depth;
+static uint64_t Overflow; /* activations beyond the stack */
+
+static RegionTimingEntry *Regions;
+static uint64_t NumRegions;
+
+static uint64_t ReadOverhead; /* measured between two reads */
+static uint64_t PairOverhead; /* added to the caller by a probe pair */
+static uint64_t RegionPairOverhead; /* the same for a region probe pair */
+static uint64_t ProbeCost; /* of all the probe pairs run so far */
+
+static uint64_t readTime(void) {
+#if defined(__i386__) || defined(__x86_64__)
+  uint32_t Low, High;
+  __asm__ __volatile__ ("rdtsc" : "=a" (Low), "=d" (High));
+  return ((uint64_t)High << 32) | Low;
+#else
+  struct timespec Now;
+  clock_gettime(CLOCK_MONOTONIC, &Now);
+  return (uint64_t)Now.tv_sec * 1000000000 + Now.tv_nsec;
+#endif
+}
+
+/* Close the innermost activation at time Now. */
+static void popFrame(uint64_t Now) {
+  timingFrame_t *Top = &Stack[--Depth];
+  uint64_t Elapsed = Now - Top->start;
+  uint64_t Exclusive;
+
+  Elapsed = Elapsed > ReadOverhead ? Elapsed - ReadOverhead : 0;
+  Exclusive = Elapsed > Top->children ? Elapsed - Top->children : 0;
+
+  if (Top->function < NumFunctions) {
+    FunctionTimingEntry *Entry = &Timings[Top->function];
+    Entry->calls++;
+    Entry->exclusive += Exclusive;
+    if (--ActiveCounts[Top->function] == 0)
+      Entry->inclusive += Elapsed;
+  }
+
+  if (Depth)
+    Stack[Depth-1].children += Elapsed + PairOverhead;
+  ProbeCost += PairOverhead;
+}
+
+/* llvm_timing_enter - Called on entry of every profiled function.  Frames
+ * not above the new one were left by unwinding and are closed.
+ */
+void llvm_timing_enter(uint64_t Function, void *Frame) {
+  timingFrame_t *Top;
+
+  if (!Timings)
+    return;
+
+  if (!Overflow)
+    while (Depth && Stack[Depth-1].frame <= (char *)Frame)
+      popFrame(readTime());
+
+  if (Depth == TIMING_MAX_DEPTH) {
+    Overflow++;
+    return;
+  }
+
+  if (Function < NumFunctions)
+    ActiveCounts[Function]++;
+
+  Top = &Stack[Depth++];
+  Top->function = Function;
+  Top->frame = Frame;
+  Top->children = 0;
+  Top->start = readTime();
+}
+
+/* llvm_timing_leave - Called before every return of a profiled function.
+ * Frames below this one were left by unwinding and are closed first.
+ */
+void llvm_timing_leave(void *Frame) {
+  uint64_t Now = readTime();
+
+  if (!Timings)
+    return;
+
+  if (Overflow) {
+    Overflow--;
+    return;
+  }
+
+  while (Depth && Stack[Depth-1].frame < (char *)Frame)
+    popFrame(Now);
+  if (Depth && Stack[Depth-1].frame == (char *)Frame)
+    popFrame(Now);
+}
+
+/* llvm_timing_region_enter - Called first in every timed region.  The start
+ * time it returns is passed back to llvm_timing_region_leave.
+ */
+uint64_t llvm_timing_region_enter(void) {
+  return readTime() - ProbeCost;
+}
+
+/* llvm_timing_region_leave - Called before the terminator of every timed
+ * region.
+ */
+void llvm_timing_region_leave(uint64_t Region, uint64_t Start) {
+  int64_t Elapsed = (int64_t)(readTime() - ProbeCost - Start) -
+                    (int64_t)ReadOverhead;
+
+  if (Region < NumRegions) {
+    Regions[Region].executions++;
+    Regions[Region].cycles += Elapsed > 0 ? Elapsed : 0;
+  }
+
+  if (Depth)
+    Stack[Depth-1].children += RegionPairOverhead;
+  ProbeCost += RegionPairOverhead;
+}
+
+/* Measure the cost of the probes. */
+static void calibrate(void) {
+  char Frame;
+  uint64_t i, Start, Cost;
+
+  ReadOverhead = ~0ULL;
+  for (i = 0; i != TIMING_CALIBRATION_ROUNDS; ++i) {
+    Start = readTime();
+    Cost = readTime() - Start;
+    if (Cost < ReadOverhead)
+      ReadOverhead = Cost;
+  }
+
+  /* Time probe pairs of a function which is not accounted. */
+  PairOverhead = ~0ULL;
+  for (i = 0; i != TIMING_CALIBRATION_ROUNDS; ++i) {
+    Start = readTime();
+    llvm_timing_enter(NumFunctions, &Frame);
+    llvm_timing_leave(&Frame);
+    Cost = readTime() - Start;
+    Cost = Cost > ReadOverhead ? Cost - ReadOverhead : 0;
+    if (Cost < PairOverhead)
+      PairOverhead = Cost;
+  }
+  ProbeCost = 0;
+}
+
+/* TimingAtExitHandler - When the program exits, close the activations still
+ * open, such as main's when exit() is called, and write out the timings.
+ */
+static void TimingAtExitHandler(void) {
+  uint64_t Now = readTime();
+
+  Overflow = 0;
+  while (Depth)
+    popFrame(Now);
+
+  write_profiling_data(TimingInfo, (uint64_t *)Timings,
+                       NumFunctions * sizeof(FunctionTimingEntry) /
+                       sizeof(uint64_t));
+  if (NumRegions)
+    write_profiling_data(RegionTimingInfo, (uint64_t *)Regions,
+                         NumRegions * sizeof(RegionTimingEntry) /
+                         sizeof(uint64_t));
+}
+
+/* llvm_start_function_timing - This is the main entry point of the function
+ * timing library.  It is responsible for calibrating the probes and setting
+ * up the atexit handler.
+ */
+int llvm_start_function_timing(int argc, const char **argv,
+                               uint64_t *arrayStart, uint64_t numElements) {
+  int Ret = save_arguments(argc, argv);
+
+  NumFunctions = numElements * sizeof(uint64_t) / sizeof(FunctionTimingEntry);
+  ActiveCounts = calloc(NumFunctions + 1, sizeof(uint64_t));
+  Timings = (FunctionTimingEntry *)arrayStart;
+  calibrate();
+
+  atexit(TimingAtExitHandler);
+  return Ret;
+}
+
+/* llvm_start_region_timing - Start timing the regions.  It runs after
+ * llvm_start_function_timing, which measured the cost of reading the clock,
+ * and writes out its data from the same atexit handler.
+ */
+int llvm_start_region_timing(int argc, const char **argv,
+                             uint64_t *arrayStart, uint64_t numElements) {
+  int Ret = save_arguments(argc, argv);
+  uint64_t i, Start, Cost, MinCost = ~0ULL;
+
+  /* Time probe pairs of a region which is not accounted. */
+  for (i = 0; i != TIMING_CALIBRATION_ROUNDS; ++i) {
+    Start = readTime();
+    llvm_timing_region_leave(0, llvm_timing_region_enter());
+    Cost = readTime() - Start;
+    Cost = Cost > ReadOverhead ? Cost - ReadOverhead : 0;
+    if (Cost < MinCost)
+      MinCost = Cost;
+  }
+  RegionPairOverhead = MinCost;
+
+  NumRegions = numElements * sizeof(uint64_t) / sizeof(RegionTimingEntry);
+  Regions = (RegionTimingEntry *)arrayStart;
+  return Ret;
+}
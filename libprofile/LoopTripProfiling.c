@@ -0,0 +1,49 @@
+/*===-- LoopTripProfiling.c - Support library for loop trip counts --------===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+|*===----------------------------------------------------------------------===*|
+|*
+|* This file implements the call back routines for the loop trip count
+|* profiling instrumentation pass.  This should be used with the
+|* -insert-looptrip-profiling LLVM pass.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "Profiling.h"
+#include "ProfileInfoTypes.h"
+
+/* llvm_loop_trip - Called on every exit edge of a loop with the number of
+ * times its header ran since the loop was last left.  Zero trip counts come
+ * from entering an exit block other than by leaving the loop and are
+ * ignored.
+ */
+void llvm_loop_trip(LoopTripEntry *Loop, uint64_t Trips) {
+  unsigned Bucket = 0;
+
+  if (!Trips)
+    return;
+
+  Loop->iterations += Trips;
+  while (Trips >>= 1)
+    ++Bucket;
+  if (Bucket >= LOOP_TRIP_BUCKETS)
+    Bucket = LOOP_TRIP_BUCKETS - 1;
+  Loop->buckets[Bucket]++;
+}
+
+/* llvm_start_loop_trip_profiling - This is the main entry point of the loop
+ * trip count profiling library.  It is responsible for registering the
+ * histograms of the module, the instrumentation keeps them in the record's
+ * layout.
+ */
+int llvm_start_loop_trip_profiling(int argc, const char **argv,
+                                   uint64_t *arrayStart,
+                                   uint64_t numElements) {
+  int Ret = save_arguments(argc, argv);
+  register_profiling_array(LoopTripInfo, arrayStart, numElements);
+  return Ret;
+}
@@ -14,32 +14,19 @@
 \*===----------------------------------------------------------------------===*/
 
 #include "Profiling.h"
-#include <stdlib.h>
 
-static uint64_t *ArrayStart;
-static uint64_t NumElements;
-
-/* OptEdgeProfAtExitHandler - When the program exits, just write out the
- * profiling data.
+/* llvm_start_opt_edge_profiling - This is the main entry point of the edge
+ * profiling library.  It is responsible for registering the counters of the
+ * module, which are written out when the program exits.
  */
-static void OptEdgeProfAtExitHandler(void) {
+int llvm_start_opt_edge_profiling(int argc, const char **argv,
+                                  uint64_t *arrayStart, uint64_t numElements) {
+  int Ret = save_arguments(argc, argv);
   /* Note that, although the array has a counter for each edge, not all
    * counters are updated, the ones that are not used are initialised with -1.
    * When loading this information the counters with value -1 have to be
    * recalculated, it is guaranteed that this is possible.
    */
-  write_profiling_data(OptEdgeInfo, ArrayStart, NumElements);
-}
-
-
-/* llvm_start_opt_edge_profiling - This is the main entry point of the edge
- * profiling library.  It is responsible for setting up the atexit handler.
- */
-int llvm_start_opt_edge_profiling(int argc, const char **argv,
-                                  uint64_t *arrayStart, uint64_t numElements) {
-  int Ret = save_arguments(argc, argv);
-  ArrayStart = arrayStart;
-  NumElements = numElements;
-  atexit(OptEdgeProfAtExitHandler);
+  register_profiling_array(OptEdgeInfo, arrayStart, numElements);
   return Ret;
 }
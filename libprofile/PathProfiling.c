@@ -47,9 +47,17 @@ typedef struct {
   void* array;
 } ftEntry_t;
 
-/* pointer to the function table allocated in the instrumented program */
-ftEntry_t* ft;
-uint64_t ftSize;
+/* the function table allocated in an instrumented module */
+typedef struct pathModule_s {
+  ProfiledModule* module;
+  ftEntry_t* ft;
+  uint64_t ftSize;
+  struct pathModule_s* next;
+} pathModule_t;
+
+/* the function tables of all instrumented modules */
+static pathModule_t* pathModules;
+static int pathAtExitRegistered;
 
 /* write an array table to file */
 void writeArrayTable(uint64_t fNumber, ftEntry_t* ft, uint64_t* funcCount) {
@@ -151,16 +159,16 @@ void writeHashTable(uint64_t functionNumber, pathHashTable_t* hashTable) {
 }
 
 /* Return a pointer to this path's specific path counter */
-static uint64_t* getPathCounter(uint64_t functionNumber,
+static uint64_t* getPathCounter(ftEntry_t* function,
                                        uint64_t pathNumber) {
   pathHashTable_t* hashTable;
   pathHashEntry_t* hashEntry;
   uint64_t index = hash(pathNumber);
 
-  if( ft[functionNumber-1].array == 0)
-    ft[functionNumber-1].array = calloc(sizeof(pathHashTable_t), 1);
+  if( function->array == 0)
+    function->array = calloc(sizeof(pathHashTable_t), 1);
 
-  hashTable = (pathHashTable_t*)((ftEntry_t*)ft)[functionNumber-1].array;
+  hashTable = (pathHashTable_t*)function->array;
   hashEntry = hashTable->hashBins[index];
 
   while (hashEntry) {
@@ -180,21 +188,236 @@ static uint64_t* getPathCounter(uint64_t functionNumber,
   return &hashEntry->pathCount;
 }
 
-/* Increment a specific path's count */
-void llvm_increment_path_count (uint64_t functionNumber, uint64_t pathNumber) {
-  uint64_t* pathCounter = getPathCounter(functionNumber, pathNumber);
+/* Increment a specific path's count.  Functions are passed as their entry in
+   the function table of their module. */
+void llvm_increment_path_count (ftEntry_t* function, uint64_t pathNumber) {
+  uint64_t* pathCounter = getPathCounter(function, pathNumber);
   if( *pathCounter < 0xffffffff )
     (*pathCounter)++;
 }
 
 /* Decrement a specific path's count */
-void llvm_decrement_path_count (uint64_t functionNumber, uint64_t pathNumber) {
-  uint64_t* pathCounter = getPathCounter(functionNumber, pathNumber);
+void llvm_decrement_path_count (ftEntry_t* function, uint64_t pathNumber) {
+  uint64_t* pathCounter = getPathCounter(function, pathNumber);
   (*pathCounter)--;
 }
 
 /*
- * Writes out a path profile given a function table, in the following format.
+ * Extended paths.  The instrumentation reports the end of every Ball-Larus
+ * path and the entry and exit of every profiled function.  A shadow stack
+ * holds the activations of profiled functions, with their last k completed
+ * paths and the first paths of the functions they called during their
+ * current path.  Not thread safe, like the path counters.
+ */
+#define EXTENDED_PATH_MAX_K 8
+#define EXTENDED_PATH_MAX_DEPTH 1024
+#define EXTENDED_PATH_PENDING_CALLS 4
+#define EXTENDED_PATH_HASH_BIN_COUNT 4093
+
+typedef struct extendedPathHashEntry_s {
+  ExtendedPathHeader header;
+  struct extendedPathHashEntry_s* next;
+  ExtendedPathEntry paths[EXTENDED_PATH_MAX_K];
+} extendedPathHashEntry_t;
+
+typedef struct {
+  uint64_t fnNumber;
+  char* frame;
+  uint64_t numPaths;  /* paths completed in this activation */
+  uint64_t history[EXTENDED_PATH_MAX_K];
+  uint64_t numCallees;
+  ExtendedPathEntry callees[EXTENDED_PATH_PENDING_CALLS];
+} extendedPathFrame_t;
+
+/* number of paths per loop-iteration path, 0 if extended paths are off */
+static uint64_t extendedK;
+static extendedPathFrame_t extendedStack[EXTENDED_PATH_MAX_DEPTH];
+static uint64_t extendedDepth;
+static uint64_t extendedOverflow; /* activations beyond the shadow stack */
+static extendedPathHashEntry_t* extendedBins[EXTENDED_PATH_HASH_BIN_COUNT];
+static uint64_t extendedPathCount;
+
+/* count one execution of the extended path of the given kind */
+static void recordExtendedPath(uint64_t kind, const ExtendedPathEntry* paths,
+                               uint64_t length) {
+  /* FNV-1a over the path numbers */
+  uint64_t h = 14695981039346656037ULL ^ kind;
+  uint64_t i;
+  extendedPathHashEntry_t* entry;
+
+  for (i = 0; i < length; i++) {
+    h = (h ^ paths[i].fnNumber) * 1099511628211ULL;
+    h = (h ^ paths[i].pathNumber) * 1099511628211ULL;
+  }
+  h %= EXTENDED_PATH_HASH_BIN_COUNT;
+
+  for (entry = extendedBins[h]; entry; entry = entry->next) {
+    if (entry->header.kind == kind && entry->header.length == length &&
+        !memcmp(entry->paths, paths, length * sizeof(ExtendedPathEntry))) {
+      entry->header.count++;
+      return;
+    }
+  }
+
+  entry = malloc(sizeof(extendedPathHashEntry_t));
+  entry->header.kind = kind;
+  entry->header.length = length;
+  entry->header.count = 1;
+  memcpy(entry->paths, paths, length * sizeof(ExtendedPathEntry));
+  entry->next = extendedBins[h];
+  extendedBins[h] = entry;
+  extendedPathCount++;
+}
+
+/* llvm_start_extended_path_profiling - Called from main before any profiled
+ * function is entered, with the number of paths per loop-iteration path.
+ */
+void llvm_start_extended_path_profiling(uint64_t k) {
+  if (k > EXTENDED_PATH_MAX_K)
+    k = EXTENDED_PATH_MAX_K;
+  extendedK = k ? k : 1;
+}
+
+/* Push an activation of a profiled function.  Activations whose frames are
+ * not above the new one were left by unwinding and are dropped.
+ */
+void llvm_path_enter_function(uint64_t functionNumber, void* frame) {
+  extendedPathFrame_t* top;
+
+  if (!extendedK)
+    return;
+
+  if (!extendedOverflow)
+    while (extendedDepth &&
+           extendedStack[extendedDepth-1].frame <= (char*)frame)
+      extendedDepth--;
+
+  if (extendedDepth == EXTENDED_PATH_MAX_DEPTH) {
+    extendedOverflow++;
+    return;
+  }
+
+  top = &extendedStack[extendedDepth++];
+  top->fnNumber = functionNumber;
+  top->frame = frame;
+  top->numPaths = 0;
+  top->numCallees = 0;
+}
+
+/* Pop the activation of a returning profiled function */
+void llvm_path_leave_function(void) {
+  if (!extendedK)
+    return;
+
+  if (extendedOverflow)
+    extendedOverflow--;
+  else if (extendedDepth)
+    extendedDepth--;
+}
+
+/* A Ball-Larus path of the innermost profiled activation ended */
+void llvm_path_end(uint64_t functionNumber, uint64_t pathNumber) {
+  extendedPathFrame_t* top;
+  ExtendedPathEntry paths[EXTENDED_PATH_MAX_K];
+  uint64_t i;
+
+  if (!extendedK || extendedOverflow || !extendedDepth)
+    return;
+
+  top = &extendedStack[extendedDepth-1];
+  if (top->fnNumber != functionNumber)
+    return;
+
+  /* the first path of an activation continues the caller's current path,
+     which is only known once it ends */
+  if (top->numPaths == 0 && extendedDepth > 1) {
+    extendedPathFrame_t* caller = top - 1;
+    if (caller->numCallees < EXTENDED_PATH_PENDING_CALLS) {
+      caller->callees[caller->numCallees].fnNumber = functionNumber;
+      caller->callees[caller->numCallees].pathNumber = pathNumber;
+      caller->numCallees++;
+    }
+  }
+
+  paths[0].fnNumber = functionNumber;
+  paths[0].pathNumber = pathNumber;
+  for (i = 0; i < top->numCallees; i++) {
+    paths[1] = top->callees[i];
+    recordExtendedPath(CallSpanningPath, paths, 2);
+  }
+  top->numCallees = 0;
+
+  /* consecutive paths of an activation are joined by backedges */
+  top->history[top->numPaths % extendedK] = pathNumber;
+  top->numPaths++;
+  if (extendedK > 1 && top->numPaths >= extendedK) {
+    for (i = 0; i < extendedK; i++) {
+      paths[i].fnNumber = functionNumber;
+      paths[i].pathNumber =
+        top->history[(top->numPaths - extendedK + i) % extendedK];
+    }
+    recordExtendedPath(LoopIterationPath, paths, extendedK);
+  }
+}
+
+/*
+ * Writes out the extended paths in the following format.
+ *
+ *      | <-- 64 bits --> |
+ *      +-----------------+-----------------+-----------------+
+ * 0x00 | profileType     | pathCount       |
+ *      +-----------------+-----------------+-----------------+
+ * 0x10 | kind            | length          | count           |  // path 1
+ *      +-----------------+-----------------+-----------------+
+ *  ... | functionNum     | pathNumber      |  // Ball-Larus path 1.1
+ *      +-----------------+-----------------+
+ *  ... |       ...       |       ...       |  // Ball-Larus path 1.length
+ *      +-----------------+-----------------+-----------------+
+ *  ... | kind            | length          | count           |  // path 2
+ *      +-----------------+-----------------+-----------------+
+ *  ... |       ...       |       ...       |
+ *
+ */
+static void writeExtendedPaths(void) {
+  int outFile = getOutFile();
+  uint64_t header[2] = { ExtendedPathInfo, 0 };
+  uint64_t i;
+
+  if (!extendedPathCount)
+    return;
+
+  header[1] = extendedPathCount;
+  if (write(outFile, header, sizeof(header)) < 0) {
+    fprintf(stderr,
+            "error: unable to write extended path header to output file.\n");
+    return;
+  }
+
+  for (i = 0; i < EXTENDED_PATH_HASH_BIN_COUNT; i++) {
+    extendedPathHashEntry_t* entry = extendedBins[i];
+
+    while (entry) {
+      extendedPathHashEntry_t* temp;
+
+      if (write(outFile, &entry->header, sizeof(ExtendedPathHeader)) < 0 ||
+          write(outFile, entry->paths,
+                entry->header.length * sizeof(ExtendedPathEntry)) < 0) {
+        fprintf(stderr,
+                "error: unable to write extended path to output file.\n");
+        return;
+      }
+
+      temp = entry;
+      entry = entry->next;
+      free(temp);
+    }
+    extendedBins[i] = 0;
+  }
+}
+
+/*
+ * Writes out the path profile of a module given its function table, in the
+ * following format.
  *
  *
  *      | <-- 64 bits --> |
@@ -219,7 +442,8 @@ void llvm_decrement_path_count (uint64_t functionNumber, uint64_t pathNumber) {
  *      +-----------------+-----------------+
  *
  */
-static void pathProfAtExitHandler(void) {
+static void writePathTable(pathModule_t* module) {
+  ftEntry_t* ft = module->ft;
   int outFile = getOutFile();
   uint64_t i;
   uint64_t header[2] = { PathInfo, 0 };
@@ -231,7 +455,7 @@ static void pathProfAtExitHandler(void) {
   lseek(outFile, 2*sizeof(uint64_t), SEEK_CUR);
 
   /* Iterate through each function */
-  for( i = 0; i < ftSize; i++ ) {
+  for( i = 0; i < module->ftSize; i++ ) {
     if( ft[i].type == ProfilingArray ) {
       writeArrayTable(i+1,&ft[i],&header[1]);
 
@@ -257,15 +481,57 @@ static void pathProfAtExitHandler(void) {
 
   lseek(outFile, currentLocation, SEEK_SET);
 }
+
+/* Write the path profiles of all modules to their profile files, and forget
+   them.  Extended paths are only recorded in the main program. */
+static void pathProfAtExitHandler(void) {
+  pathModule_t* module;
+
+  while( (module = pathModules) ) {
+    set_current_module(module->module);
+    writePathTable(module);
+    pathModules = module->next;
+    free(module);
+  }
+
+  set_current_module(0);
+  writeExtendedPaths();
+}
+
+/* Write and forget the path profiles of a module being unloaded. */
+static void pathProfModuleExitHandler(ProfiledModule* unloaded) {
+  pathModule_t** link = &pathModules;
+
+  while( *link ) {
+    pathModule_t* module = *link;
+    if( module->module != unloaded ) {
+      link = &module->next;
+      continue;
+    }
+    writePathTable(module);
+    *link = module->next;
+    free(module);
+  }
+}
 /* llvm_start_path_profiling - This is the main entry point of the path
  * profiling library.  It is responsible for setting up the atexit handler.
  */
 int llvm_start_path_profiling(int argc, const char** argv,
                               void* functionTable, uint64_t numElements) {
   int Ret = save_arguments(argc, argv);
-  ft = functionTable;
-  ftSize = numElements;
-  atexit(pathProfAtExitHandler);
+  pathModule_t* module = malloc(sizeof(pathModule_t));
+
+  if( !pathAtExitRegistered ) {
+    atexit(pathProfAtExitHandler);
+    pathAtExitRegistered = 1;
+  }
+  register_module_exit_handler(pathProfModuleExitHandler);
+
+  module->module = get_current_module();
+  module->ft = functionTable;
+  module->ftSize = numElements;
+  module->next = pathModules;
+  pathModules = module;
 
   return Ret;
 }
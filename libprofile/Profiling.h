@@ -23,8 +23,47 @@
  */
 int save_arguments(int argc, const char **argv);
 
+/* llvm_profile_set_enabled - Turn the probes of dormant instrumentation on or
+ * off.  Instrumentation which is not dormant always runs.
+ */
+void llvm_profile_set_enabled(int Enabled);
+
+/* llvm_profile_is_enabled - Whether the probes of dormant instrumentation
+ * run.
+ */
+int llvm_profile_is_enabled(void);
+
+/* A module registered with the runtime: the main program, or a library or
+ * plugin without main() which registers itself from a global constructor.
+ * Every module has its own profile file.
+ */
+typedef struct ProfiledModule ProfiledModule;
+
+/* llvm_profiling_module - Called by the global constructor of an instrumented
+ * module without main() around the entry points of its instrumentation.  A
+ * name registers the module and makes it current, null returns to the main
+ * program.
+ */
+void llvm_profiling_module(const char *Name);
+
+/* llvm_profiling_module_exit - Called by the global destructor of such a
+ * module, when it is unloaded or when the program exits.  The data of the
+ * module lives in it, so it is written out and forgotten.
+ */
+void llvm_profiling_module_exit(const char *Name);
+
+/* get_current_module - The module whose instrumentation is being started,
+ * the main program outside of the global constructors of other modules.
+ */
+ProfiledModule *get_current_module(void);
+
+/* set_current_module - Direct getOutFile and write_profiling_data to the
+ * profile file of M, or of the main program if M is null.
+ */
+void set_current_module(ProfiledModule *M);
+
 /*
- * Retrieves the file descriptor for the profile file.
+ * Retrieves the file descriptor for the profile file of the current module.
  */
 int getOutFile();
 
@@ -34,4 +73,20 @@ int getOutFile();
 void write_profiling_data(enum ProfilingType PT, uint64_t *Start,
                           uint64_t NumElements);
 
+/* register_profiling_array - Write out the array as a packet of the current
+ * module when the program exits.
+ */
+void register_profiling_array(enum ProfilingType PT, uint64_t *Start,
+                              uint64_t NumElements);
+
+/* A module exit handler writes out and forgets the data of module M, which
+ * is current while it runs.
+ */
+typedef void (*ModuleExitHandler)(ProfiledModule *M);
+
+/* register_module_exit_handler - Run Handler for every module unloaded from
+ * now on.  Registering a handler again has no effect.
+ */
+void register_module_exit_handler(ModuleExitHandler Handler);
+
 #endif
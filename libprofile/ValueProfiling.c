@@ -0,0 +1,54 @@
+/*===-- ValueProfiling.c - Support library for value profiling ------------===*\
+|*
+|*                     The LLVM Compiler Infrastructure
+|*
+|* This file is distributed under the University of Illinois Open Source
+|* License. See LICENSE.TXT for details.
+|*
+|*===----------------------------------------------------------------------===*|
+|*
+|* This file implements the call back routines for the value profiling
+|* instrumentation pass.  This should be used with the -insert-value-profiling
+|* LLVM pass.
+|*
+\*===----------------------------------------------------------------------===*/
+
+#include "Profiling.h"
+#include "ProfileInfoTypes.h"
+
+/* llvm_profile_value - Called by every value profiling site with the value
+ * of its operand.  Keeps the most frequent values with the space-saving
+ * algorithm.
+ */
+void llvm_profile_value(ValueProfileSiteEntry *Site, uint64_t Value) {
+  unsigned i, Least = 0;
+
+  Site->total++;
+  for (i = 0; i != VALUE_PROFILE_TOP_VALUES; ++i) {
+    if (!Site->values[i].count) {
+      Site->values[i].value = Value;
+      Site->values[i].count = 1;
+      return;
+    }
+    if (Site->values[i].value == Value) {
+      Site->values[i].count++;
+      return;
+    }
+    if (Site->values[i].count < Site->values[Least].count)
+      Least = i;
+  }
+
+  Site->values[Least].value = Value;
+  Site->values[Least].count++;
+}
+
+/* llvm_start_value_profiling - This is the main entry point of the value
+ * profiling library.  It is responsible for registering the site tables of
+ * the module, the instrumentation keeps them in the record's layout.
+ */
+int llvm_start_value_profiling(int argc, const char **argv,
+                               uint64_t *arrayStart, uint64_t numElements) {
+  int Ret = save_arguments(argc, argv);
+  register_profiling_array(ValueInfo, arrayStart, numElements);
+  return Ret;
+}
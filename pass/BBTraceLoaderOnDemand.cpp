@@ -25,6 +25,7 @@ namespace {
 		bool BBTraceFinished=false;
 
 		std::vector<BasicBlock*> BBMap;
+		std::vector<Instruction*> MemMap;
 
 		FILE* F;
 		std::vector<uint64_t> buffer;
@@ -138,6 +139,8 @@ namespace {
 				}
 				std::unordered_map<BasicBlock*, int> reverse_map;
 				label_basic_blocks(M,BBMap, reverse_map); 
+				std::unordered_map<Instruction*, int> reverse_MemMap;
+				label_memory_operations(M,MemMap, reverse_MemMap);
 
 			}
 			virtual const char *getPassName() const {
@@ -175,6 +178,24 @@ namespace {
 						}
 						packet.ptype=BBTraceStream::PacketType::MemOp;
 						packet.MemAddr=getNextUint();
+						packet.memKind=BBTraceStream::MemUnknown;
+						packet.memSize=0;
+						packet.memInstr=NULL;
+					}else if(BBTraceStream::isMemRecord(bbid)) {
+						if(buffer.empty()) {
+							errs()<<"Error, truncated MemOp packet in Basic Block trace stream\n";
+							exit(1);
+						}
+						uint32_t instr=BBTraceStream::getMemRecordInstr(bbid);
+						if(instr>=MemMap.size()) {
+							errs() <<"ERROR: Unrecognized memory operation in MemOp packet\n";
+							exit(1);
+						}
+						packet.ptype=BBTraceStream::PacketType::MemOp;
+						packet.MemAddr=getNextUint();
+						packet.memKind=BBTraceStream::getMemRecordKind(bbid);
+						packet.memSize=BBTraceStream::getMemRecordSize(bbid);
+						packet.memInstr=MemMap[instr];
 					}else if(bbid==BBTraceStream::FunCallID) {
 						if(buffer.empty()) {
 							errs()<<"Error, truncated FunCall packet in Basic Block trace stream\n";
@@ -184,6 +205,13 @@ namespace {
 						packet.BB=uintToBB (getNextUint());
 					} else if(bbid==BBTraceStream::FunRetID) {
 						packet.ptype=BBTraceStream::FunRet;
+					} else if(bbid==BBTraceStream::BurstID) {
+						if(buffer.empty()) {
+							errs()<<"Error, truncated Burst packet in Basic Block trace stream\n";
+							exit(1);
+						}
+						packet.ptype=BBTraceStream::Burst;
+						packet.EventIndex=getNextUint();
 					} else {
 						packet.ptype=BBTraceStream::BB;
 						packet.BB=uintToBB(bbid);
@@ -0,0 +1,156 @@
+//===- BlockProfiling.cpp - Insert counters for block profiling -----------===//
+//
+//                      The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass instruments the specified program with counters for block
+// profiling, for when only the execution counts of the blocks are needed.
+//
+// Most block counts follow from others: a block runs as often as the blocks
+// it is control equivalent with, and as often as its incoming and outgoing
+// edges run.  A counter is only placed in the blocks the loader could not
+// infer the count of otherwise, picking the coldest blocks by the estimated
+// profile.  As with optimal edge profiling, a counter is reserved for every
+// block and the ones not used are initialised with -1.
+//
+//===----------------------------------------------------------------------===//
+#define DEBUG_TYPE "insert-block-profiling"
+#include "ProfileCommon.h"
+#include "ProfileInfo.h"
+#include "ProfileInfoLoader.h"
+#include "ProfilingUtils.h"
+#include "Passes.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+STATISTIC(NumBlocksCounted, "The # of blocks counted.");
+STATISTIC(NumBlocksInferred, "The # of blocks whose count is inferred.");
+
+namespace {
+  class BlockProfiler : public ModulePass {
+    bool runOnModule(Module &M);
+  public:
+    static char ID; // Pass identification, replacement for typeid
+    BlockProfiler() : ModulePass(ID) {
+    }
+
+    void getAnalysisUsage(AnalysisUsage &AU) const {
+      AU.addRequiredID(ProfileEstimatorPassID);
+      AU.addRequired<ProfileInfo>();
+    }
+
+    virtual const char *getPassName() const {
+      return "Block Profiler";
+    }
+  };
+}
+
+char BlockProfiler::ID = 0;
+
+static llvm::RegisterPass<BlockProfiler> X("insert-block-profiling", "Insert minimal instrumentation for block profiling", false, false);
+
+// selectCountedBlocks - Pick the blocks of F to count, such that the solver
+// infers the counts of all others.  The coldest block whose count is not
+// known yet is counted until all are known, then counters made redundant by
+// the ones picked after them are dropped again.
+static void selectCountedBlocks(Function *F, ProfileInfo &PI,
+                                BlockCountSolver &Solver,
+                                std::vector<bool> &Counted) {
+  std::vector<double> Weights;
+  for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB)
+    Weights.push_back(PI.getExecutionCount(BB));
+
+  unsigned NumBlocks = Solver.getNumBlocks();
+  std::vector<unsigned> Picked;
+  Solver.reset();
+  while (Solver.solve()) {
+    unsigned Coldest = NumBlocks;
+    for (unsigned b = 0; b != NumBlocks; ++b)
+      if (!Solver.isKnown(b) &&
+          (Coldest == NumBlocks || Weights[b] < Weights[Coldest]))
+        Coldest = b;
+    Solver.setCount(Coldest, 0);
+    Picked.push_back(Coldest);
+  }
+
+  Counted.assign(NumBlocks, false);
+  for (unsigned i = 0, e = Picked.size(); i != e; ++i)
+    Counted[Picked[i]] = true;
+
+  // Later picks are the hotter ones, try to drop them first.
+  for (unsigned i = Picked.size(); i-- != 0; ) {
+    Counted[Picked[i]] = false;
+    Solver.reset();
+    for (unsigned b = 0; b != NumBlocks; ++b)
+      if (Counted[b])
+        Solver.setCount(b, 0);
+    if (Solver.solve())
+      Counted[Picked[i]] = true;
+  }
+}
+
+bool BlockProfiler::runOnModule(Module &M) {
+  uint64_t NumBlocks = 0;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F)
+    if (!F->isDeclaration())
+      NumBlocks += F->size();
+
+  Type *Int64 = Type::getInt64Ty(M.getContext());
+  ArrayType *ATy = ArrayType::get(Int64, NumBlocks);
+  GlobalVariable *Counters =
+    new GlobalVariable(M, ATy, false, GlobalValue::InternalLinkage,
+                       Constant::getNullValue(ATy), "BlockProfCounters");
+
+  std::vector<Constant*> Initializer(NumBlocks);
+  Constant *Zero = ConstantInt::get(Int64, 0);
+  Constant *Uncounted = ConstantInt::get(Int64, ProfileInfoLoader::Uncounted);
+  ProfiledFunctions Functions;
+
+  uint64_t i = 0;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (F->isDeclaration()) continue;
+    DEBUG(dbgs() << "Working on " << F->getName() << "\n");
+    Functions.add(*F, i, F->size());
+
+    BlockCountSolver Solver(*F);
+    std::vector<bool> Counted;
+    selectCountedBlocks(F, getAnalysis<ProfileInfo>(*F), Solver, Counted);
+
+    // The counters do not change the control flow graph, so the loader finds
+    // the same classes and edges.
+    unsigned b = 0;
+    for (Function::iterator BB = F->begin(), BE = F->end(); BB != BE;
+         ++BB, ++b, ++i) {
+      if (Counted[b]) {
+        DEBUG(dbgs() << "--Block Counter for " << BB->getName()
+                     << " (# " << i << ")\n");
+        IncrementCounterInBlock(BB, i, Counters); ++NumBlocksCounted;
+        Initializer[i] = Zero;
+      } else {
+        ++NumBlocksInferred;
+        Initializer[i] = Uncounted;
+      }
+    }
+  }
+  assert(i == NumBlocks && "the number of blocks in counting array is wrong");
+
+  Counters->setInitializer(ConstantArray::get(ATy, Initializer));
+
+  // Run the probes only while profiling is enabled, with -profile-dormant.
+  InsertProbeGuards(M);
+
+  // Add the initialization call to main, or to a constructor of the module.
+  InsertProfilingInit(M, "llvm_start_block_profiling", Counters);
+  InsertFunctionMap(M, BlockInfo, Functions);
+  return true;
+}
@@ -0,0 +1,201 @@
+//===- CallSiteProfileInfo.cpp --------------------------------*- C++ -*---===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file defines the interface used by optimizers to load call site
+// profiles, and provides a loader pass which reads them from a profile file.
+//
+//===----------------------------------------------------------------------===//
+#define DEBUG_TYPE "callsite-profile-info"
+
+#include "CallSiteProfileInfo.h"
+#include "ProfileInfoLoader.h"
+#include "Passes.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+
+using namespace llvm;
+
+static cl::opt<std::string>
+CallSiteProfileFilename("callsite-profile-file", cl::init("llvmprof.out"),
+  cl::value_desc("filename"),
+  cl::desc("Profile file loaded by -callsite-profile-loader"), cl::Hidden);
+
+// ----------------------------------------------------------------------------
+// CallSiteProfileInfo implementation
+//
+
+// Pass identification
+char llvm::CallSiteProfileInfo::ID = 0;
+
+CallSiteProfileInfo::CallSiteProfileInfo() {}
+
+CallSiteProfileInfo::~CallSiteProfileInfo() {}
+
+bool CallSiteProfileInfo::isProfiledCallSite(const Instruction* I) {
+  if (!isa<CallInst>(I) && !isa<InvokeInst>(I))
+    return false;
+  if (isa<IntrinsicInst>(I))
+    return false;
+
+  ImmutableCallSite CS(I);
+  return !CS.isInlineAsm();
+}
+
+bool CallSiteProfileInfo::isIndirectCallSite(const Instruction* I) {
+  ImmutableCallSite CS(I);
+  return !isa<Function>(CS.getCalledValue()->stripPointerCasts());
+}
+
+void CallSiteProfileInfo::getTargetFunctions(Module& M,
+                                             std::vector<Function*>& targets) {
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F)
+    if (!F->isIntrinsic())
+      targets.push_back(F);
+}
+
+uint64_t CallSiteProfileInfo::getCallCount(const Instruction* I) const {
+  DenseMap<const Instruction*, uint64_t>::const_iterator count =
+    _callCounts.find(I);
+  return count == _callCounts.end() ? 0 : count->second;
+}
+
+const CallSiteProfileInfo::TargetVector&
+CallSiteProfileInfo::getIndirectTargets(const Instruction* I) const {
+  DenseMap<const Instruction*, TargetVector>::const_iterator targets =
+    _indirectTargets.find(I);
+  return targets == _indirectTargets.end() ? _noTargets : targets->second;
+}
+
+// ----------------------------------------------------------------------------
+// CallSiteProfileLoaderPass implementation
+//
+
+namespace {
+  class CallSiteProfileLoaderPass : public ModulePass,
+                                    public CallSiteProfileInfo {
+  public:
+    static char ID; // Pass identification
+    CallSiteProfileLoaderPass() : ModulePass(ID) { }
+
+    // this pass doesn't change anything (only loads information)
+    virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+      AU.setPreservesAll();
+    }
+
+    virtual const char* getPassName() const {
+      return "Call Site Profiling Information Loader";
+    }
+
+    // required since this pass implements multiple inheritance
+    virtual void *getAdjustedAnalysisPointer(AnalysisID PI) {
+      if (PI == &CallSiteProfileInfo::ID)
+        return (CallSiteProfileInfo*)this;
+      return this;
+    }
+
+    bool runOnModule(Module &M);
+  };
+
+  // Orders targets by decreasing call count.
+  struct MoreCalls {
+    bool operator()(const std::pair<Function*, uint64_t>& LHS,
+                    const std::pair<Function*, uint64_t>& RHS) const {
+      return LHS.second > RHS.second;
+    }
+  };
+}
+
+char CallSiteProfileLoaderPass::ID = 0;
+
+static RegisterAnalysisGroup<CallSiteProfileInfo>
+P("Call Site Profile Information");
+static RegisterPass<CallSiteProfileLoaderPass> X("callsite-profile-loader",
+                   "Load call site profile information from file", false, true);
+static RegisterAnalysisGroup<CallSiteProfileInfo> R(X);
+
+char &llvm::CallSiteProfileLoaderPassID = CallSiteProfileLoaderPass::ID;
+
+bool CallSiteProfileLoaderPass::runOnModule(Module &M) {
+  ProfileInfoLoader PIL("callsite-profile-loader", CallSiteProfileFilename);
+  const std::vector<uint64_t>& counts = PIL.getRawCallSiteCounts();
+  const std::map<uint64_t, IndirectCallTargetMap>& indirect =
+    PIL.getRawIndirectCallTargets();
+
+  std::vector<Function*> functions;
+  getTargetFunctions(M, functions);
+
+  uint64_t site = 0;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (F->isDeclaration()) continue;
+    for (inst_iterator I = inst_begin(F), IE = inst_end(F); I != IE; ++I) {
+      if (!isProfiledCallSite(&*I)) continue;
+
+      if (site < counts.size() &&
+          counts[site] != ProfileInfoLoader::Uncounted)
+        _callCounts[&*I] = counts[site];
+
+      std::map<uint64_t, IndirectCallTargetMap>::const_iterator targets =
+        indirect.find(site);
+      if (targets != indirect.end()) {
+        TargetVector& result = _indirectTargets[&*I];
+        for (IndirectCallTargetMap::const_iterator
+               T = targets->second.begin(), TE = targets->second.end();
+             T != TE; ++T) {
+          Function* target = 0 < T->first && T->first <= functions.size() ?
+            functions[T->first - 1] : 0;
+          result.push_back(std::make_pair(target, T->second));
+        }
+        std::stable_sort(result.begin(), result.end(), MoreCalls());
+      }
+
+      ++site;
+    }
+  }
+
+  if (site != counts.size())
+    errs() << "WARNING: " << counts.size() << " call sites in the profile, "
+           << site << " in the module\n";
+
+  return false;
+}
+
+//===----------------------------------------------------------------------===//
+//  NoProfile CallSiteProfileInfo implementation
+//
+
+namespace {
+  struct NoCallSiteProfileInfo : public ImmutablePass,
+                                 public CallSiteProfileInfo {
+    static char ID; // Class identification, replacement for typeinfo
+    NoCallSiteProfileInfo() : ImmutablePass(ID) {
+    }
+
+    virtual void *getAdjustedAnalysisPointer(AnalysisID PI) {
+      if (PI == &CallSiteProfileInfo::ID)
+        return (CallSiteProfileInfo*)this;
+      return this;
+    }
+
+    virtual const char *getPassName() const {
+      return "NoCallSiteProfileInfo";
+    }
+  };
+}  // End of anonymous namespace
+
+char NoCallSiteProfileInfo::ID = 0;
+// Register this pass...
+static RegisterPass<NoCallSiteProfileInfo> Y("no-callsite-profile",
+                   "No Call Site Profile Information", false, true);
+static RegisterAnalysisGroup<CallSiteProfileInfo, true> S(Y);
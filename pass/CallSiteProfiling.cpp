@@ -0,0 +1,174 @@
+//===- CallSiteProfiling.cpp - Insert counters for call site profiling ----===//
+//
+//                      The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass instruments the specified program with a counter for every call
+// site, giving the caller to callee call counts of the call graph.  Indirect
+// call sites additionally report their target to the runtime, which keeps the
+// most frequent targets of every site for devirtualization and inlining.
+//
+// Call sites are numbered in module order, see CallSiteProfileInfo for the
+// call sites counted.
+//
+//===----------------------------------------------------------------------===//
+#define DEBUG_TYPE "insert-callsite-profiling"
+
+#include "CallSiteProfileInfo.h"
+#include "ProfileInfoTypes.h"
+#include "ProfilingUtils.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/CallSite.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/raw_ostream.h"
+using namespace llvm;
+
+STATISTIC(NumCallSitesInserted, "The # of call site counters inserted.");
+STATISTIC(NumIndirectCallSites, "The # of indirect call sites profiled.");
+
+namespace {
+  class CallSiteProfiler : public ModulePass {
+    bool runOnModule(Module &M);
+  public:
+    static char ID; // Pass identification, replacement for typeid
+    CallSiteProfiler() : ModulePass(ID) { }
+
+    virtual const char *getPassName() const {
+      return "Call Site Profiler";
+    }
+  };
+}
+
+char CallSiteProfiler::ID = 0;
+
+static llvm::RegisterPass<CallSiteProfiler> X("insert-callsite-profiling", "Insert instrumentation for call site profiling", false, false);
+
+bool CallSiteProfiler::runOnModule(Module &M) {
+  Function *Main = M.getFunction("main");
+  if (Main == 0) {
+    errs() << "WARNING: cannot insert call site profiling into a module"
+           << " with no main function!\n";
+    return false;  // No main, no instrumentation!
+  }
+
+  LLVMContext &Context = M.getContext();
+
+  // Collect the call sites first, the instrumentation adds calls of its own.
+  std::vector<Instruction*> CallSites;
+  uint64_t NumIndirect = 0;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (F->isDeclaration()) continue;
+    for (inst_iterator I = inst_begin(F), IE = inst_end(F); I != IE; ++I)
+      if (CallSiteProfileInfo::isProfiledCallSite(&*I)) {
+        CallSites.push_back(&*I);
+        if (CallSiteProfileInfo::isIndirectCallSite(&*I))
+          ++NumIndirect;
+      }
+  }
+
+  Type *ATy = ArrayType::get(Type::getInt64Ty(Context), CallSites.size());
+  GlobalVariable *Counters =
+    new GlobalVariable(M, ATy, false, GlobalValue::InternalLinkage,
+                       Constant::getNullValue(ATy), "CallSiteProfCounters");
+  NumCallSitesInserted = CallSites.size();
+  NumIndirectCallSites = NumIndirect;
+
+  // The target tables of the indirect call sites, laid out as
+  // IndirectCallSiteEntry.
+  const unsigned EntryWords = sizeof(IndirectCallSiteEntry) / sizeof(uint64_t);
+  std::vector<Constant*> Entries(
+    NumIndirect * EntryWords, ConstantInt::get(Type::getInt64Ty(Context), 0));
+  for (uint64_t i = 0, Indirect = 0, e = CallSites.size(); i != e; ++i)
+    if (CallSiteProfileInfo::isIndirectCallSite(CallSites[i]))
+      Entries[EntryWords * Indirect++] =
+        ConstantInt::get(Type::getInt64Ty(Context), i);
+
+  ArrayType *TableTy = ArrayType::get(Type::getInt64Ty(Context),
+                                      Entries.size());
+  GlobalVariable *Table =
+    new GlobalVariable(M, TableTy, false, GlobalValue::InternalLinkage,
+                       ConstantArray::get(TableTy, Entries),
+                       "IndirectCallProfTable");
+
+  Type *EntryPtrTy = Type::getInt64PtrTy(Context);
+  Type *VoidPtrTy = Type::getInt8PtrTy(Context);
+  Constant *ProfileIndirectCall =
+    M.getOrInsertFunction("llvm_profile_indirect_call",
+                          Type::getVoidTy(Context),
+                          EntryPtrTy, // call site entry
+                          VoidPtrTy,  // target
+                          NULL);
+
+  // Instrument all of the call sites...
+  for (uint64_t i = 0, Indirect = 0, e = CallSites.size(); i != e; ++i) {
+    Instruction *I = CallSites[i];
+    IncrementCounterBefore(I, i, Counters);
+
+    if (!CallSiteProfileInfo::isIndirectCallSite(I))
+      continue;
+
+    std::vector<Constant*> Indices(2);
+    Indices[0] = Constant::getNullValue(Type::getInt64Ty(Context));
+    Indices[1] = ConstantInt::get(Type::getInt64Ty(Context),
+                                  EntryWords * Indirect++);
+
+    std::vector<Value*> Args(2);
+    Args[0] = ConstantExpr::getGetElementPtr(Table, Indices);
+    Args[1] = CastInst::CreatePointerCast(CallSite(I).getCalledValue(),
+                                          VoidPtrTy, "target", I);
+    if (Instruction *Target = dyn_cast<Instruction>(Args[1]))
+      MarkProbe(Target);
+    MarkProbe(CallInst::Create(ProfileIndirectCall, Args, "", I));
+  }
+
+  // The functions which may be called indirectly, numbered from 1.
+  std::vector<Function*> Targets;
+  CallSiteProfileInfo::getTargetFunctions(M, Targets);
+  std::vector<Constant*> TargetAddresses;
+  for (unsigned i = 0, e = Targets.size(); i != e; ++i)
+    TargetAddresses.push_back(ConstantExpr::getBitCast(Targets[i], VoidPtrTy));
+
+  ArrayType *TargetsTy = ArrayType::get(VoidPtrTy, TargetAddresses.size());
+  GlobalVariable *TargetTable =
+    new GlobalVariable(M, TargetsTy, true, GlobalValue::InternalLinkage,
+                       ConstantArray::get(TargetsTy, TargetAddresses),
+                       "IndirectCallProfTargets");
+
+  // Run the probes only while profiling is enabled, with -profile-dormant.
+  InsertProbeGuards(M);
+
+  // Add the initialization calls to main.
+  InsertProfilingInitCall(Main, "llvm_start_callsite_profiling", Counters);
+
+  if (NumIndirect) {
+    Constant *StartIndirect =
+      M.getOrInsertFunction("llvm_start_indirect_call_profiling",
+                            Type::getVoidTy(Context),
+                            EntryPtrTy, // call site entries
+                            Type::getInt64Ty(Context), // number of entries
+                            PointerType::getUnqual(VoidPtrTy), // functions
+                            Type::getInt64Ty(Context), // number of functions
+                            NULL);
+
+    std::vector<Constant*> Indices(2,
+      Constant::getNullValue(Type::getInt64Ty(Context)));
+    std::vector<Value*> Args(4);
+    Args[0] = ConstantExpr::getGetElementPtr(Table, Indices);
+    Args[1] = ConstantInt::get(Type::getInt64Ty(Context), NumIndirect);
+    Args[2] = ConstantExpr::getGetElementPtr(TargetTable, Indices);
+    Args[3] = ConstantInt::get(Type::getInt64Ty(Context), Targets.size());
+    CallInst::Create(StartIndirect, Args, "",
+                     Main->getEntryBlock().getFirstInsertionPt());
+  }
+
+  return true;
+}
@@ -15,6 +15,17 @@
 // edge in the program, instead of using control flow information to prune the
 // number of counters inserted.
 //
+// With -edge-coverage every edge gets a byte flag instead of a counter.  The
+// flag is only stored while it is still clear, so a probe costs a load and a
+// predicted branch once its edge has run.
+//
+// The counters are followed by a map of the functions they belong to, so the
+// loaders still find them once other functions changed.
+//
+// With -profile-sample-interval the counters only run in bursts, in a copy of
+// every function which is entered from its uninstrumented original at the
+// entry and at the back edges.
+//
 //===----------------------------------------------------------------------===//
 #define DEBUG_TYPE "insert-edge-profiling"
 
@@ -23,6 +34,7 @@
 #include "llvm/ADT/Statistic.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include <set>
@@ -30,6 +42,11 @@ using namespace llvm;
 
 STATISTIC(NumEdgesInserted, "The # of edges inserted.");
 
+static cl::opt<bool>
+EdgeCoverage("edge-coverage", cl::init(false),
+             cl::desc("Record whether edges ran rather than how often"),
+             cl::Hidden);
+
 namespace {
   class EdgeProfiler : public ModulePass {
     bool runOnModule(Module &M);
@@ -48,17 +65,12 @@ char EdgeProfiler::ID = 0;
 static llvm::RegisterPass<EdgeProfiler> X("insert-edge-profiling", "Insert instrumentation for edge profiling", false, false);
 
 bool EdgeProfiler::runOnModule(Module &M) {
-  Function *Main = M.getFunction("main");
-  if (Main == 0) {
-    errs() << "WARNING: cannot insert edge profiling into a module"
-           << " with no main function!\n";
-    return false;  // No main, no instrumentation!
-  }
-
   std::set<BasicBlock*> BlocksToInstrument;
+  ProfiledFunctions Functions;
   uint64_t NumEdges = 0;
   for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
     if (F->isDeclaration()) continue;
+    uint64_t FirstEdge = NumEdges;
     // Reserve space for (0,entry) edge.
     ++NumEdges;
     for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB) {
@@ -68,20 +80,36 @@ bool EdgeProfiler::runOnModule(Module &M) {
       BlocksToInstrument.insert(BB);
       NumEdges += BB->getTerminator()->getNumSuccessors();
     }
+    // Identify the function before its critical edges are split.
+    Functions.add(*F, FirstEdge, NumEdges - FirstEdge);
   }
 
-  Type *ATy = ArrayType::get(Type::getInt64Ty(M.getContext()), NumEdges);
+  Type *ElementTy = EdgeCoverage ? Type::getInt8Ty(M.getContext()) :
+                                   Type::getInt64Ty(M.getContext());
+  Type *ATy = ArrayType::get(ElementTy, NumEdges);
   GlobalVariable *Counters =
     new GlobalVariable(M, ATy, false, GlobalValue::InternalLinkage,
-                       Constant::getNullValue(ATy), "EdgeProfCounters");
+                       Constant::getNullValue(ATy),
+                       EdgeCoverage ? "EdgeCoverageFlags" : "EdgeProfCounters");
   NumEdgesInserted = NumEdges;
 
+  // Coverage probes split their block, they are inserted once all edges have
+  // been numbered.
+  std::vector<std::pair<Instruction*, uint64_t> > CoverageProbes;
+
   // Instrument all of the edges...
   uint64_t i = 0;
   for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
     if (F->isDeclaration()) continue;
+    // With sampling, keep an uninstrumented copy to run between bursts.
+    ValueToValueMapTy VMap;
+    Function *Clean = EdgeCoverage ? 0 : CloneForSampling(F, VMap);
     // Create counter for (0,entry) edge.
-    IncrementCounterInBlock(&F->getEntryBlock(), i++, Counters);
+    if (EdgeCoverage)
+      CoverageProbes.push_back(std::make_pair(
+        GetCounterInsertionPoint(&F->getEntryBlock()), i++));
+    else
+      IncrementCounterInBlock(&F->getEntryBlock(), i++, Counters);
     for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB)
       if (BlocksToInstrument.count(BB)) {  // Don't instrument inserted blocks
         // Okay, we have to add a counter of each outgoing edge.  If the
@@ -95,19 +123,39 @@ bool EdgeProfiler::runOnModule(Module &M) {
           // Okay, we are guaranteed that the edge is no longer critical.  If we
           // only have a single successor, insert the counter in this block,
           // otherwise insert it in the successor block.
-          if (TI->getNumSuccessors() == 1) {
-            // Insert counter at the start of the block
-            IncrementCounterInBlock(BB, i++, Counters, false);
-          } else {
-            // Insert counter at the start of the block
-            IncrementCounterInBlock(TI->getSuccessor(s), i++, Counters);
+          BasicBlock *CounterBB = BB;
+          bool AtStart = false;
+          if (TI->getNumSuccessors() != 1) {
+            CounterBB = TI->getSuccessor(s);
+            AtStart = true;
           }
+
+          if (EdgeCoverage)
+            CoverageProbes.push_back(std::make_pair(
+              GetCounterInsertionPoint(CounterBB, AtStart), i++));
+          else
+            IncrementCounterInBlock(CounterBB, i++, Counters, AtStart);
         }
       }
+    if (Clean)
+      InsertSampling(F, Clean, VMap, true);
   }
 
-  // Add the initialization call to main.
-  InsertProfilingInitCall(Main, "llvm_start_edge_profiling", Counters);
+  for (unsigned p = 0, e = CoverageProbes.size(); p != e; ++p)
+    SetCoverageFlagBefore(CoverageProbes[p].first, CoverageProbes[p].second,
+                          Counters);
+
+  // Run the probes only while profiling is enabled, with -profile-dormant.
+  InsertProbeGuards(M);
+
+  // Add the initialization call to main, or to a constructor of the module.
+  if (EdgeCoverage)
+    InsertProfilingInit(M, "llvm_start_edge_coverage", Counters,
+                        Type::getInt8PtrTy(M.getContext()));
+  else
+    InsertProfilingInit(M, "llvm_start_edge_profiling", Counters);
+  InsertFunctionMap(M, EdgeCoverage ? EdgeCoverageInfo : EdgeInfo,
+                    Functions);
   return true;
 }
 
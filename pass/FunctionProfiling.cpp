@@ -0,0 +1,75 @@
+//===- FunctionProfiling.cpp - Insert counters for function profiling -----===//
+//
+//                      The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass instruments the specified program with a counter on the entry of
+// every defined function.  Function entry counts are often all inlining and
+// hot/cold splitting need, at the cost of one counter per call.
+//
+// The counters are followed by a map of the functions they belong to, so the
+// loaders still find them once other functions changed.
+//
+//===----------------------------------------------------------------------===//
+#define DEBUG_TYPE "insert-function-profiling"
+
+#include "ProfilingUtils.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/raw_ostream.h"
+using namespace llvm;
+
+STATISTIC(NumFunctionsInstrumented, "The # of functions instrumented.");
+
+namespace {
+  class FunctionProfiler : public ModulePass {
+    bool runOnModule(Module &M);
+  public:
+    static char ID; // Pass identification, replacement for typeid
+    FunctionProfiler() : ModulePass(ID) { }
+
+    virtual const char *getPassName() const {
+      return "Function Profiler";
+    }
+  };
+}
+
+char FunctionProfiler::ID = 0;
+
+static llvm::RegisterPass<FunctionProfiler> X("insert-function-profiling", "Insert instrumentation for function entry count profiling", false, false);
+
+bool FunctionProfiler::runOnModule(Module &M) {
+  ProfiledFunctions Functions;
+  uint64_t NumFunctions = 0;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (F->isDeclaration()) continue;
+    Functions.add(*F, NumFunctions++, 1);
+  }
+
+  Type *ATy = ArrayType::get(Type::getInt64Ty(M.getContext()), NumFunctions);
+  GlobalVariable *Counters =
+    new GlobalVariable(M, ATy, false, GlobalValue::InternalLinkage,
+                       Constant::getNullValue(ATy), "FuncProfCounters");
+  NumFunctionsInstrumented = NumFunctions;
+
+  // Instrument the entry of all of the functions...
+  uint64_t i = 0;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (F->isDeclaration()) continue;
+    IncrementCounterInBlock(&F->getEntryBlock(), i++, Counters);
+  }
+
+  // Run the probes only while profiling is enabled, with -profile-dormant.
+  InsertProbeGuards(M);
+
+  // Add the initialization call to main, or to a constructor of the module.
+  InsertProfilingInit(M, "llvm_start_function_profiling", Counters);
+  InsertFunctionMap(M, FunctionInfo, Functions);
+  return true;
+}
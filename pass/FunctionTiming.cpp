@@ -0,0 +1,164 @@
+//===- FunctionTiming.cpp - Insert instrumentation for function timing ----===//
+//
+//                      The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass instruments the specified program to measure where its time goes
+// rather than how often code runs.  Every defined function reports its entry
+// and its returns to the runtime, which accumulates the inclusive and
+// exclusive time of every function.  The frame address passed along lets the
+// runtime close activations left by unwinding.
+//
+// Functions are numbered in module order, skipping declarations.
+//
+// The blocks of the functions named with -timing-regions are also timed as
+// regions of their own, from their first instruction to their terminator.
+// They are identified by the GUID of their function and their index in it.
+//
+//===----------------------------------------------------------------------===//
+#define DEBUG_TYPE "insert-function-timing"
+
+#include "ProfileCommon.h"
+#include "ProfileInfoTypes.h"
+#include "ProfilingUtils.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Intrinsics.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+using namespace llvm;
+
+STATISTIC(NumFunctionsTimed, "The # of functions timed.");
+STATISTIC(NumRegionsTimed, "The # of regions timed.");
+
+static cl::list<std::string>
+TimingRegions("timing-regions", cl::CommaSeparated,
+              cl::value_desc("function"),
+              cl::desc("Also time every block of these functions"),
+              cl::Hidden);
+
+namespace {
+  class FunctionTimer : public ModulePass {
+    bool runOnModule(Module &M);
+  public:
+    static char ID; // Pass identification, replacement for typeid
+    FunctionTimer() : ModulePass(ID) { }
+
+    virtual const char *getPassName() const {
+      return "Function Timer";
+    }
+  };
+}
+
+char FunctionTimer::ID = 0;
+
+static llvm::RegisterPass<FunctionTimer> X("insert-function-timing", "Insert instrumentation for function timing", false, false);
+
+bool FunctionTimer::runOnModule(Module &M) {
+  Function *Main = M.getFunction("main");
+  if (Main == 0) {
+    errs() << "WARNING: cannot insert function timing into a module"
+           << " with no main function!\n";
+    return false;  // No main, no instrumentation!
+  }
+
+  LLVMContext &Context = M.getContext();
+  Type *Int64Ty = Type::getInt64Ty(Context);
+  Type *VoidPtrTy = Type::getInt8PtrTy(Context);
+
+  Constant *Enter = M.getOrInsertFunction("llvm_timing_enter",
+                                          Type::getVoidTy(Context),
+                                          Int64Ty, // function number
+                                          VoidPtrTy, // frame address
+                                          NULL);
+  Constant *Leave = M.getOrInsertFunction("llvm_timing_leave",
+                                          Type::getVoidTy(Context),
+                                          VoidPtrTy, // frame address
+                                          NULL);
+  Constant *RegionEnter = M.getOrInsertFunction("llvm_timing_region_enter",
+                                                Int64Ty, // start time
+                                                NULL);
+  Constant *RegionLeave = M.getOrInsertFunction("llvm_timing_region_leave",
+                                                Type::getVoidTy(Context),
+                                                Int64Ty, // region number
+                                                Int64Ty, // start time
+                                                NULL);
+  Function *FrameAddress = Intrinsic::getDeclaration(&M,
+                                                     Intrinsic::frameaddress);
+
+  const unsigned RegionWords = sizeof(RegionTimingEntry) / sizeof(uint64_t);
+  uint64_t NumFunctions = 0;
+  std::vector<Constant*> Regions;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (F->isDeclaration()) continue;
+
+    // Time the regions first, so that the probes of the function enclose them.
+    if (std::find(TimingRegions.begin(), TimingRegions.end(), F->getName()) !=
+        TimingRegions.end()) {
+      uint64_t GUID = getFunctionGUID(*F);
+      uint64_t BlockNo = 0;
+      for (Function::iterator BB = F->begin(), BE = F->end(); BB != BE;
+           ++BB, ++BlockNo) {
+        std::vector<Value*> Args(2);
+        Args[0] = ConstantInt::get(Int64Ty, Regions.size() / RegionWords);
+        Args[1] = CallInst::Create(RegionEnter, "region.start",
+                                   BB->getFirstInsertionPt());
+        CallInst::Create(RegionLeave, Args, "", BB->getTerminator());
+
+        Regions.push_back(ConstantInt::get(Int64Ty, GUID));
+        Regions.push_back(ConstantInt::get(Int64Ty, BlockNo));
+        Regions.push_back(ConstantInt::get(Int64Ty, 0));
+        Regions.push_back(ConstantInt::get(Int64Ty, 0));
+      }
+    }
+
+    BasicBlock::iterator InsertPos = F->getEntryBlock().getFirstInsertionPt();
+    Value *Frame = CallInst::Create(FrameAddress,
+                                    ConstantInt::get(Type::getInt32Ty(Context),
+                                                     0),
+                                    "frame", InsertPos);
+
+    std::vector<Value*> Args(2);
+    Args[0] = ConstantInt::get(Int64Ty, NumFunctions++);
+    Args[1] = Frame;
+    CallInst::Create(Enter, Args, "", InsertPos);
+
+    for (Function::iterator BB = F->begin(), BE = F->end(); BB != BE; ++BB) {
+      TerminatorInst *TI = BB->getTerminator();
+      if (isa<ReturnInst>(TI) || isa<ResumeInst>(TI))
+        CallInst::Create(Leave, Frame, "", TI);
+    }
+  }
+  NumFunctionsTimed = NumFunctions;
+
+  const unsigned EntryWords = sizeof(FunctionTimingEntry) / sizeof(uint64_t);
+  ArrayType *TableTy = ArrayType::get(Int64Ty, NumFunctions * EntryWords);
+  GlobalVariable *Table =
+    new GlobalVariable(M, TableTy, false, GlobalValue::InternalLinkage,
+                       Constant::getNullValue(TableTy), "FunctionTimingTable");
+
+  // Each initialization call is added ahead of the earlier ones, so the regions
+  // start after the functions, whose calibration they rely on.
+  if (!Regions.empty()) {
+    NumRegionsTimed = Regions.size() / RegionWords;
+    ArrayType *RegionTableTy = ArrayType::get(Int64Ty, Regions.size());
+    GlobalVariable *RegionTable =
+      new GlobalVariable(M, RegionTableTy, false, GlobalValue::InternalLinkage,
+                         ConstantArray::get(RegionTableTy, Regions),
+                         "RegionTimingTable");
+    InsertProfilingInitCall(Main, "llvm_start_region_timing", RegionTable);
+  }
+
+  // Add the initialization call to main, ahead of main's own entry probe.
+  InsertProfilingInitCall(Main, "llvm_start_function_timing", Table);
+  return true;
+}
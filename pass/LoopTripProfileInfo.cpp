@@ -0,0 +1,166 @@
+//===- LoopTripProfileInfo.cpp --------------------------------*- C++ -*---===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file defines the interface used by optimizers to load loop trip count
+// profiles, and provides a loader pass which reads them from a profile file.
+//
+//===----------------------------------------------------------------------===//
+#define DEBUG_TYPE "looptrip-profile-info"
+
+#include "LoopTripProfileInfo.h"
+#include "ProfileInfoLoader.h"
+#include "ProfileInfoTypes.h"
+#include "Passes.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+static cl::opt<std::string>
+LoopTripProfileFilename("looptrip-profile-file", cl::init("llvmprof.out"),
+  cl::value_desc("filename"),
+  cl::desc("Profile file loaded by -looptrip-profile-loader"), cl::Hidden);
+
+// ----------------------------------------------------------------------------
+// LoopTripProfileInfo implementation
+//
+
+// Pass identification
+char llvm::LoopTripProfileInfo::ID = 0;
+
+LoopTripProfileInfo::LoopTripProfileInfo() {}
+
+LoopTripProfileInfo::~LoopTripProfileInfo() {}
+
+static void addLoopAndSubLoops(Loop* L, std::vector<Loop*>& loops) {
+  loops.push_back(L);
+  for (Loop::iterator SL = L->begin(), E = L->end(); SL != E; ++SL)
+    addLoopAndSubLoops(*SL, loops);
+}
+
+void LoopTripProfileInfo::getProfiledLoops(LoopInfo& LI,
+                                           std::vector<Loop*>& loops) {
+  for (LoopInfo::iterator L = LI.begin(), E = LI.end(); L != E; ++L)
+    addLoopAndSubLoops(*L, loops);
+}
+
+const LoopTripProfileInfo::Histogram*
+LoopTripProfileInfo::getHistogram(const Loop* L) const {
+  DenseMap<const BasicBlock*, Histogram>::const_iterator histogram =
+    _histograms.find(L->getHeader());
+  return histogram == _histograms.end() ? 0 : &histogram->second;
+}
+
+// ----------------------------------------------------------------------------
+// LoopTripProfileLoaderPass implementation
+//
+
+namespace {
+  class LoopTripProfileLoaderPass : public ModulePass,
+                                    public LoopTripProfileInfo {
+  public:
+    static char ID; // Pass identification
+    LoopTripProfileLoaderPass() : ModulePass(ID) { }
+
+    // this pass doesn't change anything (only loads information)
+    virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+      AU.setPreservesAll();
+      AU.addRequired<LoopInfo>();
+    }
+
+    virtual const char* getPassName() const {
+      return "Loop Trip Count Profiling Information Loader";
+    }
+
+    // required since this pass implements multiple inheritance
+    virtual void *getAdjustedAnalysisPointer(AnalysisID PI) {
+      if (PI == &LoopTripProfileInfo::ID)
+        return (LoopTripProfileInfo*)this;
+      return this;
+    }
+
+    bool runOnModule(Module &M);
+  };
+}
+
+char LoopTripProfileLoaderPass::ID = 0;
+
+static RegisterAnalysisGroup<LoopTripProfileInfo>
+P("Loop Trip Count Profile Information");
+static RegisterPass<LoopTripProfileLoaderPass> X("looptrip-profile-loader",
+                   "Load loop trip count profile information from file",
+                   false, true);
+static RegisterAnalysisGroup<LoopTripProfileInfo> R(X);
+
+char &llvm::LoopTripProfileLoaderPassID = LoopTripProfileLoaderPass::ID;
+
+bool LoopTripProfileLoaderPass::runOnModule(Module &M) {
+  ProfileInfoLoader PIL("looptrip-profile-loader", LoopTripProfileFilename);
+  const std::vector<uint64_t>& counts = PIL.getRawLoopTripCounts();
+
+  const size_t entryWords = sizeof(LoopTripEntry) / sizeof(uint64_t);
+  size_t loop = 0;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (F->isDeclaration()) continue;
+
+    std::vector<Loop*> loops;
+    getProfiledLoops(getAnalysis<LoopInfo>(*F), loops);
+
+    for (unsigned i = 0, e = loops.size(); i != e; ++i, ++loop) {
+      if ((loop + 1) * entryWords > counts.size())
+        continue;
+
+      const uint64_t* entry = &counts[loop * entryWords];
+      Histogram& histogram = _histograms[loops[i]->getHeader()];
+      histogram.Iterations = entry[0];
+      histogram.Invocations = 0;
+      histogram.Buckets.assign(entry + 1, entry + entryWords);
+      for (unsigned b = 0; b != LOOP_TRIP_BUCKETS; ++b)
+        histogram.Invocations += histogram.Buckets[b];
+    }
+  }
+
+  if (loop * entryWords != counts.size())
+    errs() << "WARNING: " << counts.size() / entryWords
+           << " loops in the profile, " << loop << " in the module\n";
+
+  return false;
+}
+
+//===----------------------------------------------------------------------===//
+//  NoProfile LoopTripProfileInfo implementation
+//
+
+namespace {
+  struct NoLoopTripProfileInfo : public ImmutablePass,
+                                 public LoopTripProfileInfo {
+    static char ID; // Class identification, replacement for typeinfo
+    NoLoopTripProfileInfo() : ImmutablePass(ID) {
+    }
+
+    virtual void *getAdjustedAnalysisPointer(AnalysisID PI) {
+      if (PI == &LoopTripProfileInfo::ID)
+        return (LoopTripProfileInfo*)this;
+      return this;
+    }
+
+    virtual const char *getPassName() const {
+      return "NoLoopTripProfileInfo";
+    }
+  };
+}  // End of anonymous namespace
+
+char NoLoopTripProfileInfo::ID = 0;
+// Register this pass...
+static RegisterPass<NoLoopTripProfileInfo> Y("no-looptrip-profile",
+                   "No Loop Trip Count Profile Information", false, true);
+static RegisterAnalysisGroup<LoopTripProfileInfo, true> S(Y);
@@ -0,0 +1,139 @@
+//===- LoopTripProfiling.cpp - Insert loop trip count instrumentation -----===//
+//
+//                      The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass instruments the specified program to count the iterations of
+// every invocation of every loop, giving the trip count distribution which
+// unrolling and vectorization need rather than the average edge profiles give.
+//
+// Every loop gets a counter in its function's frame, incremented by the loop
+// header.  The exit blocks of the loop hand the counter to the runtime, which
+// adds it to the loop's log2 histogram, and reset it.  The loop structure is
+// not changed, so the loader finds the same loops in the uninstrumented
+// module.  Invocations left by returning or unwinding from inside the loop are
+// not counted.
+//
+//===----------------------------------------------------------------------===//
+#define DEBUG_TYPE "insert-looptrip-profiling"
+
+#include "LoopTripProfileInfo.h"
+#include "ProfileInfoTypes.h"
+#include "ProfilingUtils.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/raw_ostream.h"
+using namespace llvm;
+
+STATISTIC(NumLoopsInstrumented, "The # of loops instrumented.");
+
+namespace {
+  // The blocks of a loop the instrumentation is inserted into.
+  struct LoopBlocks {
+    BasicBlock *Header;
+    SmallVector<BasicBlock*, 8> Exits;
+  };
+
+  class LoopTripProfiler : public ModulePass {
+    bool runOnModule(Module &M);
+  public:
+    static char ID; // Pass identification, replacement for typeid
+    LoopTripProfiler() : ModulePass(ID) { }
+
+    virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+      AU.addRequired<LoopInfo>();
+    }
+
+    virtual const char *getPassName() const {
+      return "Loop Trip Count Profiler";
+    }
+  };
+}
+
+char LoopTripProfiler::ID = 0;
+
+static llvm::RegisterPass<LoopTripProfiler> X("insert-looptrip-profiling", "Insert instrumentation for loop trip count profiling", false, false);
+
+bool LoopTripProfiler::runOnModule(Module &M) {
+  // Collect the headers and exit blocks of all loops first, LoopInfo only
+  // lasts until the next function is analyzed.
+  std::vector<LoopBlocks> Loops;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (F->isDeclaration()) continue;
+
+    std::vector<Loop*> FunctionLoops;
+    LoopTripProfileInfo::getProfiledLoops(getAnalysis<LoopInfo>(*F),
+                                          FunctionLoops);
+    for (unsigned i = 0, e = FunctionLoops.size(); i != e; ++i) {
+      Loops.push_back(LoopBlocks());
+      Loops.back().Header = FunctionLoops[i]->getHeader();
+      FunctionLoops[i]->getUniqueExitBlocks(Loops.back().Exits);
+    }
+  }
+
+  LLVMContext &Context = M.getContext();
+  Type *Int64Ty = Type::getInt64Ty(Context);
+  const unsigned EntryWords = sizeof(LoopTripEntry) / sizeof(uint64_t);
+
+  ArrayType *TableTy = ArrayType::get(Int64Ty, Loops.size() * EntryWords);
+  GlobalVariable *Table =
+    new GlobalVariable(M, TableTy, false, GlobalValue::InternalLinkage,
+                       Constant::getNullValue(TableTy), "LoopTripProfTable");
+  NumLoopsInstrumented = Loops.size();
+
+  Constant *LoopTrip =
+    M.getOrInsertFunction("llvm_loop_trip",
+                          Type::getVoidTy(Context),
+                          Type::getInt64PtrTy(Context), // histogram
+                          Int64Ty, // trip count
+                          NULL);
+
+  for (unsigned i = 0, e = Loops.size(); i != e; ++i) {
+    BasicBlock *Header = Loops[i].Header;
+    BasicBlock *Entry = &Header->getParent()->getEntryBlock();
+
+    // Reset the counter right after it is allocated, ahead of everything
+    // else in the entry block.
+    AllocaInst *Trips = new AllocaInst(Int64Ty, "LoopTrips", Entry->begin());
+    new StoreInst(ConstantInt::get(Int64Ty, 0), Trips,
+                  ++BasicBlock::iterator(Trips));
+
+    // Count the iterations in the header...
+    BasicBlock::iterator HeaderPos = Header->getFirstInsertionPt();
+    Value *OldTrips = new LoadInst(Trips, "OldLoopTrips", HeaderPos);
+    Value *NewTrips = BinaryOperator::Create(Instruction::Add, OldTrips,
+                                             ConstantInt::get(Int64Ty, 1),
+                                             "NewLoopTrips", HeaderPos);
+    new StoreInst(NewTrips, Trips, HeaderPos);
+
+    // ...and report them when the loop is left.
+    std::vector<Constant*> Indices(2);
+    Indices[0] = Constant::getNullValue(Int64Ty);
+    Indices[1] = ConstantInt::get(Int64Ty, EntryWords * i);
+    Constant *Histogram = ConstantExpr::getGetElementPtr(Table, Indices);
+
+    for (unsigned x = 0, xe = Loops[i].Exits.size(); x != xe; ++x) {
+      BasicBlock::iterator ExitPos = Loops[i].Exits[x]->getFirstInsertionPt();
+
+      std::vector<Value*> Args(2);
+      Args[0] = Histogram;
+      Args[1] = new LoadInst(Trips, "LoopTrips", ExitPos);
+      CallInst::Create(LoopTrip, Args, "", ExitPos);
+      new StoreInst(ConstantInt::get(Int64Ty, 0), Trips, ExitPos);
+    }
+  }
+
+  // Add the initialization call to main, or to a constructor of the module.
+  InsertProfilingInit(M, "llvm_start_loop_trip_profiling", Table);
+  return true;
+}
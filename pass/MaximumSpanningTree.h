@@ -9,6 +9,8 @@
 //
 // This module provides means for calculating a maximum spanning tree for a
 // given set of weighted edges. The type parameter T is the type of a node.
+// Edges of equal weight are ranked by the loop depth of their blocks, if loop
+// information is given, and then by the size of their blocks.
 //
 //===----------------------------------------------------------------------===//
 
@@ -16,6 +18,7 @@
 #define LLVM_ANALYSIS_MAXIMUMSPANNINGTREE_H
 #include <cstddef>
 #include "llvm/ADT/EquivalenceClasses.h"
+#include "llvm/Analysis/LoopInfo.h"
 #include "llvm/IR/BasicBlock.h"
 #include <algorithm>
 #include <vector>
@@ -38,16 +41,34 @@ namespace llvm {
   private:
     // A comparing class for comparing weighted edges.
     struct EdgeWeightCompare {
-      static bool getBlockSize(const T *X) {
+      const LoopInfo *LI;
+
+      explicit EdgeWeightCompare(const LoopInfo *LI) : LI(LI) {}
+
+      static size_t getBlockSize(const T *X) {
         const BasicBlock *BB = dyn_cast_or_null<BasicBlock>(X);
         return BB ? BB->size() : 0;
       }
 
+      unsigned getLoopDepth(const T *X) const {
+        const BasicBlock *BB = dyn_cast_or_null<BasicBlock>(X);
+        return BB && LI ? LI->getLoopDepth(BB) : 0;
+      }
+
       bool operator()(EdgeWeight X, EdgeWeight Y) const {
         if (X.second > Y.second) return true;
         if (X.second < Y.second) return false;
 
-        // Equal edge weights: break ties by comparing block sizes.
+        // Equal edge weights: the weights are often estimates, so keep the
+        // edges of deeper loops in the tree, they are the likely hot ones.
+        unsigned XDepth = std::max(getLoopDepth(X.first.first),
+                                   getLoopDepth(X.first.second));
+        unsigned YDepth = std::max(getLoopDepth(Y.first.first),
+                                   getLoopDepth(Y.first.second));
+        if (XDepth > YDepth) return true;
+        if (XDepth < YDepth) return false;
+
+        // Equal loop depths: break ties by comparing block sizes.
         size_t XSizeA = getBlockSize(X.first.first);
         size_t YSizeA = getBlockSize(Y.first.first);
         if (XSizeA > YSizeA) return true;
@@ -66,10 +87,11 @@ namespace llvm {
     static char ID; // Class identification, replacement for typeinfo
 
     /// MaximumSpanningTree() - Takes a vector of weighted edges and returns a
-    /// spanning tree.
-    MaximumSpanningTree(EdgeWeights &EdgeVector) {
+    /// spanning tree.  LI, if given, ranks edges of equal weight.
+    MaximumSpanningTree(EdgeWeights &EdgeVector, const LoopInfo *LI = 0) {
 
-      std::stable_sort(EdgeVector.begin(), EdgeVector.end(), EdgeWeightCompare());
+      std::stable_sort(EdgeVector.begin(), EdgeVector.end(),
+                       EdgeWeightCompare(LI));
 
       // Create spanning tree, Forest contains a special data structure
       // that makes checking if two nodes are already in a common (sub-)tree
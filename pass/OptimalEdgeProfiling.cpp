@@ -11,20 +11,36 @@
 // Edge profiling can give a reasonable approximation of the hot paths through a
 // program, and is used for a wide variety of program transformations.
 //
+// Counters are only placed on the edges left out of a maximum spanning tree
+// of the estimated edge weights.  With -optimal-edge-profile-file the tree is
+// built from the weights measured by an earlier run instead, so the counters
+// go on the edges which are actually cold.  Functions the profile does not
+// cover, or which never ran, fall back to the estimate.
+//
+// The tree is built from the cost of counting every edge rather than its
+// weight alone: a counter on a critical edge needs a block of its own, which
+// adds a jump to every execution of the edge.  Ties are broken by loop depth
+// and block size.
+//
 //===----------------------------------------------------------------------===//
 #define DEBUG_TYPE "insert-optimal-edge-profiling"
 #include "llvm/Transforms/Instrumentation.h"
 #include "MaximumSpanningTree.h"
 #include "ProfilingUtils.h"
 #include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/CFG.h"
+#include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Analysis/Passes.h"
 #include "Passes.h"
 #include "ProfileInfo.h"
 #include "ProfileInfoLoader.h"
+#include "ProfileInfoLoaderPass.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
@@ -32,6 +48,18 @@
 using namespace llvm;
 
 STATISTIC(NumEdgesInserted, "The # of edges inserted.");
+STATISTIC(NumFunctionsMeasured, "The # of functions placed by measured weights.");
+
+static cl::opt<std::string>
+OptimalEdgeProfileFile("optimal-edge-profile-file", cl::init(""),
+  cl::value_desc("filename"),
+  cl::desc("Profile of an earlier run the optimal edge counters are placed "
+           "by, instead of the estimate"), cl::Hidden);
+
+static cl::opt<unsigned>
+CriticalEdgeCost("optimal-edge-split-cost", cl::init(50),
+  cl::desc("Extra cost of a counter on a critical edge, in percent of the "
+           "cost of a counter"), cl::Hidden);
 
 namespace {
   class OptimalEdgeProfiler : public ModulePass {
@@ -44,6 +72,7 @@ namespace {
     void getAnalysisUsage(AnalysisUsage &AU) const {
       AU.addRequiredID(ProfileEstimatorPassID);
      AU.addRequired<ProfileInfo>();
+      AU.addRequired<LoopInfo>();
     }
 
     virtual const char *getPassName() const {
@@ -63,13 +92,67 @@ inline static void printEdgeCounter(ProfileInfo::Edge e,
                << ((b)?(b)->getName():"0") << " (# " << (i) << ")\n");
 }
 
-bool OptimalEdgeProfiler::runOnModule(Module &M) {
-  Function *Main = M.getFunction("main");
-  if (Main == 0) {
-    errs() << "WARNING: cannot insert edge profiling into a module"
-           << " with no main function!\n";
-    return false;  // No main, no instrumentation!
+// getMeasuredWeights - The weights of the edges of F, including the virtual
+// edges, as measured by the profile PI.  Returns false if an edge has no
+// weight or F never ran, in which case the profile says nothing about F.
+static bool getMeasuredWeights(ProfileInfo &PI, Function *F,
+                               ProfileInfo::EdgeWeights &Weights) {
+  ProfileInfo::Edge entry = ProfileInfo::getEdge(0, &F->getEntryBlock());
+  double w = PI.getEdgeWeight(entry);
+  if (w == ProfileInfo::MissingValue || w == 0)
+    return false;
+  Weights[entry] = w;
+
+  for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB) {
+    TerminatorInst *TI = BB->getTerminator();
+    if (TI->getNumSuccessors() == 0) {
+      // Edge profiles have no exit edges, their weight is the block's.
+      ProfileInfo::Edge edge = ProfileInfo::getEdge(BB, 0);
+      w = PI.getEdgeWeight(edge);
+      if (w == ProfileInfo::MissingValue)
+        w = PI.getExecutionCount(BB);
+      if (w == ProfileInfo::MissingValue)
+        return false;
+      Weights[edge] = w;
+    }
+    for (unsigned s = 0, e = TI->getNumSuccessors(); s != e; ++s) {
+      ProfileInfo::Edge edge = ProfileInfo::getEdge(BB, TI->getSuccessor(s));
+      w = PI.getEdgeWeight(edge);
+      if (w == ProfileInfo::MissingValue)
+        return false;
+      Weights[edge] = w;
+    }
+  }
+  return true;
+}
+
+// addPlacementCosts - Turn the weights of the edges of F into the dynamic
+// cost of counting them.  Counting a critical edge costs a jump through the
+// block splitting it on top of the counter.
+static void addPlacementCosts(Function *F, ProfileInfo::EdgeWeights &ECs) {
+  double SplitFactor = 1 + CriticalEdgeCost / 100.0;
+  for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB) {
+    TerminatorInst *TI = BB->getTerminator();
+    SmallPtrSet<BasicBlock*, 8> Visited;
+    for (unsigned s = 0, e = TI->getNumSuccessors(); s != e; ++s) {
+      BasicBlock *Succ = TI->getSuccessor(s);
+      if (!Visited.insert(Succ) || !isCriticalEdge(TI, s))
+        continue;
+      ProfileInfo::EdgeWeights::iterator I =
+        ECs.find(ProfileInfo::getEdge(BB, Succ));
+      if (I != ECs.end() && I->second != ProfileInfo::MissingValue)
+        I->second *= SplitFactor;
+    }
   }
+}
+
+bool OptimalEdgeProfiler::runOnModule(Module &M) {
+  // Load the measured weights while the functions are still the ones the
+  // profile was taken of, before any critical edge is split.
+  ProfileInfoLoaderPass Measured(OptimalEdgeProfileFile);
+  bool HasMeasured = !OptimalEdgeProfileFile.empty();
+  if (HasMeasured)
+    Measured.runOnModule(M);
 
   // NumEdges counts all the edges that may be instrumented. Later on its
   // decided which edges to actually instrument, to achieve optimal profiling.
@@ -78,9 +161,11 @@ bool OptimalEdgeProfiler::runOnModule(Module &M) {
   // to calculate a truly optimal maximum spanning tree and thus an optimal
   // instrumentation.
  uint64_t NumEdges = 0;
+  ProfiledFunctions Functions;
 
   for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
     if (F->isDeclaration()) continue;
+    uint64_t FirstEdge = NumEdges;
     // Reserve space for (0,entry) edge.
     ++NumEdges;
     for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB) {
@@ -94,6 +179,8 @@ bool OptimalEdgeProfiler::runOnModule(Module &M) {
         NumEdges += BB->getTerminator()->getNumSuccessors();
       }
     }
+    // Identify the function before its critical edges are split.
+    Functions.add(*F, FirstEdge, NumEdges - FirstEdge);
   }
 
   // In the profiling output a counter for each edge is reserved, but only few
@@ -120,16 +207,24 @@ bool OptimalEdgeProfiler::runOnModule(Module &M) {
     if (F->isDeclaration()) continue;
     DEBUG(dbgs() << "Working on " << F->getName() << "\n");
 
-    // Calculate a Maximum Spanning Tree with the edge weights determined by
-    // ProfileEstimator. ProfileEstimator also assign weights to the virtual
-    // edges (0,entry) and (BB,0) (for blocks with no successors) and this
-    // edges also participate in the maximum spanning tree calculation.
+    // Calculate a Maximum Spanning Tree with the edge weights measured by an
+    // earlier run or else determined by ProfileEstimator. Both assign weights
+    // to the virtual edges (0,entry) and (BB,0) (for blocks with no
+    // successors) and this edges also participate in the maximum spanning
+    // tree calculation.
     // The third parameter of MaximumSpanningTree() has the effect that not the
     // actual MST is returned but the edges _not_ in the MST.
-    ProfileInfo::EdgeWeights ECs =
-      getAnalysis<ProfileInfo>(*F).getEdgeWeights(F);
+    ProfileInfo::EdgeWeights ECs;
+    if (HasMeasured && getMeasuredWeights(Measured, F, ECs)) {
+      DEBUG(dbgs() << "Using measured weights for " << F->getName() << "\n");
+      ++NumFunctionsMeasured;
+    } else {
+      ECs = getAnalysis<ProfileInfo>(*F).getEdgeWeights(F);
+    }
+    addPlacementCosts(F, ECs);
     std::vector<ProfileInfo::EdgeWeight> EdgeVector(ECs.begin(), ECs.end());
-    MaximumSpanningTree<BasicBlock> MST(EdgeVector);
+    MaximumSpanningTree<BasicBlock> MST(EdgeVector,
+                                        &getAnalysis<LoopInfo>(*F));
     std::stable_sort(MST.begin(), MST.end());
 
     // Check if (0,entry) not in the MST. If not, instrument edge
@@ -208,8 +303,12 @@ bool OptimalEdgeProfiler::runOnModule(Module &M) {
   Constant *init = ConstantArray::get(ATy, Initializer);
   Counters->setInitializer(init);
 
-  // Add the initialization call to main.
-  InsertProfilingInitCall(Main, "llvm_start_opt_edge_profiling", Counters);
+  // Run the probes only while profiling is enabled, with -profile-dormant.
+  InsertProbeGuards(M);
+
+  // Add the initialization call to main, or to a constructor of the module.
+  InsertProfilingInit(M, "llvm_start_opt_edge_profiling", Counters);
+  InsertFunctionMap(M, OptEdgeInfo, Functions);
   return true;
 }
 
@@ -37,7 +37,7 @@
 #include "llvm/Support/Compiler.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/raw_ostream.h"
-#include <queue>
+#include <algorithm>
 #include <sstream>
 #include <stack>
 #include <string>
@@ -51,6 +51,40 @@ static cl::opt<bool> ProcessEarlyTermination(
   cl::desc("In path profiling, insert extra instrumentation to account for "
            "unexpected function termination."));
 
+// The largest number of paths allowed through any node but the root.  The
+// DAG is split at nodes above it.  Profiles must be decoded with the same
+// value they were instrumented with.
+static cl::opt<unsigned long long> PathBudget(
+  "path-profile-max-paths", cl::Hidden, cl::init(100000000),
+  cl::value_desc("paths"),
+  cl::desc("In path profiling, split the DAG so that no region has more "
+           "than this many paths."));
+
+// Targeted path profiling
+static cl::opt<bool> TargetedPathProfiling(
+  "path-profile-targeted", cl::Hidden,
+  cl::desc("In path profiling, use the edge profile provided by ProfileInfo "
+           "(e.g. -profile-loader) to skip cold functions and to cut cold "
+           "edges from the DAG.  The same edge profile must be provided to "
+           "load the path profile."));
+
+static cl::opt<double> ColdFunctionCount(
+  "path-profile-cold-function-count", cl::Hidden, cl::init(0),
+  cl::value_desc("count"),
+  cl::desc("In targeted path profiling, functions executed at most this "
+           "many times are not profiled."));
+
+static cl::opt<double> ColdEdgeRatio(
+  "path-profile-cold-edge-ratio", cl::Hidden, cl::init(0),
+  cl::value_desc("ratio"),
+  cl::desc("In targeted path profiling, edges executed at most this "
+           "fraction of the function's executions are cut from the DAG."));
+
+// Adds two path counts, saturating at the largest uint64_t.
+static uint64_t addPaths(uint64_t a, uint64_t b) {
+  return a + b < a ? ~0ULL : a + b;
+}
+
 // Returns the basic block for the BallLarusNode
 BasicBlock* BallLarusNode::getBlock() {
   return(_basicBlock);
@@ -112,22 +146,36 @@ unsigned BallLarusNode::getNumberSuccEdges() {
 
 // Add an edge to the predecessor list.
 void BallLarusNode::addPredEdge(BallLarusEdge* edge) {
+  edge->_predIndex = _predEdges.size();
   _predEdges.push_back(edge);
 }
 
-// Remove an edge from the predecessor list.
+// Remove an edge from the predecessor list in constant time.  The last
+// predecessor edge takes its place.
 void BallLarusNode::removePredEdge(BallLarusEdge* edge) {
-  removeEdge(_predEdges, edge);
+  assert(edge->_predIndex < _predEdges.size() &&
+         _predEdges[edge->_predIndex] == edge && "Not a predecessor edge!");
+  BallLarusEdge* last = _predEdges.back();
+  _predEdges[edge->_predIndex] = last;
+  last->_predIndex = edge->_predIndex;
+  _predEdges.pop_back();
 }
 
 // Add an edge to the successor list.
 void BallLarusNode::addSuccEdge(BallLarusEdge* edge) {
+  edge->_succIndex = _succEdges.size();
   _succEdges.push_back(edge);
 }
 
-// Remove an edge from the successor list.
+// Remove an edge from the successor list in constant time.  The last
+// successor edge takes its place.
 void BallLarusNode::removeSuccEdge(BallLarusEdge* edge) {
-  removeEdge(_succEdges, edge);
+  assert(edge->_succIndex < _succEdges.size() &&
+         _succEdges[edge->_succIndex] == edge && "Not a successor edge!");
+  BallLarusEdge* last = _succEdges.back();
+  _succEdges[edge->_succIndex] = last;
+  last->_succIndex = edge->_succIndex;
+  _succEdges.pop_back();
 }
 
 // Returns the name of the BasicBlock being represented.  If BasicBlock
@@ -148,21 +196,6 @@ std::string BallLarusNode::getName() {
   return name.str();
 }
 
-// Removes an edge from an edgeVector.  Used by removePredEdge and
-// removeSuccEdge.
-void BallLarusNode::removeEdge(BLEdgeVector& v, BallLarusEdge* e) {
-  // TODO: Avoid linear scan by using a set instead
-  for(BLEdgeIterator i = v.begin(),
-        end = v.end();
-      i != end;
-      ++i) {
-    if((*i) == e) {
-      v.erase(i);
-      break;
-    }
-  }
-}
-
 // Returns the source node of this edge.
 BallLarusNode* BallLarusEdge::getSource() const {
   return(_source);
@@ -233,105 +266,215 @@ unsigned BallLarusEdge::getDuplicateNumber() {
 // functional in the constructor.
 void BallLarusDag::init() {
   BLBlockNodeMap inDag;
-  std::stack<BallLarusNode*> dfsStack;
+  BuildStack dfsStack;
 
   _root = addNode(&(_function.getEntryBlock()));
   _exit = addNode(NULL);
 
   // start search from root
-  dfsStack.push(getRoot());
+  buildNode(inDag, dfsStack, getRoot());
+
+  // dfs to add each bb into the dag.  The stack holds the current DFS path,
+  // so its depth, not the call stack, grows with the size of the CFG.
+  while(!dfsStack.empty()) {
+    BuildFrame& frame = dfsStack.back();
+
+    if(frame.next == frame.end) {
+      // all successors visited
+      frame.node->setColor(BallLarusNode::BLACK);
+      dfsStack.pop_back();
+      continue;
+    }
+
+    BallLarusNode* currentNode = frame.node;
+    BasicBlock* succBB = *frame.next;
 
-  // dfs to add each bb into the dag
-  while(dfsStack.size())
-    buildNode(inDag, dfsStack);
+    // is this edge a duplicate?
+    if(frame.oldSuccessor == succBB)
+      frame.duplicateNumber++;
+    else
+      frame.duplicateNumber = 0;
+
+    unsigned duplicateNumber = frame.duplicateNumber;
+    frame.oldSuccessor = succBB;
+    ++frame.next;
+
+    // may push onto dfsStack, invalidating frame
+    buildEdge(inDag, dfsStack, currentNode, succBB, duplicateNumber);
+  }
 
   // put in the final edge
   addEdge(getExit(),getRoot(),0);
 }
 
-// Frees all memory associated with the DAG.
+// Frees all memory associated with the DAG.  The nodes and edges live in
+// _allocator, which releases their storage.
 BallLarusDag::~BallLarusDag() {
   for(BLEdgeIterator edge = _edges.begin(), end = _edges.end(); edge != end;
       ++edge)
-    delete (*edge);
+    (*edge)->~BallLarusEdge();
 
   for(BLNodeIterator node = _nodes.begin(), end = _nodes.end(); node != end;
       ++node)
-    delete (*node);
+    (*node)->~BallLarusNode();
+}
+
+// Returns true for targeted path profiling, where a prior edge profile
+// selects the functions to profile and the edges to cut from their DAGs.
+bool BallLarusDag::isTargeted() {
+  return TargetedPathProfiling;
+}
+
+// Returns true if the edge profile PI shows F too cold to profile.
+bool BallLarusDag::isColdFunction(ProfileInfo& PI, const Function& F) {
+  double count = PI.getExecutionCount(&F);
+  return count != ProfileInfo::MissingValue && count <= ColdFunctionCount;
+}
+
+// Collects the CFG edges of F that the edge profile PI shows too cold to
+// be part of any profiled path.  Edges without profile information are
+// kept.
+void BallLarusDag::findColdEdges(ProfileInfo& PI, Function& F,
+                                 BLColdEdgeSet& coldEdges) {
+  double count = PI.getExecutionCount(&F);
+  if( count == ProfileInfo::MissingValue )
+    return;
+
+  double threshold = ColdEdgeRatio * count;
+  for( Function::iterator BBI = F.begin(), E = F.end(); BBI != E; ++BBI ) {
+    BasicBlock* BB = &*BBI;
+    for( succ_iterator succ = succ_begin(BB), end = succ_end(BB);
+         succ != end; ++succ ) {
+      double weight = PI.getEdgeWeight(ProfileInfo::getEdge(BB, *succ));
+      if( weight != ProfileInfo::MissingValue && weight <= threshold )
+        coldEdges.insert(std::make_pair(BB, *succ));
+    }
+  }
 }
 
 // Calculate the path numbers by assigning edge increments as prescribed
-// in Ball-Larus path profiling.
-void BallLarusDag::calculatePathNumbers() {
-  BallLarusNode* node;
-  std::queue<BallLarusNode*> bfsQueue;
-  bfsQueue.push(getExit());
+// in Ball-Larus path profiling.  Nodes are visited in reverse topological
+// order, so each node is numbered exactly once, after all its successors.
+// Splitting the root would not take any path away from it, so a root whose
+// count saturates leaves the function without path numbers.
+bool BallLarusDag::calculatePathNumbers() {
+  DenseMap<BallLarusNode*, unsigned> unnumberedSuccs;
+  std::vector<BallLarusNode*> worklist;
+
+  // count the DAG successors of every node
+  for(BLEdgeIterator edge = _edges.begin(), end = _edges.end(); edge != end;
+      ++edge) {
+    if( (*edge)->getType() == BallLarusEdge::BACKEDGE ||
+        (*edge)->getType() == BallLarusEdge::SPLITEDGE ||
+        (*edge)->getSource() == getExit() )
+      continue;
+    unnumberedSuccs[(*edge)->getSource()]++;
+  }
+
+  worklist.push_back(getExit());
 
-  while(bfsQueue.size() > 0) {
-    node = bfsQueue.front();
+  while(!worklist.empty()) {
+    BallLarusNode* node = worklist.back();
+    worklist.pop_back();
 
     DEBUG(dbgs() << "calculatePathNumbers on " << node->getName() << "\n");
 
-    bfsQueue.pop();
-    uint64_t prevPathNumber = node->getNumberPaths();
     calculatePathNumbersFrom(node);
 
-    // Check for DAG splitting
-    if( node->getNumberPaths() > 100000000 && node != getRoot() ) {
-      // Add new phony edge from the split-node to the DAG's exit
-      BallLarusEdge* exitEdge = addEdge(node, getExit(), 0);
-      exitEdge->setType(BallLarusEdge::SPLITEDGE_PHONY);
-
-      // Counters to handle the possibility of a multi-graph
-      BasicBlock* oldTarget = 0;
-      unsigned duplicateNumber = 0;
-
-      // Iterate through each successor edge, adding phony edges
-      for( BLEdgeIterator succ = node->succBegin(), end = node->succEnd();
-           succ != end; oldTarget = (*succ)->getTarget()->getBlock(), succ++ ) {
-
-        if( (*succ)->getType() == BallLarusEdge::NORMAL ) {
-          // is this edge a duplicate?
-          if( oldTarget != (*succ)->getTarget()->getBlock() )
-            duplicateNumber = 0;
-
-          // create the new phony edge: root -> succ
-          BallLarusEdge* rootEdge =
-            addEdge(getRoot(), (*succ)->getTarget(), duplicateNumber++);
-          rootEdge->setType(BallLarusEdge::SPLITEDGE_PHONY);
-          rootEdge->setRealEdge(*succ);
-
-          // split on this edge and reference it's exit/root phony edges
-          (*succ)->setType(BallLarusEdge::SPLITEDGE);
-          (*succ)->setPhonyRoot(rootEdge);
-          (*succ)->setPhonyExit(exitEdge);
-          (*succ)->setWeight(0);
-        }
-      }
-
+    // Check for DAG splitting.  The count saturates, so overflowing it
+    // also exceeds the budget.
+    if( node->getNumberPaths() > PathBudget && node != getRoot() ) {
+      splitAt(node);
       calculatePathNumbersFrom(node);
     }
 
-    DEBUG(dbgs() << "prev, new number paths " << prevPathNumber << ", "
-          << node->getNumberPaths() << ".\n");
-
-    if(prevPathNumber == 0 && node->getNumberPaths() != 0) {
-      DEBUG(dbgs() << "node ready : " << node->getName() << "\n");
-      for(BLEdgeIterator pred = node->predBegin(), end = node->predEnd();
-          pred != end; pred++) {
-        if( (*pred)->getType() == BallLarusEdge::BACKEDGE ||
-            (*pred)->getType() == BallLarusEdge::SPLITEDGE )
-          continue;
-
-        BallLarusNode* nextNode = (*pred)->getSource();
-        // not yet visited?
-        if(nextNode->getNumberPaths() == 0)
-          bfsQueue.push(nextNode);
+    if( node == getRoot() && node->getNumberPaths() == ~0ULL )
+      return false;
+
+    DEBUG(dbgs() << "new number paths " << node->getNumberPaths() << ".\n");
+
+    // Split edges never leave a node that is still on the worklist, and the
+    // phony edges added by splitting lead to numbered nodes, so the counts
+    // taken above stay valid.
+    for(BLEdgeIterator pred = node->predBegin(), end = node->predEnd();
+        pred != end; pred++) {
+      if( (*pred)->getType() == BallLarusEdge::BACKEDGE ||
+          (*pred)->getType() == BallLarusEdge::SPLITEDGE ||
+          (*pred)->getSource() == getExit() )
+        continue;
+
+      BallLarusNode* nextNode = (*pred)->getSource();
+      if(--unnumberedSuccs[nextNode] == 0) {
+        DEBUG(dbgs() << "node ready : " << nextNode->getName() << "\n");
+        worklist.push_back(nextNode);
       }
     }
   }
 
   DEBUG(dbgs() << "\tNumber of paths: " << getRoot()->getNumberPaths() << "\n");
+  return true;
+}
+
+// Orders edges by the number of paths through their target.
+static bool hasFewerPaths(BallLarusEdge* a, BallLarusEdge* b) {
+  return a->getTarget()->getNumberPaths() < b->getTarget()->getNumberPaths();
+}
+
+// Splits the DAG at node, whose number of paths is too large.  Its outgoing
+// edges leading to the most paths are turned into split edges, until the
+// paths left through node fit the budget.  Like backedges, a split edge
+// ends its path at a phony edge to the exit, and a new path starts at a
+// phony edge from the root to its target.
+void BallLarusDag::splitAt(BallLarusNode* node) {
+  // the new exit edge accounts for one path through node
+  uint64_t keptPaths = 1;
+  BLEdgeVector candidates;
+
+  for( BLEdgeIterator succ = node->succBegin(), end = node->succEnd();
+       succ != end; succ++ ) {
+    if( (*succ)->getType() == BallLarusEdge::NORMAL )
+      candidates.push_back(*succ);
+    else if( (*succ)->getType() != BallLarusEdge::BACKEDGE &&
+             (*succ)->getType() != BallLarusEdge::SPLITEDGE )
+      keptPaths = addPaths(keptPaths, (*succ)->getTarget()->getNumberPaths());
+  }
+
+  // Keep the cheapest edges.  Their targets are numbered and within the
+  // budget, so at least the lightest edge usually fits.
+  std::stable_sort(candidates.begin(), candidates.end(), hasFewerPaths);
+  BLEdgeIterator firstSplit = candidates.begin();
+  for( ; firstSplit != candidates.end(); ++firstSplit ) {
+    uint64_t paths = addPaths(keptPaths,
+                              (*firstSplit)->getTarget()->getNumberPaths());
+    if( paths > PathBudget )
+      break;
+    keptPaths = paths;
+  }
+
+  if( firstSplit == candidates.end() )
+    return;
+
+  DEBUG(dbgs() << "Splitting " << (candidates.end() - firstSplit) << " of "
+        << candidates.size() << " edges at " << node->getName() << "\n");
+
+  // Add new phony edge from the split-node to the DAG's exit
+  BallLarusEdge* exitEdge = addEdge(node, getExit(), 0);
+  exitEdge->setType(BallLarusEdge::SPLITEDGE_PHONY);
+
+  for( BLEdgeIterator succ = firstSplit, end = candidates.end();
+       succ != end; succ++ ) {
+    // create the new phony edge: root -> succ
+    BallLarusEdge* rootEdge = addEdge(getRoot(), (*succ)->getTarget(),
+                                      (*succ)->getDuplicateNumber());
+    rootEdge->setType(BallLarusEdge::SPLITEDGE_PHONY);
+    rootEdge->setRealEdge(*succ);
+
+    // split on this edge and reference it's exit/root phony edges
+    (*succ)->setType(BallLarusEdge::SPLITEDGE);
+    (*succ)->setPhonyRoot(rootEdge);
+    (*succ)->setPhonyExit(exitEdge);
+    (*succ)->setWeight(0);
+  }
 }
 
 // Returns the number of paths for the Dag.
@@ -360,82 +503,63 @@ void BallLarusDag::clearColors(BallLarusNode::NodeColor color) {
     (*nodeIt)->setColor(color);
 }
 
-// Processes one node and its imediate edges for building the DAG.
-void BallLarusDag::buildNode(BLBlockNodeMap& inDag, BLNodeStack& dfsStack) {
-  BallLarusNode* currentNode = dfsStack.top();
+// Processes one node and its imediate edges for building the DAG, and
+// pushes it on the DFS stack.
+void BallLarusDag::buildNode(BLBlockNodeMap& inDag, BuildStack& dfsStack,
+                             BallLarusNode* currentNode) {
   BasicBlock* currentBlock = currentNode->getBlock();
 
-  if(currentNode->getColor() != BallLarusNode::WHITE) {
-    // we have already visited this node
-    dfsStack.pop();
-    currentNode->setColor(BallLarusNode::BLACK);
-  } else {
-    // are there any external procedure calls?
-    if( ProcessEarlyTermination ) {
-      for( BasicBlock::iterator bbCurrent = currentNode->getBlock()->begin(),
-             bbEnd = currentNode->getBlock()->end(); bbCurrent != bbEnd;
-           bbCurrent++ ) {
-        Instruction& instr = *bbCurrent;
-        if( instr.getOpcode() == Instruction::Call ) {
-          BallLarusEdge* callEdge = addEdge(currentNode, getExit(), 0);
-          callEdge->setType(BallLarusEdge::CALLEDGE_PHONY);
-          break;
-        }
+  // are there any external procedure calls?
+  if( ProcessEarlyTermination ) {
+    for( BasicBlock::iterator bbCurrent = currentBlock->begin(),
+           bbEnd = currentBlock->end(); bbCurrent != bbEnd;
+         bbCurrent++ ) {
+      Instruction& instr = *bbCurrent;
+      if( instr.getOpcode() == Instruction::Call ) {
+        BallLarusEdge* callEdge = addEdge(currentNode, getExit(), 0);
+        callEdge->setType(BallLarusEdge::CALLEDGE_PHONY);
+        break;
       }
     }
+  }
 
-    TerminatorInst* terminator = currentNode->getBlock()->getTerminator();
-    if(isa<ReturnInst>(terminator) || isa<UnreachableInst>(terminator) ||
-       isa<ResumeInst>(terminator))
-      addEdge(currentNode, getExit(),0);
-
-    currentNode->setColor(BallLarusNode::GRAY);
-    inDag[currentBlock] = currentNode;
-
-    BasicBlock* oldSuccessor = 0;
-    unsigned duplicateNumber = 0;
-
-    // iterate through this node's successors
-    for(succ_iterator successor = succ_begin(currentBlock),
-          succEnd = succ_end(currentBlock); successor != succEnd;
-        oldSuccessor = *successor, ++successor ) {
-      BasicBlock* succBB = *successor;
+  TerminatorInst* terminator = currentBlock->getTerminator();
+  if(isa<ReturnInst>(terminator) || isa<UnreachableInst>(terminator) ||
+     isa<ResumeInst>(terminator))
+    addEdge(currentNode, getExit(),0);
 
-      // is this edge a duplicate?
-      if (oldSuccessor == succBB)
-        duplicateNumber++;
-      else
-        duplicateNumber = 0;
+  currentNode->setColor(BallLarusNode::GRAY);
+  inDag[currentBlock] = currentNode;
 
-      buildEdge(inDag, dfsStack, currentNode, succBB, duplicateNumber);
-    }
-  }
+  dfsStack.push_back(BuildFrame(currentNode, currentBlock));
 }
 
 // Process an edge in the CFG for DAG building.
-void BallLarusDag::buildEdge(BLBlockNodeMap& inDag, std::stack<BallLarusNode*>&
-                             dfsStack, BallLarusNode* currentNode,
-                             BasicBlock* succBB, unsigned duplicateCount) {
-  BallLarusNode* succNode = inDag[succBB];
+void BallLarusDag::buildEdge(BLBlockNodeMap& inDag, BuildStack& dfsStack,
+                             BallLarusNode* currentNode, BasicBlock* succBB,
+                             unsigned duplicateCount) {
+  BallLarusNode* succNode = inDag.lookup(succBB);
+  bool isCold = _coldEdges &&
+    _coldEdges->count(std::make_pair(currentNode->getBlock(), succBB));
 
   if(succNode && succNode->getColor() == BallLarusNode::BLACK) {
     // visited node and forward edge
-    addEdge(currentNode, succNode, duplicateCount);
+    if(isCold)
+      addColdEdge(currentNode, succNode, duplicateCount);
+    else
+      addEdge(currentNode, succNode, duplicateCount);
   } else if(succNode && succNode->getColor() == BallLarusNode::GRAY) {
     // visited node and back edge
     DEBUG(dbgs() << "Backedge detected.\n");
     addBackedge(currentNode, succNode, duplicateCount);
   } else {
-    BallLarusNode* childNode;
     // not visited node and forward edge
-    if(succNode) // an unvisited node that is child of a gray node
-      childNode = succNode;
-    else { // an unvisited node that is a child of a an unvisted node
-      childNode = addNode(succBB);
-      inDag[succBB] = childNode;
-    }
-    addEdge(currentNode, childNode, duplicateCount);
-    dfsStack.push(childNode);
+    BallLarusNode* childNode = addNode(succBB);
+    if(isCold)
+      addColdEdge(currentNode, childNode, duplicateCount);
+    else
+      addEdge(currentNode, childNode, duplicateCount);
+    buildNode(inDag, dfsStack, childNode);
   }
 }
 
@@ -458,9 +582,8 @@ void BallLarusDag::calculatePathNumbersFrom(BallLarusNode* node) {
       (*succ)->setWeight(sumPaths);
       succNode = (*succ)->getTarget();
 
-      if( !succNode->getNumberPaths() )
-        return;
-      sumPaths += succNode->getNumberPaths();
+      assert(succNode->getNumberPaths() && "Successor not numbered yet!");
+      sumPaths = addPaths(sumPaths, succNode->getNumberPaths());
     }
 
     node->setNumberPaths(sumPaths);
@@ -469,20 +592,21 @@ void BallLarusDag::calculatePathNumbersFrom(BallLarusNode* node) {
 
 // Allows subclasses to determine which type of Node is created.
 // Override this method to produce subclasses of BallLarusNode if
-// necessary. The destructor of BallLarusDag will call free on each
-// pointer created.
+// necessary. The destructor of BallLarusDag will destroy each node
+// created.
 BallLarusNode* BallLarusDag::createNode(BasicBlock* BB) {
-  return( new BallLarusNode(BB) );
+  return( new (_allocator.Allocate<BallLarusNode>()) BallLarusNode(BB) );
 }
 
 // Allows subclasses to determine which type of Edge is created.
 // Override this method to produce subclasses of BallLarusEdge if
-// necessary. The destructor of BallLarusDag will call free on each
-// pointer created.
+// necessary. The destructor of BallLarusDag will destroy each edge
+// created.
 BallLarusEdge* BallLarusDag::createEdge(BallLarusNode* source,
                                         BallLarusNode* target,
                                         unsigned duplicateCount) {
-  return( new BallLarusEdge(source, target, duplicateCount) );
+  return( new (_allocator.Allocate<BallLarusEdge>())
+          BallLarusEdge(source, target, duplicateCount) );
 }
 
 // Proxy to node's constructor.  Updates the DAG state.
@@ -519,3 +643,21 @@ void BallLarusDag::addBackedge(BallLarusNode* source, BallLarusNode* target,
   childEdge->getPhonyExit()->setType(BallLarusEdge::BACKEDGE_PHONY);
   _backEdges.push_back(childEdge);
 }
+
+// Adds a cold edge as a split edge with its phony edges.  A path taking the
+// edge ends at its source and a new one starts at its target, so the paths
+// through it are not enumerated.  Updates the DAG state.
+void BallLarusDag::addColdEdge(BallLarusNode* source, BallLarusNode* target,
+                               unsigned duplicateCount) {
+  BallLarusEdge* childEdge = addEdge(source, target, duplicateCount);
+  childEdge->setType(BallLarusEdge::SPLITEDGE);
+
+  childEdge->setPhonyRoot(addEdge(getRoot(), target, duplicateCount));
+  childEdge->setPhonyExit(addEdge(source, getExit(),0));
+
+  childEdge->getPhonyRoot()->setRealEdge(childEdge);
+  childEdge->getPhonyRoot()->setType(BallLarusEdge::SPLITEDGE_PHONY);
+
+  childEdge->getPhonyExit()->setRealEdge(childEdge);
+  childEdge->getPhonyExit()->setType(BallLarusEdge::SPLITEDGE_PHONY);
+}
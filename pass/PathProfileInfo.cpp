@@ -14,6 +14,8 @@
 #define DEBUG_TYPE "path-profile-info"
 
 #include "PathProfileInfo.h"
+#include "ProfileCommon.h"
+#include "ProfileInfoLoader.h"
 #include "ProfileInfoTypes.h"
 #include "llvm/IR/Module.h"
 #include "Passes.h"
@@ -39,6 +41,8 @@ namespace {
     // this pass doesn't change anything (only loads information)
     virtual void getAnalysisUsage(AnalysisUsage &AU) const {
       AU.setPreservesAll();
+      if (BallLarusDag::isTargeted())
+        AU.addRequired<ProfileInfo>();
     }
 
     // the full name of the loader pass
@@ -60,8 +64,9 @@ namespace {
     static char ID;
 
   private:
-    // make a reference table to refer to function by number
-    void buildFunctionRefs(Module &M);
+    // make a reference table to refer to function by number, the numbers
+    // of the function map if the profile has one
+    void buildFunctionRefs(Module &M, const FunctionMap* map);
 
     // process argument info of a program from the input file
     void handleArgumentInfo();
@@ -69,6 +74,9 @@ namespace {
     // process path number information from the input file
     void handlePathInfo();
 
+    // process extended path information from the input file
+    void handleExtendedPathInfo();
+
     // array of references to the functions in the module
     std::vector<Function*> _functions;
 
@@ -226,7 +234,9 @@ void PathProfileInfo::setCurrentFunction(Function* F) {
     delete _currentDag;
 
   _currentFunction = F;
-  _currentDag = new BallLarusDag(*F);
+  std::map<Function*, BLColdEdgeSet>::iterator coldEdges = _coldEdges.find(F);
+  _currentDag = new BallLarusDag(*F, coldEdges == _coldEdges.end() ? 0 :
+                                 &coldEdges->second);
   _currentDag->init();
   _currentDag->calculatePathNumbers();
 }
@@ -266,6 +276,38 @@ uint64_t PathProfileInfo::pathsRun() {
   return _currentFunction ? _functionPaths[_currentFunction].size() : 0;
 }
 
+// return the extended paths of all functions
+const ExtendedProfilePathVector& PathProfileInfo::getExtendedPaths() const {
+  return _extendedPaths;
+}
+
+// return the blocks of an extended path by concatenating its Ball-Larus paths
+ProfilePathBlockVector* PathProfileInfo::getExtendedPathBlocks(
+  const ExtendedProfilePath& path) {
+  ProfilePathBlockVector* pbv = new ProfilePathBlockVector;
+
+  for (unsigned i = 0, e = path.getLength(); i != e; ++i) {
+    Function* F = path.getFunction(i);
+    if (F != _currentFunction)
+      setCurrentFunction(F);
+
+    ProfilePath component(path.getPathNumber(i), 0, 0, this);
+    ProfilePathBlockVector* blocks = component.getPathBlocks();
+
+    // A path ending in a backedge ends with the loop header the next
+    // iteration starts at; list it once.
+    ProfilePathBlockIterator first = blocks->begin();
+    if (path.getKind() == ExtendedProfilePath::LOOP_ITERATION &&
+        !pbv->empty() && first != blocks->end() && pbv->back() == *first)
+      ++first;
+
+    pbv->insert(pbv->end(), first, blocks->end());
+    delete blocks;
+  }
+
+  return pbv;
+}
+
 // ----------------------------------------------------------------------------
 // PathLoader implementation
 //
@@ -283,16 +325,28 @@ PathProfileLoaderPass::~PathProfileLoaderPass() {
 bool PathProfileLoaderPass::runOnModule(Module &M) {
   // get the filename and setup the module's function references
   _filename = PathProfileInfoFilename;
-  buildFunctionRefs (M);
-
   if (!(_file = fopen(_filename.c_str(), "rb"))) {
     errs () << "error: input '" << _filename << "' file does not exist.\n";
     return false;
   }
 
-  ProfilingType profType;
+  ProfileInfoLoader PIL("path-profile-loader", _filename);
+  buildFunctionRefs (M, PIL.getFunctionMap(PathInfo));
+
+  // rebuild the DAGs the instrumentation used from the same edge profile
+  if (BallLarusDag::isTargeted()) {
+    for (unsigned i = 1, e = _functions.size(); i != e; ++i) {
+      Function* F = _functions[i];
+      if (F)
+        BallLarusDag::findColdEdges(getAnalysis<ProfileInfo>(), *F,
+                                    _coldEdges[F]);
+    }
+  }
+
+  // packet types are written as 64 bit words
+  uint64_t profType;
 
-  while( fread(&profType, sizeof(ProfilingType), 1, _file) ) {
+  while( fread(&profType, sizeof(uint64_t), 1, _file) ) {
     switch (profType) {
     case ArgumentInfo:
       handleArgumentInfo ();
@@ -300,6 +354,13 @@ bool PathProfileLoaderPass::runOnModule(Module &M) {
     case PathInfo:
       handlePathInfo ();
       break;
+    case ExtendedPathInfo:
+      handleExtendedPathInfo ();
+      break;
+    case FunctionMapInfo:
+    case BlockMapInfo:
+      SkipProfilingBlock ("path-profile-loader", _file, false);
+      break;
     default:
       errs () << "error: bad path profiling file syntax, " << profType << "\n";
       fclose (_file);
@@ -313,13 +374,26 @@ bool PathProfileLoaderPass::runOnModule(Module &M) {
 }
 
 // create a reference table for functions defined in the path profile file
-void PathProfileLoaderPass::buildFunctionRefs (Module &M) {
+void PathProfileLoaderPass::buildFunctionRefs (Module &M,
+                                               const FunctionMap* map) {
   _functions.push_back(0); // make the 0 index a null pointer
 
   for (Module::iterator F = M.begin(), E = M.end(); F != E; F++) {
     if (F->isDeclaration())
       continue;
-    _functions.push_back(F);
+    if (!map) {
+      _functions.push_back(F);
+      continue;
+    }
+
+    // functions keep the number they were profiled under; those which were
+    // not profiled or changed since are left out
+    const FunctionMapEntry* entry = findProfiledFunction(*map, *F);
+    if (!entry)
+      continue;
+    if (_functions.size() <= entry->firstCounter)
+      _functions.resize(entry->firstCounter + 1, 0);
+    _functions[entry->firstCounter] = F;
   }
 }
 
@@ -343,7 +417,7 @@ void PathProfileLoaderPass::handleArgumentInfo() {
 
   // byte alignment
   if (savedArgsLength & 7)
-    fseek(_file, 8-(savedArgsLength&37), SEEK_CUR);
+    fseek(_file, 8-(savedArgsLength&7), SEEK_CUR);
 }
 
 // Handle path profile information in the output file
@@ -363,7 +437,14 @@ void PathProfileLoaderPass::handlePathInfo () {
       break;
     }
 
-    Function* f = _functions[pathHeader.fnNumber];
+    // skip the paths of functions not in the module
+    Function* f = pathHeader.fnNumber < _functions.size() ?
+      _functions[pathHeader.fnNumber] : 0;
+    if (!f) {
+      fseek(_file, pathHeader.numEntries * sizeof(PathProfileTableEntry),
+            SEEK_CUR);
+      continue;
+    }
 
     // dynamically allocate a table to store path numbers
     PathProfileTableEntry* pathTable =
@@ -391,6 +472,51 @@ void PathProfileLoaderPass::handlePathInfo () {
   }
 }
 
+// Handle extended path information in the output file
+void PathProfileLoaderPass::handleExtendedPathInfo () {
+  uint64_t pathCount;
+  if( fread(&pathCount, sizeof(pathCount), 1, _file) != 1 ) {
+    errs() << "warning: extended path info header/data mismatch\n";
+    return;
+  }
+
+  std::vector<ExtendedPathEntry> entries;
+  for (uint64_t i = 0; i < pathCount; i++) {
+    ExtendedPathHeader pathHeader;
+    if( fread(&pathHeader, sizeof(pathHeader), 1, _file) != 1 ) {
+      errs() << "warning: bad header for extended path info\n";
+      return;
+    }
+
+    entries.resize(pathHeader.length);
+    if( pathHeader.length &&
+        fread(&entries[0], sizeof(ExtendedPathEntry), pathHeader.length,
+              _file) != pathHeader.length ) {
+      errs() << "warning: extended path info header/data mismatch\n";
+      return;
+    }
+
+    ExtendedProfilePath path(pathHeader.kind == LoopIterationPath ?
+                             ExtendedProfilePath::LOOP_ITERATION :
+                             ExtendedProfilePath::CALL_SPANNING,
+                             pathHeader.count);
+    bool valid = true;
+    for (uint64_t j = 0; j < pathHeader.length; j++) {
+      if (entries[j].fnNumber >= _functions.size() ||
+          !_functions[entries[j].fnNumber]) {
+        valid = false;
+        break;
+      }
+      path.addPath(_functions[entries[j].fnNumber], entries[j].pathNumber);
+    }
+
+    if (valid)
+      _extendedPaths.push_back(path);
+    else
+      errs() << "warning: extended path of an unknown function\n";
+  }
+}
+
 //===----------------------------------------------------------------------===//
 //  NoProfile PathProfileInfo implementation
 //
@@ -46,27 +46,29 @@
 #define DEBUG_TYPE "insert-path-profiling"
 
 #include "llvm/Transforms/Instrumentation.h"
+#include "Passes.h"
 #include "ProfilingUtils.h"
 #include "PathNumbering.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/InstrTypes.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/TypeBuilder.h"
 #include "llvm/Pass.h"
 #include "llvm/IR/CFG.h"
+#include "llvm/IR/CallSite.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Compiler.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include <algorithm>
 #include <vector>
 
-#define HASH_THRESHHOLD 100000
-
 using namespace llvm;
 
 namespace {
@@ -169,7 +171,7 @@ private:
 // ---------------------------------------------------------------------------
 class BLInstrumentationDag : public BallLarusDag {
 public:
-  BLInstrumentationDag(Function &F);
+  BLInstrumentationDag(Function &F, const BLColdEdgeSet* coldEdges);
 
   // Returns the Exit->Root edge. This edge is required for creating
   // directed cycles in the algorithm for moving instrumentation off of
@@ -243,13 +245,13 @@ private:
   // Makes an edge part of the spanning tree.
   void makeEdgeSpanning(BLInstrumentationEdge* edge);
 
-  // Pushes initialization and calls itself recursively.
+  // Pushes initialization down from edge as far as possible.
   void pushInitializationFromEdge(BLInstrumentationEdge* edge);
 
-  // Pushes path counter increments up recursively.
+  // Pushes path counter increments up from edge as far as possible.
   void pushCountersFromEdge(BLInstrumentationEdge* edge);
 
-  // Depth first algorithm for determining the chord increments.f
+  // Depth first algorithm for determining the chord increments.
   void calculateChordIncrementsDfs(
     long weight, BallLarusNode* v, BallLarusEdge* e);
 
@@ -268,17 +270,53 @@ private:
   // Which function are we currently instrumenting
   unsigned currentFunctionNumber;
 
+  // The table of the functions of the module, the runtime keeps the hash
+  // tables of the functions in their entries.
+  GlobalVariable* functionTable;
+
+  // Whether extended paths are recorded, which needs a main function.
+  bool extendedPaths;
+
   // The function prototype in the profiling runtime for incrementing a
   // single path counter in a hash table.
   Constant* llvmIncrementHashFunction;
   Constant* llvmDecrementHashFunction;
 
+  // The runtime functions tracking activations and path ends for extended
+  // path profiling.
+  Constant* llvmPathEnterFunction;
+  Constant* llvmPathLeaveFunction;
+  Constant* llvmPathEndFunction;
+
   // Instruments each function with path profiling.  'main' is instrumented
   // with code to save the profile to disk.
   bool runOnModule(Module &M);
 
   // Analyzes the function for Ball-Larus path profiling, and inserts code.
-  void runOnFunction(std::vector<Constant*> &ftInit, Function &F, Module &M);
+  // The CFG edges in coldEdges, if given, are not part of any path.  Paths
+  // are counted in an array if useArray is set, else in a hash table.
+  void runOnFunction(std::vector<Constant*> &ftInit, Function &F, Module &M,
+                     const BLColdEdgeSet* coldEdges, bool useArray);
+
+  // Returns the profile information used to rank functions: the prior edge
+  // profile in targeted path profiling, else the static estimate.
+  ProfileInfo& getProfileInfo(Function &F);
+
+  // Estimates how often the path counters of each function are incremented
+  // relative to the other functions.
+  void estimateFrequencies(const std::vector<Function*> &functions,
+                           DenseMap<Function*, double> &frequencies);
+
+  // Decides which functions count their paths in arrays.  Functions with
+  // few enough paths get arrays, hottest first, until the module's array
+  // budget is spent.
+  void chooseArrays(const std::vector<Function*> &functions,
+                    const std::vector<uint64_t> &numberPaths,
+                    std::vector<bool> &useArray);
+
+  // Adds a function table entry without counters for a function which is
+  // not profiled.
+  void addEmptyEntry(std::vector<Constant*> &ftInit);
 
   // Creates an increment constant representing incr.
   ConstantInt* createIncrementConstant(long incr, int bitsize);
@@ -316,6 +354,18 @@ private:
     BLInstrumentationDag* dag,
     bool increment = true);
 
+  // Inserts the counter increment for a completed path and, for extended
+  // path profiling, reports the path end to the runtime.
+  void insertPathEnd(
+    Value* pathNumber,
+    BasicBlock::iterator insertPoint,
+    BLInstrumentationDag* dag);
+
+  // Reports entering and leaving F to the runtime for extended path
+  // profiling.  Must run after the path instrumentation is inserted, so
+  // that the last path ends before F is left.
+  void insertActivationTracking(Function &F, Module &M);
+
   // A PHINode is created in the node, and its values initialized to -1U.
   void preparePHI(BLInstrumentationNode* node);
 
@@ -327,6 +377,14 @@ private:
   // Post: Edge's target node has a pathNumber set to the path number Value
   // corresponding to the value of the path register after edge's
   // execution.
+  //
+  // Returns the node whose successors are instrumented next, or NULL if the
+  // edge could not be instrumented.
+  BLInstrumentationNode* instrumentEdge(
+    BLInstrumentationEdge* edge,
+    BLInstrumentationDag* dag);
+
+  // Instruments edge and every edge reachable from it, depth first.
   void insertInstrumentationStartingAt(
     BLInstrumentationEdge* edge,
     BLInstrumentationDag* dag);
@@ -348,6 +406,12 @@ public:
   PathProfiler() : ModulePass(ID) {
   }
 
+  virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+    if (!BallLarusDag::isTargeted())
+      AU.addRequiredID(ProfileEstimatorPassID);
+    AU.addRequired<ProfileInfo>();
+  }
+
   virtual const char *getPassName() const {
     return "Path Profiler";
   }
@@ -358,6 +422,33 @@ public:
 static cl::opt<bool> DotPathDag("path-profile-pathdag", cl::Hidden,
         cl::desc("Output the path profiling DAG for each function."));
 
+// Functions with at most this many paths may count them in an array
+static cl::opt<unsigned long long> ArrayThreshold(
+  "path-profile-array-threshold", cl::Hidden, cl::init(100000),
+  cl::value_desc("paths"),
+  cl::desc("In path profiling, count the paths of functions with at most "
+           "this many paths in an array rather than a hash table."));
+
+// Extended path profiling
+static cl::opt<bool> ExtendedPaths(
+  "path-profile-extended", cl::Hidden,
+  cl::desc("In path profiling, also count paths spanning several loop "
+           "iterations and paths continuing into called functions."));
+
+static cl::opt<unsigned> ExtendedPathIterations(
+  "path-profile-extended-k", cl::Hidden, cl::init(2),
+  cl::value_desc("k"),
+  cl::desc("Number of consecutive loop iterations counted together by "
+           "-path-profile-extended (at most 8)."));
+
+// Memory available for path counter arrays in a module
+static cl::opt<unsigned long long> ArrayBudget(
+  "path-profile-array-budget", cl::Hidden, cl::init(64 << 20),
+  cl::value_desc("bytes"),
+  cl::desc("In path profiling, the most memory used by the path counter "
+           "arrays of a module, given to the hottest functions first.  "
+           "0 means unlimited."));
+
 // Register the path profiler as a pass
 char PathProfiler::ID = 0;
 static RegisterPass<PathProfiler> X( "insert-path-profiling",
@@ -498,8 +589,9 @@ unsigned BLInstrumentationEdge::getSuccessorNumber() {
 }
 
 // BLInstrumentationDag constructor initializes a DAG for the given Function.
-BLInstrumentationDag::BLInstrumentationDag(Function &F) : BallLarusDag(F),
-                                                          _counterArray(0) {
+BLInstrumentationDag::BLInstrumentationDag(Function &F,
+                                           const BLColdEdgeSet* coldEdges)
+  : BallLarusDag(F, coldEdges), _counterArray(0) {
 }
 
 // Returns the Exit->Root edge. This edge is required for creating
@@ -550,12 +642,13 @@ void BLInstrumentationDag::splitUpdate(BLInstrumentationEdge* formerEdge,
                                        BasicBlock* newBlock) {
   BallLarusNode* oldTarget = formerEdge->getTarget();
   BallLarusNode* newNode = addNode(newBlock);
+
+  // unlink from the old target first, adding to newNode renumbers the edge
+  oldTarget->removePredEdge(formerEdge);
   formerEdge->setTarget(newNode);
   newNode->addPredEdge(formerEdge);
 
   DEBUG(dbgs() << "  Edge split: " << *formerEdge << "\n");
-
-  oldTarget->removePredEdge(formerEdge);
   BallLarusEdge* newEdge = addEdge(newNode, oldTarget,0);
 
   if( formerEdge->getType() == BallLarusEdge::BACKEDGE ||
@@ -719,22 +812,24 @@ void BLInstrumentationDag::generateDotGraph() {
 
 // Allows subclasses to determine which type of Node is created.
 // Override this method to produce subclasses of BallLarusNode if
-// necessary. The destructor of BallLarusDag will call free on each pointer
+// necessary. The destructor of BallLarusDag will destroy each node
 // created.
 BallLarusNode* BLInstrumentationDag::createNode(BasicBlock* BB) {
-  return( new BLInstrumentationNode(BB) );
+  return( new (_allocator.Allocate<BLInstrumentationNode>())
+          BLInstrumentationNode(BB) );
 }
 
 // Allows subclasses to determine which type of Edge is created.
 // Override this method to produce subclasses of BallLarusEdge if
-// necessary. The destructor of BallLarusDag will call free on each pointer
+// necessary. The destructor of BallLarusDag will destroy each edge
 // created.
 BallLarusEdge* BLInstrumentationDag::createEdge(BallLarusNode* source,
                                                 BallLarusNode* target, unsigned edgeNumber) {
   // One can cast from BallLarusNode to BLInstrumentationNode since createNode
   // is overriden to produce BLInstrumentationNode.
-  return( new BLInstrumentationEdge((BLInstrumentationNode*)source,
-                                    (BLInstrumentationNode*)target) );
+  return( new (_allocator.Allocate<BLInstrumentationEdge>())
+          BLInstrumentationEdge((BLInstrumentationNode*)source,
+                                (BLInstrumentationNode*)target) );
 }
 
 // Sets the Value corresponding to the pathNumber register, constant,
@@ -790,15 +885,21 @@ void BLInstrumentationDag::makeEdgeSpanning(BLInstrumentationEdge* edge) {
   _treeEdges.push_back(edge);
 }
 
-// Pushes initialization and calls itself recursively.
+// Pushes initialization down from edge as far as possible.  Only nodes with
+// a single predecessor are passed, so the edges reached form a tree and are
+// visited once each.
 void BLInstrumentationDag::pushInitializationFromEdge(
   BLInstrumentationEdge* edge) {
-  BallLarusNode* target;
+  std::vector<BLInstrumentationEdge*> worklist(1, edge);
+
+  while(!worklist.empty()) {
+    edge = worklist.back();
+    worklist.pop_back();
+
+    BallLarusNode* target = edge->getTarget();
+    if( target->getNumberPredEdges() > 1 || target == getExit() )
+      continue;
 
-  target = edge->getTarget();
-  if( target->getNumberPredEdges() > 1 || target == getExit() ) {
-    return;
-  } else {
     for(BLEdgeIterator next = target->succBegin(),
           end = target->succEnd(); next != end; next++) {
       BLInstrumentationEdge* intoEdge = (BLInstrumentationEdge*) *next;
@@ -810,7 +911,7 @@ void BLInstrumentationDag::pushInitializationFromEdge(
       intoEdge->setIncrement(intoEdge->getIncrement() +
                              edge->getIncrement());
       intoEdge->setIsInitialization(true);
-      pushInitializationFromEdge(intoEdge);
+      worklist.push_back(intoEdge);
     }
 
     edge->setIncrement(0);
@@ -818,15 +919,20 @@ void BLInstrumentationDag::pushInitializationFromEdge(
   }
 }
 
-// Pushes path counter increments up recursively.
+// Pushes path counter increments up from edge as far as possible.  Only
+// nodes with a single successor are passed.
 void BLInstrumentationDag::pushCountersFromEdge(BLInstrumentationEdge* edge) {
-  BallLarusNode* source;
+  std::vector<BLInstrumentationEdge*> worklist(1, edge);
+
+  while(!worklist.empty()) {
+    edge = worklist.back();
+    worklist.pop_back();
+
+    BallLarusNode* source = edge->getSource();
+    if(source->getNumberSuccEdges() > 1 || source == getRoot()
+       || edge->isInitialization())
+      continue;
 
-  source = edge->getSource();
-  if(source->getNumberSuccEdges() > 1 || source == getRoot()
-     || edge->isInitialization()) {
-    return;
-  } else {
     for(BLEdgeIterator previous = source->predBegin(),
           end = source->predEnd(); previous != end; previous++) {
       BLInstrumentationEdge* fromEdge = (BLInstrumentationEdge*) *previous;
@@ -838,7 +944,7 @@ void BLInstrumentationDag::pushCountersFromEdge(BLInstrumentationEdge* edge) {
       fromEdge->setIncrement(fromEdge->getIncrement() +
                              edge->getIncrement());
       fromEdge->setIsCounterIncrement(true);
-      pushCountersFromEdge(fromEdge);
+      worklist.push_back(fromEdge);
     }
 
     edge->setIncrement(0);
@@ -846,32 +952,66 @@ void BLInstrumentationDag::pushCountersFromEdge(BLInstrumentationEdge* edge) {
   }
 }
 
-// Depth first algorithm for determining the chord increments.
+// Depth first algorithm for determining the chord increments.  The spanning
+// tree is walked from v with an explicit stack, using the tree and chord
+// edges incident to each node gathered up front, so the walk is linear in
+// the size of the DAG.
 void BLInstrumentationDag::calculateChordIncrementsDfs(long weight,
                                                        BallLarusNode* v, BallLarusEdge* e) {
-  BLInstrumentationEdge* f;
+  typedef DenseMap<BallLarusNode*, BLEdgeVector> IncidentEdgeMap;
+  IncidentEdgeMap treeEdges, chordEdges;
 
   for(BLEdgeIterator treeEdge = _treeEdges.begin(),
         end = _treeEdges.end(); treeEdge != end; treeEdge++) {
-    f = (BLInstrumentationEdge*) *treeEdge;
-    if(e != f && v == f->getTarget()) {
-      calculateChordIncrementsDfs(
-        calculateChordIncrementsDir(e,f)*(weight) +
-        f->getWeight(), f->getSource(), f);
-    }
-    if(e != f && v == f->getSource()) {
-      calculateChordIncrementsDfs(
-        calculateChordIncrementsDir(e,f)*(weight) +
-        f->getWeight(), f->getTarget(), f);
-    }
+    treeEdges[(*treeEdge)->getSource()].push_back(*treeEdge);
+    treeEdges[(*treeEdge)->getTarget()].push_back(*treeEdge);
   }
 
   for(BLEdgeIterator chordEdge = _chordEdges.begin(),
         end = _chordEdges.end(); chordEdge != end; chordEdge++) {
-    f = (BLInstrumentationEdge*) *chordEdge;
-    if(v == f->getSource() || v == f->getTarget()) {
-      f->setIncrement(f->getIncrement() +
-                      calculateChordIncrementsDir(e,f)*weight);
+    chordEdges[(*chordEdge)->getSource()].push_back(*chordEdge);
+    if((*chordEdge)->getTarget() != (*chordEdge)->getSource())
+      chordEdges[(*chordEdge)->getTarget()].push_back(*chordEdge);
+  }
+
+  struct DfsItem {
+    long weight;
+    BallLarusNode* v;
+    BallLarusEdge* e;
+  };
+  std::vector<DfsItem> dfsStack;
+  DfsItem start = { weight, v, e };
+  dfsStack.push_back(start);
+
+  while(!dfsStack.empty()) {
+    DfsItem item = dfsStack.back();
+    dfsStack.pop_back();
+
+    IncidentEdgeMap::iterator incident = treeEdges.find(item.v);
+    if(incident != treeEdges.end()) {
+      for(BLEdgeIterator treeEdge = incident->second.begin(),
+            end = incident->second.end(); treeEdge != end; treeEdge++) {
+        BallLarusEdge* f = *treeEdge;
+        if(f == item.e)
+          continue;
+
+        DfsItem next = {
+          (long) (calculateChordIncrementsDir(item.e,f)*(item.weight) +
+                  f->getWeight()),
+          item.v == f->getTarget() ? f->getSource() : f->getTarget(),
+          f };
+        dfsStack.push_back(next);
+      }
+    }
+
+    incident = chordEdges.find(item.v);
+    if(incident != chordEdges.end()) {
+      for(BLEdgeIterator chordEdge = incident->second.begin(),
+            end = incident->second.end(); chordEdge != end; chordEdge++) {
+        BLInstrumentationEdge* f = (BLInstrumentationEdge*) *chordEdge;
+        f->setIncrement(f->getIncrement() +
+                        calculateChordIncrementsDir(item.e,f)*item.weight);
+      }
     }
   }
 }
@@ -925,6 +1065,47 @@ BasicBlock::iterator PathProfiler::getInsertionPoint(BasicBlock* block, Value*
   }
 }
 
+// Inserts the counter increment for a completed path and, for extended
+// path profiling, reports the path end to the runtime.
+void PathProfiler::insertPathEnd(Value* pathNumber,
+                                 BasicBlock::iterator insertPoint,
+                                 BLInstrumentationDag* dag) {
+  insertCounterIncrement(pathNumber, insertPoint, dag);
+
+  if (!extendedPaths)
+    return;
+
+  std::vector<Value*> args(2);
+  args[0] = ConstantInt::get(Type::getInt64Ty(*Context),
+                             currentFunctionNumber);
+  args[1] = pathNumber;
+  CallInst::Create(llvmPathEndFunction, args, "", insertPoint);
+}
+
+// Reports entering and leaving F to the runtime for extended path
+// profiling.  The frame address lets the runtime drop activations left by
+// unwinding.  Must run after the path instrumentation is inserted, so that
+// the last path ends before F is left.
+void PathProfiler::insertActivationTracking(Function &F, Module &M) {
+  BasicBlock::iterator insertPoint = F.getEntryBlock().getFirstInsertionPt();
+
+  Value* frameAddress = CallInst::Create(
+    Intrinsic::getDeclaration(&M, Intrinsic::frameaddress),
+    ConstantInt::get(Type::getInt32Ty(*Context), 0), "frame", insertPoint);
+
+  std::vector<Value*> args(2);
+  args[0] = ConstantInt::get(Type::getInt64Ty(*Context),
+                             currentFunctionNumber);
+  args[1] = frameAddress;
+  CallInst::Create(llvmPathEnterFunction, args, "", insertPoint);
+
+  for (Function::iterator BB = F.begin(), E = F.end(); BB != E; ++BB) {
+    TerminatorInst* terminator = BB->getTerminator();
+    if (isa<ReturnInst>(terminator) || isa<ResumeInst>(terminator))
+      CallInst::Create(llvmPathLeaveFunction, "", terminator);
+  }
+}
+
 // A PHINode is created in the node, and its values initialized to -1U.
 void PathProfiler::preparePHI(BLInstrumentationNode* node) {
   BasicBlock* block = node->getBlock();
@@ -1020,7 +1201,7 @@ void PathProfiler::insertCounterIncrement(Value* incValue,
                                           BLInstrumentationDag* dag,
                                           bool increment) {
   // Counter increment for array
-  if( dag->getNumberOfPaths() <= HASH_THRESHHOLD ) {
+  if( dag->getCounterArray() ) {
     // Get pointer to the array location
     std::vector<Value*> gepIndices(2);
     gepIndices[0] = Constant::getNullValue(Type::getInt64Ty(*Context));
@@ -1050,16 +1231,26 @@ void PathProfiler::insertCounterIncrement(Value* incValue,
                                                    insertPoint);
 
     // Store back in to the array
-    new StoreInst(newPc, pcPointer, insertPoint);
+    StoreInst* store = new StoreInst(newPc, pcPointer, insertPoint);
+
+    MarkProbe(pcPointer);
+    MarkProbe(oldPc);
+    MarkProbe(isMax);
+    MarkProbe(inc);
+    MarkProbe(newPc);
+    MarkProbe(store);
   } else { // Counter increment for hash
+    std::vector<Constant*> indices(2);
+    indices[0] = createIncrementConstant(0, 64);
+    indices[1] = createIncrementConstant(currentFunctionNumber - 1, 64);
+
     std::vector<Value*> args(2);
-    args[0] = ConstantInt::get(Type::getInt64Ty(*Context),
-                               currentFunctionNumber);
+    args[0] = ConstantExpr::getGetElementPtr(functionTable, indices);
     args[1] = incValue;
 
-    CallInst::Create(
+    MarkProbe(CallInst::Create(
       increment ? llvmIncrementHashFunction : llvmDecrementHashFunction,
-      args, "", insertPoint);
+      args, "", insertPoint));
   }
 }
 
@@ -1071,10 +1262,8 @@ void PathProfiler::insertCounterIncrement(Value* incValue,
 // Post: Edge's target node has a pathNumber set to the path number Value
 // corresponding to the value of the path register after edge's
 // execution.
-//
-// FIXME: This should be reworked so it's not recursive.
-void PathProfiler::insertInstrumentationStartingAt(BLInstrumentationEdge* edge,
-                                                   BLInstrumentationDag* dag) {
+BLInstrumentationNode* PathProfiler::instrumentEdge(BLInstrumentationEdge* edge,
+                                                    BLInstrumentationDag* dag) {
   // Mark the edge as instrumented
   edge->setHasInstrumentation(true);
   DEBUG(dbgs() << "\nInstrumenting edge: " << (*edge) << "\n");
@@ -1114,7 +1303,7 @@ void PathProfiler::insertInstrumentationStartingAt(BLInstrumentationEdge* edge,
   else {
     errs() << "Instrumenting could not split a critical edge.\n";
     DEBUG(dbgs() << "  Couldn't split edge " << (*edge) << ".\n");
-    return;
+    return NULL;
   }
 
   // Insert instrumentation if this is a back or split edge
@@ -1150,8 +1339,7 @@ void PathProfiler::insertInstrumentationStartingAt(BLInstrumentationEdge* edge,
       instrumentNode->setEndingPathNumber(newpn);
     }
 
-    insertCounterIncrement(instrumentNode->getEndingPathNumber(),
-                           insertPoint, dag);
+    insertPathEnd(instrumentNode->getEndingPathNumber(), insertPoint, dag);
 
     if( atBeginning )
       instrumentNode->setStartingPathNumber(createIncrementConstant(top));
@@ -1160,8 +1348,8 @@ void PathProfiler::insertInstrumentationStartingAt(BLInstrumentationEdge* edge,
 
     // Check for path counter increments
     if( top->isCounterIncrement() ) {
-      insertCounterIncrement(instrumentNode->getEndingPathNumber(),
-                             instrumentNode->getBlock()->getTerminator(),dag);
+      insertPathEnd(instrumentNode->getEndingPathNumber(),
+                    instrumentNode->getBlock()->getTerminator(), dag);
       instrumentNode->setEndingPathNumber(0);
     }
   }
@@ -1188,8 +1376,7 @@ void PathProfiler::insertInstrumentationStartingAt(BLInstrumentationEdge* edge,
 
     // Check for path counter increments
     if( edge->isCounterIncrement() ) {
-      insertCounterIncrement(instrumentNode->getEndingPathNumber(),
-                             insertPoint, dag);
+      insertPathEnd(instrumentNode->getEndingPathNumber(), insertPoint, dag);
       instrumentNode->setEndingPathNumber(0);
     }
   }
@@ -1198,15 +1385,36 @@ void PathProfiler::insertInstrumentationStartingAt(BLInstrumentationEdge* edge,
   if (nextSourceNode && instrumentNode->getEndingPathNumber())
     pushValueIntoNode(instrumentNode, nextSourceNode);
 
-  // Add all the successors
-  for( BLEdgeIterator next = targetNode->succBegin(),
-         end = targetNode->succEnd(); next != end; next++ ) {
+  return targetNode;
+}
+
+// Instruments the edges in the same order as a recursion over the successors
+// of every instrumented edge would, with an explicit stack of the successors
+// left to visit, so the depth of the DAG does not grow the call stack.
+void PathProfiler::insertInstrumentationStartingAt(BLInstrumentationEdge* edge,
+                                                   BLInstrumentationDag* dag) {
+  typedef std::pair<BLEdgeIterator, BLEdgeIterator> SuccRange;
+  std::vector<SuccRange> dfsStack;
+
+  if( BLInstrumentationNode* target = instrumentEdge(edge, dag) )
+    dfsStack.push_back(SuccRange(target->succBegin(), target->succEnd()));
+
+  while( !dfsStack.empty() ) {
+    SuccRange& succs = dfsStack.back();
+    if( succs.first == succs.second ) {
+      dfsStack.pop_back();
+      continue;
+    }
+
     // So long as it is un-instrumented, add it to the list
-    if( !((BLInstrumentationEdge*)(*next))->hasInstrumentation() )
-      insertInstrumentationStartingAt((BLInstrumentationEdge*)*next,dag);
-    else
-      DEBUG(dbgs() << "  Edge " << *(BLInstrumentationEdge*)(*next)
-            << " already instrumented.\n");
+    BLInstrumentationEdge* next = (BLInstrumentationEdge*)*succs.first++;
+    if( next->hasInstrumentation() ) {
+      DEBUG(dbgs() << "  Edge " << *next << " already instrumented.\n");
+      continue;
+    }
+
+    if( BLInstrumentationNode* target = instrumentEdge(next, dag) )
+      dfsStack.push_back(SuccRange(target->succBegin(), target->succEnd()));
   }
 }
 
@@ -1264,9 +1472,11 @@ void PathProfiler::insertInstrumentation(
 
 // Entry point of the module
 void PathProfiler::runOnFunction(std::vector<Constant*> &ftInit,
-                                 Function &F, Module &M) {
+                                 Function &F, Module &M,
+                                 const BLColdEdgeSet* coldEdges,
+                                 bool useArray) {
   // Build DAG from CFG
-  BLInstrumentationDag dag = BLInstrumentationDag(F);
+  BLInstrumentationDag dag(F, coldEdges);
   dag.init();
 
   // give each path a unique integer value
@@ -1285,7 +1495,7 @@ void PathProfiler::runOnFunction(std::vector<Constant*> &ftInit,
     dag.generateDotGraph ();
 
   // Should we store the information in an array or hash
-  if( dag.getNumberOfPaths() <= HASH_THRESHHOLD ) {
+  if( useArray ) {
     Type* t = ArrayType::get(Type::getInt64Ty(*Context),
                                    dag.getNumberOfPaths());
 
@@ -1296,11 +1506,14 @@ void PathProfiler::runOnFunction(std::vector<Constant*> &ftInit,
 
   insertInstrumentation(dag, M);
 
+  if (extendedPaths)
+    insertActivationTracking(F, M);
+
   // Add to global function reference table
   unsigned type;
   Type* voidPtr = TypeBuilder<types::i<8>*, true>::get(*Context);
 
-  if( dag.getNumberOfPaths() <= HASH_THRESHHOLD )
+  if( useArray )
     type = ProfilingArray;
   else
     type = ProfilingHash;
@@ -1318,6 +1531,132 @@ void PathProfiler::runOnFunction(std::vector<Constant*> &ftInit,
   ftInit.push_back(functionEntry);
 }
 
+// Adds a function table entry without counters for a function which is not
+// profiled.  The runtime writes no paths for it.
+void PathProfiler::addEmptyEntry(std::vector<Constant*> &ftInit) {
+  Type* voidPtr = TypeBuilder<types::i<8>*, true>::get(*Context);
+
+  std::vector<Constant*> entryArray(3);
+  entryArray[0] = createIncrementConstant(ProfilingArray,64);
+  entryArray[1] = createIncrementConstant(0,64);
+  entryArray[2] = Constant::getNullValue(voidPtr);
+
+  StructType* at = ftEntryTypeBuilder::get(*Context);
+  ftInit.push_back(ConstantStruct::get(at, entryArray));
+}
+
+// Returns the profile information used to rank functions: the prior edge
+// profile in targeted path profiling, else the static estimate.
+ProfileInfo& PathProfiler::getProfileInfo(Function &F) {
+  if (BallLarusDag::isTargeted())
+    return getAnalysis<ProfileInfo>();
+  return getAnalysis<ProfileInfo>(F);
+}
+
+// Estimates how often the path counters of each function are incremented
+// relative to the other functions.  This is the number of calls of the
+// function times the number of blocks executed per call, which grows with
+// the number of loop iterations and thus of paths.  With a prior edge
+// profile the number of calls is known.  Otherwise every function is
+// assumed to be called once, plus the estimated executions of its call
+// sites relative to their caller.
+void PathProfiler::estimateFrequencies(
+  const std::vector<Function*> &functions,
+  DenseMap<Function*, double> &frequencies) {
+  DenseMap<Function*, double> calls, blocksPerCall;
+  bool targeted = BallLarusDag::isTargeted();
+
+  for (unsigned i = 0, e = functions.size(); i != e; ++i) {
+    Function* F = functions[i];
+    ProfileInfo &PI = getProfileInfo(*F);
+
+    double entryCount = PI.getExecutionCount(F);
+    if (entryCount <= 0)
+      continue;
+
+    double blocks = 0;
+    for (Function::iterator BBI = F->begin(), BBE = F->end(); BBI != BBE;
+         ++BBI) {
+      double count = PI.getExecutionCount(&*BBI);
+      if (count <= 0)
+        continue;
+      blocks += count;
+
+      if (targeted)
+        continue;
+
+      for (BasicBlock::iterator I = BBI->begin(), IE = BBI->end(); I != IE;
+           ++I) {
+        CallSite CS(&*I);
+        if (!CS)
+          continue;
+        Function* callee = CS.getCalledFunction();
+        if (callee && !callee->isDeclaration())
+          calls[callee] += count / entryCount;
+      }
+    }
+
+    blocksPerCall[F] = blocks / entryCount;
+    if (targeted)
+      calls[F] = entryCount;
+  }
+
+  for (unsigned i = 0, e = functions.size(); i != e; ++i) {
+    Function* F = functions[i];
+    double callCount = targeted ? calls.lookup(F) : 1 + calls.lookup(F);
+    frequencies[F] = callCount * blocksPerCall.lookup(F);
+  }
+}
+
+// Orders functions by decreasing frequency, then by module order.
+static bool isHotter(const std::pair<double, unsigned> &a,
+                     const std::pair<double, unsigned> &b) {
+  if (a.first != b.first)
+    return a.first > b.first;
+  return a.second < b.second;
+}
+
+// Decides which functions count their paths in arrays.  Functions with few
+// enough paths get arrays, hottest first, until the module's array budget
+// is spent.  Functions with 0 paths are not profiled.
+void PathProfiler::chooseArrays(const std::vector<Function*> &functions,
+                                const std::vector<uint64_t> &numberPaths,
+                                std::vector<bool> &useArray) {
+  useArray.assign(functions.size(), false);
+
+  std::vector<std::pair<double, unsigned> > candidates;
+  for (unsigned i = 0, e = functions.size(); i != e; ++i)
+    if (numberPaths[i] && numberPaths[i] <= ArrayThreshold)
+      candidates.push_back(std::make_pair(0.0, i));
+
+  if (!ArrayBudget) {
+    for (unsigned i = 0, e = candidates.size(); i != e; ++i)
+      useArray[candidates[i].second] = true;
+    return;
+  }
+
+  DenseMap<Function*, double> frequencies;
+  estimateFrequencies(functions, frequencies);
+  for (unsigned i = 0, e = candidates.size(); i != e; ++i)
+    candidates[i].first = frequencies.lookup(functions[candidates[i].second]);
+  std::sort(candidates.begin(), candidates.end(), isHotter);
+
+  uint64_t bytes = 0;
+  for (unsigned i = 0, e = candidates.size(); i != e; ++i) {
+    unsigned index = candidates[i].second;
+    uint64_t size = numberPaths[index] * sizeof(uint64_t);
+    if (bytes + size > ArrayBudget) {
+      DEBUG(dbgs() << "No array budget left for "
+            << functions[index]->getName() << "\n");
+      continue;
+    }
+    bytes += size;
+    useArray[index] = true;
+  }
+
+  DEBUG(dbgs() << "Path counter arrays use " << bytes << " bytes\n");
+}
+
 // Output the bitcode if we want to observe instrumentation changess
 #define PRINT_MODULE dbgs() <<                               \
   "\n\n============= MODULE BEGIN ===============\n" << M << \
@@ -1335,59 +1674,166 @@ bool PathProfiler::runOnModule(Module &M) {
         << "****************************************\n"
         << "****************************************\n");
 
-  // No main, no instrumentation!
+  // Modules without main, such as shared libraries, are started from a
+  // global constructor.
   Function *Main = M.getFunction("main");
 
   // Using fortran? ... this kind of works
   if (!Main)
     Main = M.getFunction("MAIN__");
 
-  if (!Main) {
-    errs() << "WARNING: cannot insert path profiling into a module"
+  // Extended paths follow the activations of the whole program, only the
+  // main program records them.
+  extendedPaths = ExtendedPaths;
+  if (extendedPaths && !Main) {
+    errs() << "WARNING: cannot record extended paths in a module"
            << " with no main function!\n";
-    return false;
+    extendedPaths = false;
   }
 
+  Type* ftEntryPtr = PointerType::getUnqual(ftEntryTypeBuilder::get(*Context));
+
   llvmIncrementHashFunction = M.getOrInsertFunction(
     "llvm_increment_path_count",
     Type::getVoidTy(*Context), // return type
-    Type::getInt64Ty(*Context), // function number
+    ftEntryPtr, // function table entry
     Type::getInt64Ty(*Context), // path number
     NULL );
 
   llvmDecrementHashFunction = M.getOrInsertFunction(
     "llvm_decrement_path_count",
     Type::getVoidTy(*Context), // return type
-    Type::getInt64Ty(*Context), // function number
+    ftEntryPtr, // function table entry
     Type::getInt64Ty(*Context), // path number
     NULL );
 
-  std::vector<Constant*> ftInit;
-  unsigned functionNumber = 0;
+  if (extendedPaths) {
+    llvmPathEnterFunction = M.getOrInsertFunction(
+      "llvm_path_enter_function",
+      Type::getVoidTy(*Context), // return type
+      Type::getInt64Ty(*Context), // function number
+      Type::getInt8PtrTy(*Context), // frame address
+      NULL );
+
+    llvmPathLeaveFunction = M.getOrInsertFunction(
+      "llvm_path_leave_function",
+      Type::getVoidTy(*Context), // return type
+      NULL );
+
+    llvmPathEndFunction = M.getOrInsertFunction(
+      "llvm_path_end",
+      Type::getVoidTy(*Context), // return type
+      Type::getInt64Ty(*Context), // function number
+      Type::getInt64Ty(*Context), // path number
+      NULL );
+  }
+
+  // Number the paths of every function first, so that the counter arrays
+  // can be handed out across the whole module.  Functions with 0 paths are
+  // not profiled.
+  std::vector<Function*> functions;
+  std::vector<uint64_t> numberPaths;
+  ProfiledFunctions profiledFunctions;
+  std::map<Function*, BLColdEdgeSet> coldEdges;
   for (Module::iterator F = M.begin(), E = M.end(); F != E; F++) {
     if (F->isDeclaration())
       continue;
 
+    functions.push_back(F);
+    const BLColdEdgeSet* cold = 0;
+
+    // with a prior edge profile, skip cold functions and cut cold edges
+    if (BallLarusDag::isTargeted()) {
+      ProfileInfo &PI = getAnalysis<ProfileInfo>();
+      if (BallLarusDag::isColdFunction(PI, *F)) {
+        DEBUG(dbgs() << "Skipping cold function " << F->getName() << "\n");
+        numberPaths.push_back(0);
+        continue;
+      }
+
+      BallLarusDag::findColdEdges(PI, *F, coldEdges[F]);
+      cold = &coldEdges[F];
+      DEBUG(dbgs() << "Cutting " << cold->size() << " cold edges\n");
+    }
+
+    BallLarusDag dag(*F, cold);
+    dag.init();
+    if (!dag.calculatePathNumbers()) {
+      errs() << "WARNING: the paths of '" << F->getName() << "' overflow "
+             << "the path numbers, the function is not profiled!\n";
+      numberPaths.push_back(0);
+      continue;
+    }
+    numberPaths.push_back(dag.getNumberOfPaths());
+
+    // identify the function by its number before it is instrumented
+    profiledFunctions.add(*F, functions.size(), numberPaths.back());
+  }
+
+  std::vector<bool> useArray;
+  chooseArrays(functions, numberPaths, useArray);
+
+  // The table is initialized once all functions are instrumented.
+  Type *t = ftEntryTypeBuilder::get(*Context);
+  ArrayType* ftArrayType = ArrayType::get(t, functions.size());
+  functionTable =
+    new GlobalVariable(M, ftArrayType, false, GlobalValue::InternalLinkage,
+                       0, "functionPathTable");
+
+  std::vector<Constant*> ftInit;
+  for (unsigned i = 0, e = functions.size(); i != e; ++i) {
+    Function* F = functions[i];
     DEBUG(dbgs() << "Function: " << F->getName() << "\n");
-    functionNumber++;
 
     // set function number
-    currentFunctionNumber = functionNumber;
-    runOnFunction(ftInit, *F, M);
+    currentFunctionNumber = i + 1;
+
+    if (!numberPaths[i]) {
+      addEmptyEntry(ftInit);
+      continue;
+    }
+
+    // The path register cannot move between copies within an invocation, so
+    // a sampled function only switches copies at its entry.
+    ValueToValueMapTy VMap;
+    Function *Clean = extendedPaths ? 0 : CloneForSampling(F, VMap);
+
+    std::map<Function*, BLColdEdgeSet>::iterator cold = coldEdges.find(F);
+    runOnFunction(ftInit, *F, M,
+                  cold == coldEdges.end() ? 0 : &cold->second, useArray[i]);
+    if (Clean)
+      InsertSampling(F, Clean, VMap, false);
   }
 
-  Type *t = ftEntryTypeBuilder::get(*Context);
-  ArrayType* ftArrayType = ArrayType::get(t, ftInit.size());
   Constant* ftInitConstant = ConstantArray::get(ftArrayType, ftInit);
 
   DEBUG(dbgs() << " ftArrayType:" << *ftArrayType << "\n");
 
-  GlobalVariable* functionTable =
-    new GlobalVariable(M, ftArrayType, false, GlobalValue::InternalLinkage,
-                       ftInitConstant, "functionPathTable");
+  functionTable->setInitializer(ftInitConstant);
   Type *eltType = ftArrayType->getTypeAtIndex((unsigned)0);
-  InsertProfilingInitCall(Main, "llvm_start_path_profiling", functionTable,
-                          PointerType::getUnqual(eltType));
+  if (Main)
+    InsertProfilingInitCall(Main, "llvm_start_path_profiling", functionTable,
+                            PointerType::getUnqual(eltType));
+  else
+    InsertProfilingInit(M, "llvm_start_path_profiling", functionTable,
+                        PointerType::getUnqual(eltType));
+  InsertFunctionMap(M, PathInfo, profiledFunctions, Main);
+
+  // Run the probes only while profiling is enabled, with -profile-dormant.
+  InsertProbeGuards(M);
+
+  // Extended paths are recorded once the runtime knows k, before main's
+  // activation is reported.
+  if (extendedPaths) {
+    Constant* startFunction = M.getOrInsertFunction(
+      "llvm_start_extended_path_profiling",
+      Type::getVoidTy(*Context), // return type
+      Type::getInt64Ty(*Context), // iterations
+      NULL );
+    CallInst::Create(startFunction,
+                     createIncrementConstant(ExtendedPathIterations, 64), "",
+                     Main->getEntryBlock().getFirstInsertionPt());
+  }
 
   DEBUG(PRINT_MODULE);
 
@@ -1,7 +1,27 @@
 #include "ProfileCommon.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DepthFirstIterator.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
 
 using namespace llvm;
 
+static cl::opt<unsigned>
+StaleMatchPercent("stale-profile-match-percent", cl::init(50),
+                  cl::value_desc("percent"),
+                  cl::desc("Fraction of the blocks of a changed function "
+                           "which must match for its profile to be used"),
+                  cl::Hidden);
+
 void label_basic_blocks(Module& M,std::vector<BasicBlock*>& map, std::unordered_map<BasicBlock*, int>& reverse_map) {
 	int i=0;
 	for(typename Module::iterator fi=M.begin(),fe=M.end(); fi!=fe; ++fi) {
@@ -13,4 +33,412 @@ void label_basic_blocks(Module& M,std::vector<BasicBlock*>& map, std::unordered_
 			i++;
 		}
 	}
-}
\ No newline at end of file
+}
+
+void label_memory_operations(Module& M,std::vector<Instruction*>& map, std::unordered_map<Instruction*, int>& reverse_map) {
+	int i=0;
+	for(Module::iterator fi=M.begin(),fe=M.end(); fi!=fe; ++fi)
+		for (Function::iterator bbi=fi->begin(), bbe=fi->end(); bbi!=bbe; ++bbi)
+			for (BasicBlock::iterator ii=bbi->begin(), ie=bbi->end(); ii!=ie; ++ii) {
+				if (!isa<LoadInst>(ii) && !isa<StoreInst>(ii) &&
+				    !isa<AtomicCmpXchgInst>(ii) && !isa<AtomicRMWInst>(ii))
+					continue;
+				map.push_back(ii);
+				reverse_map[ii]=i;
+				i++;
+			}
+}
+
+// addWord - Hash the bytes of V in the same order on every host.
+static void addWord(MD5& Hash, uint64_t V) {
+	uint8_t Bytes[8];
+	for (unsigned i=0; i!=8; ++i)
+		Bytes[i]=uint8_t(V >> (8*i));
+	Hash.update(ArrayRef<uint8_t>(Bytes, 8));
+}
+
+// finalWord - The first eight bytes of the digest.
+static uint64_t finalWord(MD5& Hash) {
+	MD5::MD5Result Result;
+	Hash.final(Result);
+	uint64_t V=0;
+	for (unsigned i=0; i!=8; ++i)
+		V |= uint64_t(Result[i]) << (8*i);
+	return V;
+}
+
+uint64_t getFunctionGUID(const Function& F) {
+	MD5 Hash;
+	if (F.hasLocalLinkage()) {
+		Hash.update(sys::path::stem(F.getParent()->getModuleIdentifier()));
+		Hash.update(":");
+	}
+	Hash.update(F.getName());
+	return finalWord(Hash);
+}
+
+uint64_t getFunctionCFGHash(const Function& F) {
+	DenseMap<const BasicBlock*, uint64_t> Numbers;
+	uint64_t NumBlocks=0;
+	for (Function::const_iterator BB=F.begin(), E=F.end(); BB!=E; ++BB)
+		Numbers[BB]=NumBlocks++;
+
+	MD5 Hash;
+	addWord(Hash, NumBlocks);
+	for (Function::const_iterator BB=F.begin(), E=F.end(); BB!=E; ++BB) {
+		const TerminatorInst* TI=BB->getTerminator();
+		addWord(Hash, TI->getOpcode());
+		addWord(Hash, TI->getNumSuccessors());
+		for (unsigned s=0, e=TI->getNumSuccessors(); s!=e; ++s)
+			addWord(Hash, Numbers[TI->getSuccessor(s)]);
+	}
+	return finalWord(Hash);
+}
+
+const FunctionMapEntry* findProfiledFunction(const FunctionMap& Map, const Function& F, bool* Stale) {
+	FunctionMap::const_iterator I=Map.find(getFunctionGUID(F));
+	if (I==Map.end())
+		return 0;
+	bool Changed=I->second.cfgHash!=getFunctionCFGHash(F);
+	if (Stale) {
+		*Stale=Changed;
+		return &I->second;
+	}
+	if (Changed) {
+		errs() << "WARNING: profile information for '" << F.getName()
+		       << "' is stale, its control flow graph changed!\n";
+		return 0;
+	}
+	return &I->second;
+}
+
+uint64_t getBlockHash(const BasicBlock& BB) {
+	MD5 Hash;
+	for (BasicBlock::const_iterator I=BB.begin(), E=BB.end(); I!=E; ++I) {
+		if (isa<DbgInfoIntrinsic>(I))
+			continue;
+		addWord(Hash, I->getOpcode());
+	}
+	addWord(Hash, BB.getTerminator()->getNumSuccessors());
+	return finalWord(Hash);
+}
+
+void appendBlockMap(const Function& F, std::vector<uint64_t>& Words) {
+	DenseMap<const BasicBlock*, uint64_t> Numbers;
+	uint64_t NumBlocks=0;
+	for (Function::const_iterator BB=F.begin(), E=F.end(); BB!=E; ++BB)
+		Numbers[BB]=NumBlocks++;
+
+	Words.push_back(getFunctionGUID(F));
+	Words.push_back(NumBlocks);
+	for (Function::const_iterator BB=F.begin(), E=F.end(); BB!=E; ++BB) {
+		const TerminatorInst* TI=BB->getTerminator();
+		Words.push_back(getBlockHash(*BB));
+		Words.push_back(TI->getNumSuccessors());
+		for (unsigned s=0, e=TI->getNumSuccessors(); s!=e; ++s)
+			Words.push_back(Numbers[TI->getSuccessor(s)]);
+	}
+}
+
+bool parseBlockMap(const std::vector<uint64_t>& Words, BlockMap& Map) {
+	size_t i=0, e=Words.size();
+	while (i!=e) {
+		if (e-i<2)
+			return false;
+		uint64_t GUID=Words[i++], NumBlocks=Words[i++];
+		ProfiledCFG& CFG=Map[GUID];
+		CFG.BlockHashes.clear();
+		CFG.Successors.assign(NumBlocks, std::vector<uint64_t>());
+		for (uint64_t b=0; b!=NumBlocks; ++b) {
+			if (e-i<2)
+				return false;
+			CFG.BlockHashes.push_back(Words[i++]);
+			uint64_t NumSuccs=Words[i++];
+			if (e-i<NumSuccs)
+				return false;
+			for (uint64_t s=0; s!=NumSuccs; ++s) {
+				if (Words[i]>=NumBlocks)
+					return false;
+				CFG.Successors[b].push_back(Words[i++]);
+			}
+		}
+	}
+	return true;
+}
+
+bool matchStaleBlocks(const Function& F, const ProfiledCFG& Old, std::vector<const BasicBlock*>& OldToNew) {
+	size_t NumOld=Old.BlockHashes.size();
+	OldToNew.assign(NumOld, (const BasicBlock*)0);
+	if (NumOld==0 || F.empty())
+		return false;
+
+	// Blocks with the same hash are paired in function order.
+	std::map<uint64_t, std::vector<uint64_t> > OldByHash;
+	for (uint64_t b=0; b!=NumOld; ++b)
+		OldByHash[Old.BlockHashes[b]].push_back(b);
+
+	SmallPtrSet<const BasicBlock*, 32> Matched;
+	std::map<uint64_t, size_t> Used;
+	for (Function::const_iterator BB=F.begin(), E=F.end(); BB!=E; ++BB) {
+		std::map<uint64_t, std::vector<uint64_t> >::const_iterator I=OldByHash.find(getBlockHash(*BB));
+		if (I==OldByHash.end())
+			continue;
+		size_t& Next=Used[I->first];
+		if (Next==I->second.size())
+			continue;
+		OldToNew[I->second[Next++]]=BB;
+		Matched.insert(BB);
+	}
+
+	// The entry block stays the entry block whatever changed in it.
+	const BasicBlock* Entry=&F.getEntryBlock();
+	if (OldToNew[0]!=Entry) {
+		if (OldToNew[0])
+			Matched.erase(OldToNew[0]);
+		for (uint64_t b=1; b!=NumOld; ++b)
+			if (OldToNew[b]==Entry)
+				OldToNew[b]=0;
+		OldToNew[0]=Entry;
+		Matched.insert(Entry);
+	}
+
+	// Changed blocks are found through the successors of the matched ones.
+	bool Changed=true;
+	while (Changed) {
+		Changed=false;
+		for (uint64_t b=0; b!=NumOld; ++b) {
+			const BasicBlock* BB=OldToNew[b];
+			if (!BB)
+				continue;
+			const TerminatorInst* TI=BB->getTerminator();
+			if (TI->getNumSuccessors()!=Old.Successors[b].size())
+				continue;
+			for (unsigned s=0, e=TI->getNumSuccessors(); s!=e; ++s) {
+				uint64_t OldSucc=Old.Successors[b][s];
+				const BasicBlock* Succ=TI->getSuccessor(s);
+				if (OldToNew[OldSucc] || Matched.count(Succ))
+					continue;
+				OldToNew[OldSucc]=Succ;
+				Matched.insert(Succ);
+				Changed=true;
+			}
+		}
+	}
+
+	return Matched.size()*100>=NumOld*StaleMatchPercent;
+}
+
+void mapStaleEdges(const ProfiledCFG& Old, const std::vector<const BasicBlock*>& OldToNew, bool ExitEdges, std::vector<ProfiledEdge>& Edges) {
+	const ProfiledEdge None((const BasicBlock*)0, (const BasicBlock*)0);
+	Edges.clear();
+	Edges.push_back(ProfiledEdge((const BasicBlock*)0, OldToNew[0]));
+	for (uint64_t b=0, e=Old.Successors.size(); b!=e; ++b) {
+		const BasicBlock* BB=OldToNew[b];
+		const std::vector<uint64_t>& Succs=Old.Successors[b];
+		if (ExitEdges && Succs.empty()) {
+			if (BB && BB->getTerminator()->getNumSuccessors()==0)
+				Edges.push_back(ProfiledEdge(BB, (const BasicBlock*)0));
+			else
+				Edges.push_back(None);
+		}
+		for (unsigned s=0, se=Succs.size(); s!=se; ++s) {
+			const BasicBlock* Succ=OldToNew[Succs[s]];
+			bool Exists=false;
+			if (BB && Succ) {
+				const TerminatorInst* TI=BB->getTerminator();
+				for (unsigned n=0, ne=TI->getNumSuccessors(); n!=ne; ++n)
+					Exists|=TI->getSuccessor(n)==Succ;
+			}
+			Edges.push_back(Exists ? ProfiledEdge(BB, Succ) : None);
+		}
+	}
+}
+
+// isReducible - Whether every cycle of F is a natural loop, that is the graph
+// without the back edges to dominators is acyclic.
+static bool isReducible(Function& F, const DominatorTree& DT, const DenseMap<const BasicBlock*, unsigned>& Number) {
+	std::vector<unsigned> NumPreds(F.size(), 0);
+	for (Function::iterator BB=F.begin(), E=F.end(); BB!=E; ++BB)
+		for (succ_iterator SI=succ_begin(BB), SE=succ_end(BB); SI!=SE; ++SI)
+			if (!DT.dominates(*SI, BB))
+				++NumPreds[Number.lookup(*SI)];
+
+	std::vector<BasicBlock*> Ready;
+	for (Function::iterator BB=F.begin(), E=F.end(); BB!=E; ++BB)
+		if (NumPreds[Number.lookup(BB)]==0)
+			Ready.push_back(BB);
+	size_t NumSorted=0;
+	while (!Ready.empty()) {
+		BasicBlock* BB=Ready.back();
+		Ready.pop_back();
+		++NumSorted;
+		for (succ_iterator SI=succ_begin(BB), SE=succ_end(BB); SI!=SE; ++SI)
+			if (!DT.dominates(*SI, BB) && --NumPreds[Number.lookup(*SI)]==0)
+				Ready.push_back(*SI);
+	}
+	return NumSorted==F.size();
+}
+
+// passesEveryIteration - Whether every path from A to the end of its iteration
+// of L, back to the header or out of L, passes B.  A postdominating B may still
+// be skipped by the iterations which take another latch.
+static bool passesEveryIteration(BasicBlock* A, BasicBlock* B, const Loop* L) {
+	SmallPtrSet<BasicBlock*, 16> Visited;
+	std::vector<BasicBlock*> Worklist;
+	Visited.insert(B);
+	Visited.insert(A);
+	Worklist.push_back(A);
+	while (!Worklist.empty()) {
+		BasicBlock* BB=Worklist.back();
+		Worklist.pop_back();
+		for (succ_iterator SI=succ_begin(BB), SE=succ_end(BB); SI!=SE; ++SI) {
+			if (*SI==L->getHeader() || !L->contains(*SI))
+				return false;
+			if (Visited.insert(*SI))
+				Worklist.push_back(*SI);
+		}
+	}
+	return true;
+}
+
+void getBlockClasses(Function& F, std::vector<unsigned>& Classes) {
+	DenseMap<const BasicBlock*, unsigned> Number;
+	Classes.clear();
+	for (Function::iterator BB=F.begin(), E=F.end(); BB!=E; ++BB) {
+		Number[BB]=Classes.size();
+		Classes.push_back(Classes.size());
+	}
+
+	DominatorTree DT;
+	DT.recalculate(F);
+	if (!isReducible(F, DT, Number))
+		return;
+	DominatorTreeBase<BasicBlock> PDT(true);
+	PDT.recalculate(F);
+	LoopInfoBase<BasicBlock, Loop> LI;
+	LI.Analyze(DT);
+
+	// Dominators come first in a walk of the dominator tree, so the class of
+	// the immediate dominator is final when a block joins it.
+	for (df_iterator<DomTreeNode*> I=df_begin(DT.getRootNode()), E=df_end(DT.getRootNode()); I!=E; ++I) {
+		if (!I->getIDom())
+			continue;
+		BasicBlock* BB=I->getBlock();
+		BasicBlock* IDom=I->getIDom()->getBlock();
+		if (!PDT.getNode(BB) || !PDT.getNode(IDom) || !PDT.dominates(BB, IDom))
+			continue;
+		Loop* L=LI.getLoopFor(BB);
+		if (L!=LI.getLoopFor(IDom))
+			continue;
+		if (L && !passesEveryIteration(IDom, BB, L))
+			continue;
+		Classes[Number[BB]]=Classes[Number[IDom]];
+	}
+}
+
+BlockCountSolver::BlockCountSolver(Function& F) {
+	getBlockClasses(F, Classes);
+	unsigned NumBlocks=Classes.size();
+	Members.resize(NumBlocks);
+	for (unsigned b=0; b!=NumBlocks; ++b)
+		Members[Classes[b]].push_back(b);
+
+	DenseMap<const BasicBlock*, unsigned> Number;
+	unsigned b=0;
+	for (Function::iterator BB=F.begin(), E=F.end(); BB!=E; ++BB)
+		Number[BB]=b++;
+
+	InEdges.resize(NumBlocks);
+	OutEdges.resize(NumBlocks);
+	if (NumBlocks) {
+		InEdges[0].push_back(Edges.size());
+		Edges.push_back(std::make_pair(-1, 0));
+	}
+	for (Function::iterator BB=F.begin(), E=F.end(); BB!=E; ++BB) {
+		unsigned Src=Number[BB];
+		TerminatorInst* TI=BB->getTerminator();
+		SmallPtrSet<BasicBlock*, 8> Visited;
+		for (unsigned s=0, se=TI->getNumSuccessors(); s!=se; ++s) {
+			BasicBlock* Succ=TI->getSuccessor(s);
+			if (!Visited.insert(Succ))
+				continue;
+			unsigned Dst=Number[Succ];
+			OutEdges[Src].push_back(Edges.size());
+			InEdges[Dst].push_back(Edges.size());
+			Edges.push_back(std::make_pair((int)Src, (int)Dst));
+		}
+		if (Visited.empty()) {
+			OutEdges[Src].push_back(Edges.size());
+			Edges.push_back(std::make_pair((int)Src, -1));
+		}
+	}
+	reset();
+}
+
+void BlockCountSolver::reset() {
+	unsigned NumBlocks=Classes.size();
+	BlockKnown.assign(NumBlocks, false);
+	BlockCounts.assign(NumBlocks, 0);
+	EdgeKnown.assign(Edges.size(), false);
+	EdgeCounts.assign(Edges.size(), 0);
+	NumUnknown=NumBlocks;
+	// Every block is visited once, which finds the blocks without incoming
+	// edges to never run.
+	Worklist.clear();
+	for (unsigned b=0; b!=NumBlocks; ++b)
+		Worklist.push_back(b);
+}
+
+void BlockCountSolver::setCount(unsigned B, uint64_t Count) {
+	if (BlockKnown[B])
+		return;
+	const std::vector<unsigned>& Class=Members[Classes[B]];
+	for (unsigned i=0, e=Class.size(); i!=e; ++i) {
+		unsigned M=Class[i];
+		BlockKnown[M]=true;
+		BlockCounts[M]=Count;
+		--NumUnknown;
+		Worklist.push_back(M);
+	}
+}
+
+void BlockCountSolver::setEdgeCount(unsigned E, uint64_t Count) {
+	EdgeKnown[E]=true;
+	EdgeCounts[E]=Count;
+	if (Edges[E].first>=0)
+		Worklist.push_back(Edges[E].first);
+	if (Edges[E].second>=0)
+		Worklist.push_back(Edges[E].second);
+}
+
+// solveBlock - Apply the conservation of the flow through block B over the
+// edges Flow, either all incoming or all outgoing ones.
+void BlockCountSolver::solveBlock(unsigned B, const std::vector<unsigned>& Flow) {
+	uint64_t Sum=0;
+	unsigned NumUnknownEdges=0, Unknown=0;
+	for (unsigned i=0, e=Flow.size(); i!=e; ++i) {
+		if (EdgeKnown[Flow[i]])
+			Sum+=EdgeCounts[Flow[i]];
+		else {
+			++NumUnknownEdges;
+			Unknown=Flow[i];
+		}
+	}
+	if (!BlockKnown[B]) {
+		if (NumUnknownEdges==0)
+			setCount(B, Sum);
+	} else if (NumUnknownEdges==1) {
+		// The flow of programs leaving through exit() is not conserved.
+		setEdgeCount(Unknown, BlockCounts[B]>Sum ? BlockCounts[B]-Sum : 0);
+	}
+}
+
+unsigned BlockCountSolver::solve() {
+	while (!Worklist.empty()) {
+		unsigned B=Worklist.back();
+		Worklist.pop_back();
+		solveBlock(B, InEdges[B]);
+		solveBlock(B, OutEdges[B]);
+	}
+	return NumUnknown;
+}
@@ -0,0 +1,148 @@
+//===- ProfileCounterKernels.cpp - Byte swap and accumulate counters ------===//
+//
+//                      The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the kernels used by the profile loaders to byte swap
+// blocks of counters and to accumulate them into the counters of previous
+// runs.  On x86 hosts vectorized versions are selected at run time, since the
+// library is not built with -msse4.1 or -mavx2.
+//
+//===----------------------------------------------------------------------===//
+
+#include "ProfileInfoLoader.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+# if !defined(__clang__)
+#  define PROFILE_KERNELS_X86 1
+# elif defined(__has_builtin)
+#  if __has_builtin(__builtin_cpu_supports)
+#   define PROFILE_KERNELS_X86 1
+#  endif
+# endif
+#endif
+
+#ifdef PROFILE_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+using namespace llvm;
+
+// AddCounts - Add 'A' and 'B', accounting for the fact that the value of one
+// (or both) may be Uncounted.
+static uint64_t AddCounts(uint64_t A, uint64_t B) {
+  // If either value is undefined, use the other.
+  if (A == ProfileInfoLoader::Uncounted) return B;
+  if (B == ProfileInfoLoader::Uncounted) return A;
+  return A + B;
+}
+
+static void byteSwapCountsScalar(uint64_t *Data, uint64_t NumEntries) {
+  for (uint64_t i = 0; i != NumEntries; ++i)
+    Data[i] = ByteSwap(Data[i], true);
+}
+
+static void accumulateCountsScalar(uint64_t *Data, const uint64_t *Src,
+                                   uint64_t NumEntries, bool ShouldByteSwap) {
+  for (uint64_t i = 0; i != NumEntries; ++i)
+    Data[i] = AddCounts(ByteSwap(Src[i], ShouldByteSwap), Data[i]);
+}
+
+#ifdef PROFILE_KERNELS_X86
+// The SSE kernels need pshufb (SSSE3), pcmpeqq and pblendvb (SSE4.1).
+__attribute__((target("sse4.1")))
+static void byteSwapCountsSSE41(uint64_t *Data, uint64_t NumEntries) {
+  const __m128i Shuffle = _mm_set_epi8(8, 9, 10, 11, 12, 13, 14, 15,
+                                       0, 1, 2, 3, 4, 5, 6, 7);
+  uint64_t i = 0;
+  for (; i + 2 <= NumEntries; i += 2) {
+    __m128i V = _mm_loadu_si128((const __m128i*)(Data + i));
+    _mm_storeu_si128((__m128i*)(Data + i), _mm_shuffle_epi8(V, Shuffle));
+  }
+  byteSwapCountsScalar(Data + i, NumEntries - i);
+}
+
+__attribute__((target("sse4.1")))
+static void accumulateCountsSSE41(uint64_t *Data, const uint64_t *Src,
+                                  uint64_t NumEntries, bool ShouldByteSwap) {
+  const __m128i Shuffle = _mm_set_epi8(8, 9, 10, 11, 12, 13, 14, 15,
+                                       0, 1, 2, 3, 4, 5, 6, 7);
+  const __m128i Uncounted = _mm_set1_epi64x(ProfileInfoLoader::Uncounted);
+  uint64_t i = 0;
+  for (; i + 2 <= NumEntries; i += 2) {
+    __m128i A = _mm_loadu_si128((const __m128i*)(Src + i));
+    if (ShouldByteSwap)
+      A = _mm_shuffle_epi8(A, Shuffle);
+    __m128i B = _mm_loadu_si128((const __m128i*)(Data + i));
+
+    // Same selection as AddCounts: an Uncounted lane takes the other value.
+    __m128i Sum = _mm_add_epi64(A, B);
+    Sum = _mm_blendv_epi8(Sum, A, _mm_cmpeq_epi64(B, Uncounted));
+    Sum = _mm_blendv_epi8(Sum, B, _mm_cmpeq_epi64(A, Uncounted));
+    _mm_storeu_si128((__m128i*)(Data + i), Sum);
+  }
+  accumulateCountsScalar(Data + i, Src + i, NumEntries - i, ShouldByteSwap);
+}
+
+__attribute__((target("avx2")))
+static void byteSwapCountsAVX2(uint64_t *Data, uint64_t NumEntries) {
+  const __m256i Shuffle = _mm256_set_epi8(8, 9, 10, 11, 12, 13, 14, 15,
+                                          0, 1, 2, 3, 4, 5, 6, 7,
+                                          8, 9, 10, 11, 12, 13, 14, 15,
+                                          0, 1, 2, 3, 4, 5, 6, 7);
+  uint64_t i = 0;
+  for (; i + 4 <= NumEntries; i += 4) {
+    __m256i V = _mm256_loadu_si256((const __m256i*)(Data + i));
+    _mm256_storeu_si256((__m256i*)(Data + i), _mm256_shuffle_epi8(V, Shuffle));
+  }
+  byteSwapCountsScalar(Data + i, NumEntries - i);
+}
+
+__attribute__((target("avx2")))
+static void accumulateCountsAVX2(uint64_t *Data, const uint64_t *Src,
+                                 uint64_t NumEntries, bool ShouldByteSwap) {
+  const __m256i Shuffle = _mm256_set_epi8(8, 9, 10, 11, 12, 13, 14, 15,
+                                          0, 1, 2, 3, 4, 5, 6, 7,
+                                          8, 9, 10, 11, 12, 13, 14, 15,
+                                          0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256i Uncounted = _mm256_set1_epi64x(ProfileInfoLoader::Uncounted);
+  uint64_t i = 0;
+  for (; i + 4 <= NumEntries; i += 4) {
+    __m256i A = _mm256_loadu_si256((const __m256i*)(Src + i));
+    if (ShouldByteSwap)
+      A = _mm256_shuffle_epi8(A, Shuffle);
+    __m256i B = _mm256_loadu_si256((const __m256i*)(Data + i));
+
+    __m256i Sum = _mm256_add_epi64(A, B);
+    Sum = _mm256_blendv_epi8(Sum, A, _mm256_cmpeq_epi64(B, Uncounted));
+    Sum = _mm256_blendv_epi8(Sum, B, _mm256_cmpeq_epi64(A, Uncounted));
+    _mm256_storeu_si256((__m256i*)(Data + i), Sum);
+  }
+  accumulateCountsScalar(Data + i, Src + i, NumEntries - i, ShouldByteSwap);
+}
+#endif
+
+void llvm::ByteSwapCounts(uint64_t *Data, uint64_t NumEntries) {
+#ifdef PROFILE_KERNELS_X86
+  if (__builtin_cpu_supports("avx2"))
+    return byteSwapCountsAVX2(Data, NumEntries);
+  if (__builtin_cpu_supports("sse4.1"))
+    return byteSwapCountsSSE41(Data, NumEntries);
+#endif
+  byteSwapCountsScalar(Data, NumEntries);
+}
+
+void llvm::AccumulateCounts(uint64_t *Data, const uint64_t *Src,
+                            uint64_t NumEntries, bool ShouldByteSwap) {
+#ifdef PROFILE_KERNELS_X86
+  if (__builtin_cpu_supports("avx2"))
+    return accumulateCountsAVX2(Data, Src, NumEntries, ShouldByteSwap);
+  if (__builtin_cpu_supports("sse4.1"))
+    return accumulateCountsSSE41(Data, Src, NumEntries, ShouldByteSwap);
+#endif
+  accumulateCountsScalar(Data, Src, NumEntries, ShouldByteSwap);
+}
@@ -20,6 +20,7 @@
 #include "llvm/Support/raw_ostream.h"
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 using namespace llvm;
 
 
@@ -94,13 +95,67 @@ static void ReadProfilingArgBlock(const char *ToolName, FILE *F,
   CommandLines.push_back(std::string(&Args[0], &Args[ArgLength]));
 }
 
+/// ReadMapWords - Read the words of a function or block map packet, which
+/// start with the type of the counters the map describes.
+static void ReadMapWords(const char *ToolName, FILE *F, bool ShouldByteSwap,
+                         std::vector<uint64_t> &Words) {
+  uint64_t NumEntries = ReadProfilingNumEntries(ToolName, F, ShouldByteSwap);
+  if (NumEntries == 0)
+    report_fatal_error(Twine(ToolName) + ": Map has no counter type");
+
+  Words.resize(NumEntries);
+  ReadProfilingData<uint64_t>(ToolName, F, Words.data(), NumEntries);
+  if (ShouldByteSwap)
+    for (uint64_t i = 0; i < NumEntries; ++i)
+      Words[i] = ByteSwap_64(Words[i]);
+}
+
+/// ReadFunctionMapBlock - Read a function map, the type of the counters it
+/// describes followed by FunctionMapEntry records.  Only maps of the edge
+/// counters are kept in 'Map', a later one replacing an earlier one.
+static bool ReadFunctionMapBlock(const char *ToolName, FILE *F,
+                                 bool ShouldByteSwap, FunctionMap &Map) {
+  std::vector<uint64_t> Words;
+  ReadMapWords(ToolName, F, ShouldByteSwap, Words);
+  uint64_t NumEntries = Words.size();
+  const size_t EntryWords = sizeof(FunctionMapEntry) / sizeof(uint64_t);
+  if ((NumEntries - 1) % EntryWords)
+    report_fatal_error(Twine(ToolName) + ": Function map has a partial entry");
+
+  if (Words[0] != EdgeInfo)
+    return false;
+
+  Map.clear();
+  for (uint64_t i = 1; i < NumEntries; i += EntryWords) {
+    FunctionMapEntry Entry;
+    memcpy(&Entry, &Words[i], sizeof(FunctionMapEntry));
+    Map[Entry.guid] = Entry;
+  }
+  return true;
+}
+
+/// ReadBlockMapBlock - Read a block map, the type of the counters it
+/// describes followed by the control flow graphs of the profiled functions.
+/// Only maps of the edge counters are kept in 'Blocks', without their type.
+static bool ReadBlockMapBlock(const char *ToolName, FILE *F,
+                              bool ShouldByteSwap,
+                              std::vector<uint64_t> &Blocks) {
+  std::vector<uint64_t> Words;
+  ReadMapWords(ToolName, F, ShouldByteSwap, Words);
+  if (Words[0] != EdgeInfo)
+    return false;
+
+  Blocks.assign(Words.begin() + 1, Words.end());
+  return true;
+}
+
 const uint64_t ProfileDataLoader::Uncounted = ~0U;
 
 /// ProfileDataLoader ctor - Read the specified profiling data file, reporting
 /// a fatal error if the file is invalid or broken.
 ProfileDataLoader::ProfileDataLoader(const char *ToolName,
                                      const std::string &Filename)
-  : Filename(Filename) {
+  : Filename(Filename), HasEdgeFunctions(false), HasEdgeBlocks(false) {
   FILE *F = fopen(Filename.c_str(), "rb");
   if (F == 0)
     report_fatal_error(Twine(ToolName) + ": Error opening '" +
@@ -125,6 +180,16 @@ ProfileDataLoader::ProfileDataLoader(const char *ToolName,
         ReadProfilingBlock(ToolName, F, ShouldByteSwap, EdgeCounts);
         break;
 
+      case FunctionMapInfo:
+        if (ReadFunctionMapBlock(ToolName, F, ShouldByteSwap, EdgeFunctions))
+          HasEdgeFunctions = true;
+        break;
+
+      case BlockMapInfo:
+        if (ReadBlockMapBlock(ToolName, F, ShouldByteSwap, EdgeBlocks))
+          HasEdgeBlocks = true;
+        break;
+
       default:
         report_fatal_error(std::string(ToolName)
                            + ": Unknown profiling packet type");
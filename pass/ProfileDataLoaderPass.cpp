@@ -21,6 +21,7 @@
 #include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/Statistic.h"
 #include "ProfileDataLoader.h"
+#include "ProfileInfo.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/InstrTypes.h"
 #include "llvm/IR/LLVMContext.h"
@@ -37,6 +38,7 @@ using namespace llvm;
 
 STATISTIC(NumEdgesRead, "The # of edges read.");
 STATISTIC(NumTermsAnnotated, "The # of terminator instructions annotated.");
+STATISTIC(NumFunctionsMatched, "The # of changed functions matched.");
 
 static cl::opt<std::string>
 ProfileMetadataFilename("profile-file", cl::init("llvmprof.out"),
@@ -65,7 +67,12 @@ namespace {
 
     virtual void readEdge(unsigned, ProfileData&, ProfileData::Edge,
                           ArrayRef<uint64_t>);
-    virtual unsigned matchEdges(Module&, ProfileData&, ArrayRef<uint64_t>);
+    virtual unsigned matchEdges(Module&, ProfileData&, ArrayRef<uint64_t>,
+                                const FunctionMap*, const BlockMap*);
+    virtual unsigned matchStaleEdges(Function*, ProfileData&,
+                                     ArrayRef<uint64_t>,
+                                     const FunctionMapEntry&,
+                                     const BlockMap&);
     virtual void setBranchWeightMetadata(Module&, ProfileData&);
 
     virtual bool runOnModule(Module &M);
@@ -94,15 +101,33 @@ void ProfileMetadataLoaderPass::readEdge(unsigned ReadCount,
                << PB.getEdgeWeight(e) << "\n");
 }
 
-/// matchEdges - Link every profile counter with an edge.
+/// matchEdges - Link every profile counter with an edge.  With a function
+/// map, the counters of every function are found by its identity, functions
+/// which changed are matched through the block map if there is one and
+/// skipped otherwise.  Without a map the counters of the functions follow
+/// each other in module order.  Returns the number of counters read.
 unsigned ProfileMetadataLoaderPass::matchEdges(Module &M, ProfileData &PB,
-                                               ArrayRef<uint64_t> Counters) {
+                                               ArrayRef<uint64_t> Counters,
+                                               const FunctionMap *Map,
+                                               const BlockMap *Blocks) {
   if (Counters.size() == 0) return 0;
 
-  unsigned ReadCount = 0;
+  unsigned ReadCount = 0, NumRead = 0;
 
   for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
     if (F->isDeclaration()) continue;
+    if (Map) {
+      bool Stale = false;
+      const FunctionMapEntry *Entry =
+        findProfiledFunction(*Map, *F, Blocks ? &Stale : 0);
+      if (!Entry) continue;
+      if (Stale) {
+        NumRead += matchStaleEdges(F, PB, Counters, *Entry, *Blocks);
+        continue;
+      }
+      ReadCount = Entry->firstCounter;
+    }
+    unsigned FirstCount = ReadCount;
     DEBUG(dbgs() << "Loading edges in '" << F->getName() << "'\n");
     readEdge(ReadCount++, PB, PB.getEdge(0, &F->getEntryBlock()), Counters);
     for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB) {
@@ -112,9 +137,82 @@ unsigned ProfileMetadataLoaderPass::matchEdges(Module &M, ProfileData &PB,
                  Counters);
       }
     }
+    NumRead += ReadCount - FirstCount;
+  }
+
+  return NumRead;
+}
+
+/// checkStaleEdges - Report the matched edges of F whose loaded weight is not
+/// the sum of the counters matched with them.
+static void checkStaleEdges(const Function *F, const ProfileData &PB,
+                            ArrayRef<uint64_t> Counters,
+                            const FunctionMapEntry &Entry,
+                            const std::vector<ProfiledEdge> &Edges) {
+  std::map<ProfiledEdge, uint64_t> Expected;
+  for (unsigned i = 0, e = Edges.size(); i != e; ++i) {
+    uint64_t Index = Entry.firstCounter + i;
+    if (Index < Counters.size() && Edges[i].second)
+      Expected[Edges[i]] += Counters[Index];
+  }
+
+  for (std::map<ProfiledEdge, uint64_t>::iterator I = Expected.begin(),
+       E = Expected.end(); I != E; ++I) {
+    uint64_t Loaded = PB.hasEdgeWeight(I->first) ?
+      PB.getEdgeWeight(I->first) : ~0ULL;
+    if (Loaded != I->second)
+      dbgs() << "--Stale edge " << I->first << " of " << F->getName()
+             << " loaded as " << Loaded << " instead of " << I->second
+             << "\n";
   }
+}
+
+/// matchStaleEdges - Link the counters of F, whose control flow graph changed
+/// since it was profiled, with the edges between the blocks matching the
+/// profiled ones.  The weights of the other edges are estimated from the flow
+/// through the function, as ProfileInfo repairs it.  Returns the number of
+/// counters read.
+unsigned ProfileMetadataLoaderPass::matchStaleEdges(Function *F,
+                                                    ProfileData &PB,
+                                                    ArrayRef<uint64_t> Counters,
+                                                    const FunctionMapEntry &Entry,
+                                                    const BlockMap &Blocks) {
+  BlockMap::const_iterator CFG = Blocks.find(Entry.guid);
+  std::vector<const BasicBlock*> OldToNew;
+  std::vector<ProfiledEdge> Edges;
+  if (CFG != Blocks.end() && matchStaleBlocks(*F, CFG->second, OldToNew))
+    mapStaleEdges(CFG->second, OldToNew, false, Edges);
+  if (Edges.empty() || Edges.size() != Entry.numCounters) {
+    errs() << "WARNING: profile information for '" << F->getName()
+           << "' is stale and could not be matched!\n";
+    return 0;
+  }
+
+  ProfileInfo PI;
+  unsigned NumRead = 0;
+  for (unsigned i = 0, e = Edges.size(); i != e; ++i) {
+    uint64_t Index = Entry.firstCounter + i;
+    if (Index >= Counters.size() || !Edges[i].second)
+      continue;
+    // Several old edges may be matched with the same new one.
+    PI.getEdgeWeights(F)[Edges[i]] += Counters[Index];
+    ++NumRead;
+  }
+  PI.repair(F);
+
+  // ProfileData has no exit edges, their weights only served the repair.
+  ProfileInfo::EdgeWeights &Weights = PI.getEdgeWeights(F);
+  for (ProfileInfo::EdgeWeights::iterator I = Weights.begin(),
+       E = Weights.end(); I != E; ++I) {
+    if (!I->first.second || I->second == ProfileInfo::MissingValue)
+      continue;
+    PB.addEdgeWeight(I->first, (uint64_t)I->second);
+  }
+  DEBUG(checkStaleEdges(F, PB, Counters, Entry, Edges));
 
-  return ReadCount;
+  DEBUG(dbgs() << "Matched the stale profile of " << F->getName() << "\n");
+  ++NumFunctionsMatched;
+  return NumRead;
 }
 
 /// setBranchWeightMetadata - Translate the counter values associated with each
@@ -123,7 +221,7 @@ unsigned ProfileMetadataLoaderPass::matchEdges(Module &M, ProfileData &PB,
 void ProfileMetadataLoaderPass::setBranchWeightMetadata(Module &M,
                                                         ProfileData &PB) {
   for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
-    if (F->isDeclaration()) continue;
+    if (F->isDeclaration() || !PB.hasProfile(F)) continue;
     DEBUG(dbgs() << "Setting branch metadata in '" << F->getName() << "'\n");
 
     for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB) {
@@ -138,12 +236,19 @@ void ProfileMetadataLoaderPass::setBranchWeightMetadata(Module &M,
       DEBUG(dbgs() << "-- Terminator with " << NumSuccessors
                    << " successors:\n");
       SmallVector<uint32_t, 4> Weights(NumSuccessors);
+      bool Complete = true;
       for (unsigned s = 0 ; s < NumSuccessors ; ++s) {
           ProfileData::Edge edge = PB.getEdge(BB, TI->getSuccessor(s));
+          // The repair of a stale profile may leave edges without weight.
+          if (!PB.hasEdgeWeight(edge)) {
+            Complete = false;
+            break;
+          }
           Weights[s] = (uint32_t)PB.getEdgeWeight(edge);
           DEBUG(dbgs() << "---- Edge '" << edge << "' has weight "
                        << Weights[s] << "\n");
       }
+      if (!Complete) continue;
 
       // Set branch weight metadata.  This will set branch probabilities of
       // 100%/0% if that is true of the dynamic execution.
@@ -164,9 +269,17 @@ bool ProfileMetadataLoaderPass::runOnModule(Module &M) {
 
   ArrayRef<uint64_t> Counters = PDL.getRawEdgeCounts();
 
-  uint64_t ReadCount = matchEdges(M, PB, Counters);
+  const FunctionMap *Map = PDL.getEdgeFunctionMap();
+  BlockMap Blocks;
+  const std::vector<uint64_t> *BlockWords = PDL.getRawEdgeBlockMap();
+  bool HasBlocks = BlockWords && parseBlockMap(*BlockWords, Blocks);
+  if (BlockWords && !HasBlocks)
+    errs() << "WARNING: the block map of the profile is malformed, "
+           << "changed functions are not matched!\n";
+  uint64_t ReadCount = matchEdges(M, PB, Counters, Map,
+                                  HasBlocks ? &Blocks : 0);
 
-  if (ReadCount != Counters.size()) {
+  if (!Map && ReadCount != Counters.size()) {
     errs() << "WARNING: profile information is inconsistent with "
            << "the current program!\n";
   }
@@ -22,18 +22,12 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
 
 using namespace llvm;
 
 
-static uint64_t AddCounts(uint64_t A, uint64_t B) {
-  // If either value is undefined, use the other.
-  if (A == ProfileInfoLoader::Uncounted) return B;
-  if (B == ProfileInfoLoader::Uncounted) return A;
-  return A + B;
-}
-
 void llvm::ReadProfilingBlock(const char *ToolName, FILE *F,
                                bool ShouldByteSwap,
                                std::vector<uint64_t> &Data) {
@@ -62,15 +56,7 @@ void llvm::ReadProfilingBlock(const char *ToolName, FILE *F,
     Data.resize(NumEntries, ProfileInfoLoader::Uncounted);
 
   // Accumulate the data we just read into the data.
-  if (!ShouldByteSwap) {
-    for (uint64_t i = 0; i != NumEntries; ++i) {
-      Data[i] = AddCounts(TempSpace[i], Data[i]);
-    }
-  } else {
-    for (uint64_t i = 0; i != NumEntries; ++i) {
-      Data[i] = AddCounts(ByteSwap(TempSpace[i], true), Data[i]);
-    }
-  }
+  AccumulateCounts(&Data[0], &TempSpace[0], NumEntries, ShouldByteSwap);
 }
 //When we do basic block tracing, the composition operator is concatenation, not summing
 //this function reads the profiling block and /appends/ it to the array instead of adding it like in path/edge profiling
@@ -99,9 +85,7 @@ bool llvm::ReadBBTraceProfilingBlock(const char *ToolName, FILE *F,
 	
   // Byte swap if necessary
   if (ShouldByteSwap) {
-    for (uint64_t i = NewEntryStart; i != Data.size(); ++i) {
-      Data[i] = ByteSwap(Data[i], true);
-    }
+    ByteSwapCounts(&Data[NewEntryStart], NumEntries);
   }
   if(Data.back()==BBTraceStream::BBEOFID) {
 	  Data.pop_back();
@@ -110,6 +94,188 @@ bool llvm::ReadBBTraceProfilingBlock(const char *ToolName, FILE *F,
 	return false;
 }
 
+// ReadPathProfilingBlock - Path profiles are tables of (path number, counter)
+// pairs per function, see PathProfiling.c for the layout.  The counters are
+// accumulated into 'Data'.
+void llvm::ReadPathProfilingBlock(const char *ToolName, FILE *F,
+                                  bool ShouldByteSwap,
+                                  std::map<uint64_t, PathCounterMap> &Data) {
+  uint64_t FunctionCount;
+  if (fread(&FunctionCount, sizeof(uint64_t), 1, F) != 1) {
+    errs() << ToolName << ": path packet truncated at function count!\n";
+    perror(0);
+    exit(1);
+  }
+  FunctionCount = ByteSwap(FunctionCount, ShouldByteSwap);
+
+  std::vector<PathProfileTableEntry> Entries;
+  for (uint64_t i = 0; i != FunctionCount; ++i) {
+    PathProfileHeader Header;
+    if (fread(&Header, sizeof(PathProfileHeader), 1, F) != 1) {
+      errs() << ToolName << ": path packet truncated at function header!\n";
+      perror(0);
+      exit(1);
+    }
+    Header.fnNumber = ByteSwap(Header.fnNumber, ShouldByteSwap);
+    Header.numEntries = ByteSwap(Header.numEntries, ShouldByteSwap);
+
+    Entries.resize(Header.numEntries);
+    if (Header.numEntries &&
+        fread(&Entries[0], sizeof(PathProfileTableEntry), Header.numEntries,
+              F) != Header.numEntries) {
+      errs() << ToolName << ": path packet truncated at path entries!\n";
+      perror(0);
+      exit(1);
+    }
+
+    PathCounterMap &Counters = Data[Header.fnNumber];
+    for (uint64_t j = 0; j != Header.numEntries; ++j) {
+      Counters[ByteSwap(Entries[j].pathNumber, ShouldByteSwap)] +=
+        ByteSwap(Entries[j].pathCounter, ShouldByteSwap);
+    }
+  }
+}
+
+// ReadIndirectCallProfilingBlock - Indirect call targets are tables of the
+// most frequent targets per call site, see CallSiteProfiling.c for the layout.
+// The counters are accumulated into 'Data'.
+void llvm::ReadIndirectCallProfilingBlock(
+    const char *ToolName, FILE *F, bool ShouldByteSwap,
+    std::map<uint64_t, IndirectCallTargetMap> &Data) {
+  std::vector<uint64_t> Words;
+  ReadProfilingBlock(ToolName, F, ShouldByteSwap, Words);
+
+  const size_t EntryWords = sizeof(IndirectCallSiteEntry) / sizeof(uint64_t);
+  if (Words.size() % EntryWords) {
+    errs() << ToolName << ": indirect call packet has a partial entry!\n";
+    exit(1);
+  }
+
+  for (size_t i = 0, e = Words.size(); i != e; i += EntryWords) {
+    IndirectCallSiteEntry Entry;
+    memcpy(&Entry, &Words[i], sizeof(IndirectCallSiteEntry));
+
+    IndirectCallTargetMap &Targets = Data[Entry.siteNumber];
+    for (unsigned t = 0; t != INDIRECT_CALL_TOP_TARGETS; ++t)
+      if (Entry.targets[t].count)
+        Targets[Entry.targets[t].target] += Entry.targets[t].count;
+  }
+}
+
+// ReadValueProfilingBlock - Value profiles are tables of the most frequent
+// values per site, see ValueProfiling.c.  The counters are accumulated into
+// 'Data'.
+void llvm::ReadValueProfilingBlock(const char *ToolName, FILE *F,
+                                   bool ShouldByteSwap,
+                                   std::vector<ValueSiteCounts> &Data) {
+  std::vector<uint64_t> Words;
+  ReadProfilingBlock(ToolName, F, ShouldByteSwap, Words);
+
+  const size_t EntryWords = sizeof(ValueProfileSiteEntry) / sizeof(uint64_t);
+  if (Words.size() % EntryWords) {
+    errs() << ToolName << ": value packet has a partial entry!\n";
+    exit(1);
+  }
+
+  if (Data.size() < Words.size() / EntryWords)
+    Data.resize(Words.size() / EntryWords);
+
+  for (size_t i = 0, e = Words.size(); i != e; i += EntryWords) {
+    ValueProfileSiteEntry Entry;
+    memcpy(&Entry, &Words[i], sizeof(ValueProfileSiteEntry));
+
+    ValueSiteCounts &Site = Data[i / EntryWords];
+    Site.Kind = Entry.kind;
+    Site.Total += Entry.total;
+    for (unsigned v = 0; v != VALUE_PROFILE_TOP_VALUES; ++v)
+      if (Entry.values[v].count)
+        Site.Values[Entry.values[v].value] += Entry.values[v].count;
+  }
+}
+
+// ReadCoverageProfilingBlock - Coverage profiles are bitmaps preceded by the
+// number of flags, see CoverageProfiling.c.  The flags are or'ed into 'Data'.
+void llvm::ReadCoverageProfilingBlock(const char *ToolName, FILE *F,
+                                      bool ShouldByteSwap,
+                                      std::vector<bool> &Data) {
+  std::vector<uint64_t> Words;
+  ReadProfilingBlock(ToolName, F, ShouldByteSwap, Words);
+
+  if (Words.empty() || Words.size() != 1 + (Words[0] + 63) / 64) {
+    errs() << ToolName << ": coverage packet does not match its size!\n";
+    exit(1);
+  }
+
+  uint64_t NumFlags = Words[0];
+  if (Data.size() < NumFlags)
+    Data.resize(NumFlags, false);
+  for (uint64_t i = 0; i != NumFlags; ++i)
+    if (Words[1 + i / 64] & (1ULL << (i % 64)))
+      Data[i] = true;
+}
+
+// ReadFunctionMapBlock - Function maps are the type of the counters they
+// describe followed by FunctionMapEntry records.  The map read last replaces
+// the earlier ones of the same type.
+void llvm::ReadFunctionMapBlock(const char *ToolName, FILE *F,
+                                bool ShouldByteSwap,
+                                std::map<uint64_t, FunctionMap> &Data) {
+  std::vector<uint64_t> Words;
+  ReadProfilingBlock(ToolName, F, ShouldByteSwap, Words);
+
+  const size_t EntryWords = sizeof(FunctionMapEntry) / sizeof(uint64_t);
+  if (Words.empty() || (Words.size() - 1) % EntryWords) {
+    errs() << ToolName << ": function map packet has a partial entry!\n";
+    exit(1);
+  }
+
+  FunctionMap &Map = Data[Words[0]];
+  Map.clear();
+  for (size_t i = 1, e = Words.size(); i != e; i += EntryWords) {
+    FunctionMapEntry Entry;
+    memcpy(&Entry, &Words[i], sizeof(FunctionMapEntry));
+    Map[Entry.guid] = Entry;
+  }
+}
+
+// ReadBlockMapBlock - Block maps are the type of the counters they describe
+// followed by the control flow graphs of the functions, which are kept as
+// they are.  The map read last replaces the earlier ones of the same type.
+void llvm::ReadBlockMapBlock(const char *ToolName, FILE *F,
+                             bool ShouldByteSwap,
+                             std::map<uint64_t, std::vector<uint64_t> > &Data) {
+  std::vector<uint64_t> Words;
+  ReadProfilingBlock(ToolName, F, ShouldByteSwap, Words);
+
+  if (Words.empty()) {
+    errs() << ToolName << ": block map packet has no counter type!\n";
+    exit(1);
+  }
+  Data[Words[0]].assign(Words.begin() + 1, Words.end());
+}
+
+// ReadRegionTimingBlock - Region timings are RegionTimingEntry records.  The
+// records of the same region are summed.
+void llvm::ReadRegionTimingBlock(const char *ToolName, FILE *F,
+                                 bool ShouldByteSwap, RegionTimingMap &Data) {
+  std::vector<uint64_t> Words;
+  ReadProfilingBlock(ToolName, F, ShouldByteSwap, Words);
+
+  const size_t EntryWords = sizeof(RegionTimingEntry) / sizeof(uint64_t);
+  if (Words.size() % EntryWords) {
+    errs() << ToolName << ": region timing packet has a partial entry!\n";
+    exit(1);
+  }
+  for (size_t i = 0, e = Words.size(); i != e; i += EntryWords) {
+    RegionTimingEntry Entry;
+    memcpy(&Entry, &Words[i], sizeof(RegionTimingEntry));
+    std::pair<uint64_t, uint64_t> &Timing =
+      Data[std::make_pair(Entry.guid, Entry.block)];
+    Timing.first += Entry.executions;
+    Timing.second += Entry.cycles;
+  }
+}
+
 void llvm::SkipProfilingBlock(const char *ToolName, FILE *F,
                                bool ShouldByteSwap) {
   // Read the number of entries...
@@ -123,6 +289,50 @@ void llvm::SkipProfilingBlock(const char *ToolName, FILE *F,
   fseek(F,NumEntries*sizeof(uint64_t),SEEK_CUR);
 }
 
+// ReadExtendedPathProfilingBlock - Extended paths are variable length
+// records, see PathProfiling.c for the layout.  The counters are accumulated
+// into 'Data'.
+void llvm::ReadExtendedPathProfilingBlock(const char *ToolName, FILE *F,
+                                          bool ShouldByteSwap,
+                                          ExtendedPathCounterMap &Data) {
+  uint64_t PathCount;
+  if (fread(&PathCount, sizeof(uint64_t), 1, F) != 1) {
+    errs() << ToolName << ": extended path packet truncated at path count!\n";
+    perror(0);
+    exit(1);
+  }
+  PathCount = ByteSwap(PathCount, ShouldByteSwap);
+
+  std::vector<ExtendedPathEntry> Entries;
+  for (uint64_t i = 0; i != PathCount; ++i) {
+    ExtendedPathHeader Header;
+    if (fread(&Header, sizeof(ExtendedPathHeader), 1, F) != 1) {
+      errs() << ToolName << ": extended path packet truncated at header!\n";
+      perror(0);
+      exit(1);
+    }
+    Header.kind = ByteSwap(Header.kind, ShouldByteSwap);
+    Header.length = ByteSwap(Header.length, ShouldByteSwap);
+    Header.count = ByteSwap(Header.count, ShouldByteSwap);
+
+    Entries.resize(Header.length);
+    if (Header.length &&
+        fread(&Entries[0], sizeof(ExtendedPathEntry), Header.length,
+              F) != Header.length) {
+      errs() << ToolName << ": extended path packet truncated at paths!\n";
+      perror(0);
+      exit(1);
+    }
+
+    std::vector<uint64_t> Key(1, Header.kind);
+    for (uint64_t j = 0; j != Header.length; ++j) {
+      Key.push_back(ByteSwap(Entries[j].fnNumber, ShouldByteSwap));
+      Key.push_back(ByteSwap(Entries[j].pathNumber, ShouldByteSwap));
+    }
+    Data[Key] += Header.count;
+  }
+}
+
 const uint64_t ProfileInfoLoader::Uncounted = ~0U;
 
 // ProfileInfoLoader ctor - Read the specified profiling data file, exiting the
@@ -186,6 +396,56 @@ ProfileInfoLoader::ProfileInfoLoader(const char *ToolName,
       ReadProfilingBlock(ToolName, F, ShouldByteSwap, OptimalEdgeCounts);
       break;
 
+    case PathInfo:
+      ReadPathProfilingBlock(ToolName, F, ShouldByteSwap, PathCounts);
+      break;
+
+    case CallSiteInfo:
+      ReadProfilingBlock(ToolName, F, ShouldByteSwap, CallSiteCounts);
+      break;
+
+    case IndirectCallInfo:
+      ReadIndirectCallProfilingBlock(ToolName, F, ShouldByteSwap,
+                                     IndirectCallTargets);
+      break;
+
+    case ValueInfo:
+      ReadValueProfilingBlock(ToolName, F, ShouldByteSwap, ValueCounts);
+      break;
+
+    case LoopTripInfo:
+      ReadProfilingBlock(ToolName, F, ShouldByteSwap, LoopTripCounts);
+      break;
+
+    case TimingInfo:
+      ReadProfilingBlock(ToolName, F, ShouldByteSwap, FunctionTimings);
+      break;
+
+    case RegionTimingInfo:
+      ReadRegionTimingBlock(ToolName, F, ShouldByteSwap, RegionTimings);
+      break;
+
+    case EdgeCoverageInfo:
+      ReadCoverageProfilingBlock(ToolName, F, ShouldByteSwap, EdgeCoverage);
+      break;
+
+    case BlockCoverageInfo:
+      ReadCoverageProfilingBlock(ToolName, F, ShouldByteSwap, BlockCoverage);
+      break;
+
+    case FunctionMapInfo:
+      ReadFunctionMapBlock(ToolName, F, ShouldByteSwap, FunctionMaps);
+      break;
+
+    case BlockMapInfo:
+      ReadBlockMapBlock(ToolName, F, ShouldByteSwap, BlockMaps);
+      break;
+
+    case ExtendedPathInfo:
+      ReadExtendedPathProfilingBlock(ToolName, F, ShouldByteSwap,
+                                     ExtendedPathCounts);
+      break;
+
     case BBTraceInfo:
 	  if(BBTraceFinished) {
 		  errs() << ToolName << ": Warning, tools can only handle one basic block trace per llvmprof.out file.  All subsequent traces are being ignored\n";
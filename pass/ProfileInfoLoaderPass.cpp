@@ -18,7 +18,10 @@
 #include "ProfileInfoLoader.h"
 #include "Passes.h"
 
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallSet.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/Statistic.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/InstrTypes.h"
@@ -33,6 +36,8 @@
 using namespace llvm;
 
 STATISTIC(NumEdgesRead, "The # of edges read.");
+STATISTIC(NumFunctionsSkipped, "The # of functions without a matching profile.");
+STATISTIC(NumFunctionsMatched, "The # of changed functions matched with their profile.");
 
 static cl::opt<std::string>
 ProfileInfoFilename("profile-info-file", cl::init("llvmprof.out"),
@@ -63,30 +68,180 @@ void ProfileInfoLoaderPass::readEdgeOrRemember(Edge edge, Edge &tocalc,
 	}
 }
 
-// recurseBasicBlock - Visits all neighbours of a block and then tries to
-// calculate the missing edge values.
-void ProfileInfoLoaderPass::recurseBasicBlock(const BasicBlock *BB) {
+// getBlockEdges - Collects the distinct edges entering and leaving BB, and
+// returns the number of entering ones, which come first.  A self-loop is
+// listed on both sides.  A block without predecessors is entered by the
+// virtual edge (0,BB), a block without successors is left by the virtual edge
+// (BB,0).
+static unsigned getBlockEdges(const BasicBlock *BB,
+                              SmallVectorImpl<ProfileInfo::Edge> &Edges) {
+	SmallPtrSet<const BasicBlock*, 8> Visited;
+	const_pred_iterator pbi = pred_begin(BB), pbe = pred_end(BB);
+	if (pbi == pbe)
+		Edges.push_back(ProfileInfo::getEdge(0, BB));
+	for (; pbi != pbe; ++pbi) {
+		if (Visited.insert(*pbi))
+			Edges.push_back(ProfileInfo::getEdge(*pbi, BB));
+	}
 
-	// break recursion if already visited
-	if (BBisUnvisited.find(BB) == BBisUnvisited.end()) return;
-	BBisUnvisited.erase(BB);
-	if (!BB) return;
+	unsigned NumIn = Edges.size();
+	Visited.clear();
+	succ_const_iterator sbi = succ_begin(BB), sbe = succ_end(BB);
+	if (sbi == sbe)
+		Edges.push_back(ProfileInfo::getEdge(BB, 0));
+	for (; sbi != sbe; ++sbi) {
+		if (Visited.insert(*sbi))
+			Edges.push_back(ProfileInfo::getEdge(BB, *sbi));
+	}
+	return NumIn;
+}
 
-	for (succ_const_iterator bbi = succ_begin(BB), bbe = succ_end(BB);
-	     bbi != bbe; ++bbi) {
-		recurseBasicBlock(*bbi);
+// calculateMissingEdge - If exactly one edge of BB has no weight, calculate
+// it from the flow through BB and remove it from the spanning tree.
+bool ProfileInfoLoaderPass::calculateMissingEdge(const BasicBlock *BB,
+                                                 Edge &removed) {
+	SmallVector<Edge, 8> Edges;
+	unsigned NumIn = getBlockEdges(BB, Edges);
+
+	Edge tocalc;
+	unsigned uncalc = 0;
+	double incount = 0, outcount = 0;
+	for (unsigned i = 0, e = Edges.size(); i != e; ++i) {
+		if (i < NumIn)
+			readEdgeOrRemember(Edges[i], tocalc, uncalc, incount);
+		else
+			readEdgeOrRemember(Edges[i], tocalc, uncalc, outcount);
 	}
-	for (const_pred_iterator bbi = pred_begin(BB), bbe = pred_end(BB);
-	     bbi != bbe; ++bbi) {
-		recurseBasicBlock(*bbi);
+	if (uncalc != 1) return false;
+
+	EdgeInformation[BB->getParent()][tocalc] = incount < outcount ?
+		outcount - incount : incount - outcount;
+	DEBUG(dbgs() << "--Calc Edge Counter for " << tocalc << ": "
+	      << format("%.20g", getEdgeWeight(tocalc)) << "\n");
+	SpanningTree.erase(tocalc);
+	removed = tocalc;
+	return true;
+}
+
+// calculateSpanningTreeEdges - Solves the flow conservation equations of F
+// with a worklist of the blocks that have exactly one edge without a weight.
+// Calculating that edge may leave its other end with a single unknown edge,
+// so every edge is calculated exactly once.
+void ProfileInfoLoaderPass::calculateSpanningTreeEdges(const Function *F) {
+	DenseMap<const BasicBlock*, unsigned> Unknown;
+	SmallVector<const BasicBlock*, 32> Worklist;
+
+	for (Function::const_iterator BB = F->begin(), E = F->end(); BB != E; ++BB) {
+		SmallVector<Edge, 8> Edges;
+		getBlockEdges(BB, Edges);
+
+		unsigned count = 0;
+		for (SmallVectorImpl<Edge>::iterator ei = Edges.begin(), ee = Edges.end();
+		     ei != ee; ++ei) {
+			if (getEdgeWeight(*ei) == MissingValue) ++count;
+		}
+		Unknown[BB] = count;
+		if (count == 1) Worklist.push_back(BB);
 	}
 
-	Edge tocalc;
-	if (CalculateMissingEdge(BB, tocalc)) {
-		SpanningTree.erase(tocalc);
+	while (!Worklist.empty()) {
+		const BasicBlock *BB = Worklist.pop_back_val();
+		Edge calculated;
+		if (!calculateMissingEdge(BB, calculated)) continue;
+		Unknown[BB] = 0;
+
+		// The other end of the calculated edge has one unknown edge less.
+		const BasicBlock *Other = calculated.first == BB ?
+			calculated.second : calculated.first;
+		if (Other && Other != BB && --Unknown[Other] == 1)
+			Worklist.push_back(Other);
 	}
 }
 
+// verifyEdgeFlow - Report the blocks of F whose known edges do not conserve
+// flow.  A self-loop counts on both sides, so it cancels out.
+void ProfileInfoLoaderPass::verifyEdgeFlow(const Function *F) {
+	for (Function::const_iterator BB = F->begin(), E = F->end(); BB != E; ++BB) {
+		SmallVector<Edge, 8> Edges;
+		unsigned NumIn = getBlockEdges(BB, Edges);
+
+		double incount = 0, outcount = 0;
+		bool Known = true;
+		for (unsigned i = 0, e = Edges.size(); i != e && Known; ++i) {
+			double w = getEdgeWeight(Edges[i]);
+			Known = w != MissingValue;
+			if (i < NumIn)
+				incount += w;
+			else
+				outcount += w;
+		}
+		if (Known && incount != outcount)
+			dbgs() << "--Flow not conserved in " << BB->getName() << " of "
+			       << F->getName() << ": " << format("%.20g", incount)
+			       << " in, " << format("%.20g", outcount) << " out\n";
+	}
+}
+
+// findFunctionCounters - Point ReadCount to the first counter of F.  Without
+// a function map the counters of the functions follow each other in module
+// order; with one, F is looked up by its identity and skipped if it was not
+// profiled.  If F has changed since, its counters are read through its block
+// map by readStaleEdges, if there is one, and F is skipped as well.
+bool ProfileInfoLoaderPass::findFunctionCounters(const Function *F,
+                                                 const FunctionMap *Map,
+                                                 const BlockMap *Blocks,
+                                                 std::vector<uint64_t> &ECs,
+                                                 bool ExitEdges) {
+	if (!Map) return true;
+	bool Stale = false;
+	const FunctionMapEntry *Entry =
+		findProfiledFunction(*Map, *F, Blocks ? &Stale : 0);
+	if (!Entry) {
+		++NumFunctionsSkipped;
+		return false;
+	}
+	if (Stale) {
+		readStaleEdges(F, *Entry, *Blocks, ECs, ExitEdges);
+		return false;
+	}
+	ReadCount = Entry->firstCounter;
+	return true;
+}
+
+// readStaleEdges - Read the counters of F, whose control flow graph changed
+// since it was profiled, onto the edges between the blocks matching the
+// profiled ones.  The weights of the other edges are then estimated from the
+// flow through the function.
+void ProfileInfoLoaderPass::readStaleEdges(const Function *F,
+                                           const FunctionMapEntry &Entry,
+                                           const BlockMap &Blocks,
+                                           std::vector<uint64_t> &ECs,
+                                           bool ExitEdges) {
+	BlockMap::const_iterator CFG = Blocks.find(Entry.guid);
+	std::vector<const BasicBlock*> OldToNew;
+	std::vector<Edge> Edges;
+	if (CFG != Blocks.end() && matchStaleBlocks(*F, CFG->second, OldToNew))
+		mapStaleEdges(CFG->second, OldToNew, ExitEdges, Edges);
+	if (Edges.empty() || Edges.size() != Entry.numCounters) {
+		errs() << "WARNING: profile information for '" << F->getName()
+		       << "' is stale and could not be matched!\n";
+		++NumFunctionsSkipped;
+		return;
+	}
+
+	for (unsigned i = 0, e = Edges.size(); i != e; ++i) {
+		uint64_t Index = Entry.firstCounter + i;
+		if (Index >= ECs.size() || ECs[Index] == ProfileInfoLoader::Uncounted)
+			continue;
+		if (!Edges[i].first && !Edges[i].second)
+			continue;
+		EdgeInformation[F][Edges[i]] += (double)ECs[Index];
+	}
+	DEBUG(dbgs() << "Matched the stale profile of " << F->getName() << "\n");
+	repair(F);
+	++NumFunctionsMatched;
+}
+
 void ProfileInfoLoaderPass::readEdge(ProfileInfo::Edge e,
                                      std::vector<uint64_t> &ECs) {
 	if (ReadCount < ECs.size()) {
@@ -108,15 +263,70 @@ void ProfileInfoLoaderPass::readEdge(ProfileInfo::Edge e,
 	}
 }
 
+// readBlockCounts - Read the counts of the blocks of F.  The counts of the
+// blocks -insert-block-profiling did not count are inferred from the others.
+void ProfileInfoLoaderPass::readBlockCounts(Function *F,
+                                            std::vector<uint64_t> &Counters) {
+	unsigned First = ReadCount;
+	bool Inferred = false;
+	for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB) {
+		if (ReadCount >= Counters.size()) break;
+		uint64_t Count = Counters[ReadCount++];
+		if (Count == ProfileInfoLoader::Uncounted)
+			Inferred = true;
+		else
+			// Here the data realm changes from the uint64_t of the file to the
+			// double of the ProfileInfo. This conversion would only be safe for
+			// values up to 2^52
+			BlockInformation[F][BB] = (double)Count;
+	}
+	if (!Inferred) return;
+
+	BlockCountSolver Solver(*F);
+	for (unsigned b = 0, e = ReadCount - First; b != e; ++b)
+		if (Counters[First + b] != ProfileInfoLoader::Uncounted)
+			Solver.setCount(b, Counters[First + b]);
+	if (Solver.solve()) {
+		errs() << "WARNING: the block counts of '" << F->getName()
+		       << "' could not be inferred!\n";
+	}
+
+	unsigned b = 0;
+	for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB, ++b)
+		if (Solver.isKnown(b))
+			BlockInformation[F][BB] = (double)Solver.getCount(b);
+	DEBUG(dbgs() << "Inferred the block counts of " << F->getName() << "\n");
+}
+
+// readBlockMap - Parse the block map of the counters of type PT, if the
+// profile has a usable one.
+static bool readBlockMap(const ProfileInfoLoader &PIL, uint64_t PT,
+                         BlockMap &Blocks) {
+	const std::vector<uint64_t> *Words = PIL.getRawBlockMap(PT);
+	if (!Words) return false;
+	if (!parseBlockMap(*Words, Blocks)) {
+		errs() << "WARNING: the block map of the profile is malformed, "
+		       << "changed functions are not matched!\n";
+		return false;
+	}
+	return true;
+}
+
 bool ProfileInfoLoaderPass::runOnModule(Module &M) {
 	ProfileInfoLoader PIL("profile-loader", Filename);
 
 	EdgeInformation.clear();
 	std::vector<uint64_t> Counters = PIL.getRawEdgeCounts();
+	const FunctionMap *Map = PIL.getFunctionMap(EdgeInfo);
+	BlockMap Blocks;
+	bool HasBlocks = readBlockMap(PIL, EdgeInfo, Blocks);
 	if (Counters.size() > 0) {
 		ReadCount = 0;
 		for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
 			if (F->isDeclaration()) continue;
+			if (!findFunctionCounters(F, Map, HasBlocks ? &Blocks : 0, Counters,
+			                          false))
+				continue;
 			DEBUG(dbgs() << "Working on " << F->getName() << "\n");
 			readEdge(getEdge(0,&F->getEntryBlock()), Counters);
 			for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB) {
@@ -126,7 +336,7 @@ bool ProfileInfoLoaderPass::runOnModule(Module &M) {
 				}
 			}
 		}
-		if (ReadCount != Counters.size()) {
+		if (!Map && ReadCount != Counters.size()) {
 			errs() << "WARNING: profile information is inconsistent with "
 				<< "the current program!\n";
 		}
@@ -134,10 +344,16 @@ bool ProfileInfoLoaderPass::runOnModule(Module &M) {
 	}
 
 	Counters = PIL.getRawOptimalEdgeCounts();
+	Map = PIL.getFunctionMap(OptEdgeInfo);
+	Blocks.clear();
+	HasBlocks = readBlockMap(PIL, OptEdgeInfo, Blocks);
 	if (Counters.size() > 0) {
 		ReadCount = 0;
 		for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
 			if (F->isDeclaration()) continue;
+			if (!findFunctionCounters(F, Map, HasBlocks ? &Blocks : 0, Counters,
+			                          true))
+				continue;
 			DEBUG(dbgs() << "Working on " << F->getName() << "\n");
 			readEdge(getEdge(0,&F->getEntryBlock()), Counters);
 			for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB) {
@@ -149,32 +365,20 @@ bool ProfileInfoLoaderPass::runOnModule(Module &M) {
 					readEdge(getEdge(BB,TI->getSuccessor(s)), Counters);
 				}
 			}
-			while (SpanningTree.size() > 0) {
-
-				unsigned size = SpanningTree.size();
+			calculateSpanningTreeEdges(F);
+			DEBUG(verifyEdgeFlow(F));
 
-				BBisUnvisited.clear();
+			if (SpanningTree.size() > 0) {
+				DEBUG(dbgs()<<"{");
 				for (std::set<Edge>::iterator ei = SpanningTree.begin(),
 				     ee = SpanningTree.end(); ei != ee; ++ei) {
-					BBisUnvisited.insert(ei->first);
-					BBisUnvisited.insert(ei->second);
-				}
-				while (BBisUnvisited.size() > 0) {
-					recurseBasicBlock(*BBisUnvisited.begin());
-				}
-
-				if (SpanningTree.size() == size) {
-					DEBUG(dbgs()<<"{");
-					for (std::set<Edge>::iterator ei = SpanningTree.begin(),
-					     ee = SpanningTree.end(); ei != ee; ++ei) {
-						DEBUG(dbgs()<< *ei <<",");
-					}
-					assert(0 && "No edge calculated!");
+					DEBUG(dbgs()<< *ei <<",");
 				}
-
+				assert(0 && "No edge calculated!");
+				SpanningTree.clear();
 			}
 		}
-		if (ReadCount != Counters.size()) {
+		if (!Map && ReadCount != Counters.size()) {
 			errs() << "WARNING: profile information is inconsistent with "
 				<< "the current program!\n";
 		}
@@ -183,18 +387,16 @@ bool ProfileInfoLoaderPass::runOnModule(Module &M) {
 
 	BlockInformation.clear();
 	Counters = PIL.getRawBlockCounts();
+	Map = PIL.getFunctionMap(BlockInfo);
 	if (Counters.size() > 0) {
 		ReadCount = 0;
 		for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
 			if (F->isDeclaration()) continue;
-			for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB)
-				if (ReadCount < Counters.size())
-				// Here the data realm changes from the uint64_t of the file to the
-				// double of the ProfileInfo. This conversion would only be safe for
-				// values up to 2^52
-				BlockInformation[F][BB] = (double)Counters[ReadCount++];
+			if (!findFunctionCounters(F, Map, 0, Counters, false))
+				continue;
+			readBlockCounts(F, Counters);
 		}
-		if (ReadCount != Counters.size()) {
+		if (!Map && ReadCount != Counters.size()) {
 			errs() << "WARNING: profile information is inconsistent with "
 				<< "the current program!\n";
 		}
@@ -202,17 +404,30 @@ bool ProfileInfoLoaderPass::runOnModule(Module &M) {
 
 	FunctionInformation.clear();
 	Counters = PIL.getRawFunctionCounts();
+	Map = PIL.getFunctionMap(FunctionInfo);
 	if (Counters.size() > 0) {
 		ReadCount = 0;
 		for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
 			if (F->isDeclaration()) continue;
+			if (Map) {
+				// The entry count of a function does not depend on its control flow
+				// graph, so it is still valid if that changed.
+				bool Stale;
+				const FunctionMapEntry *Entry =
+					findProfiledFunction(*Map, *F, &Stale);
+				if (!Entry) {
+					++NumFunctionsSkipped;
+					continue;
+				}
+				ReadCount = Entry->firstCounter;
+			}
 			if (ReadCount < Counters.size())
 				// Here the data realm changes from the uint64_t of the file to the
 				// double of the ProfileInfo. This conversion would only be safe for
 				// values up to 2^52
 				FunctionInformation[F] = (double)Counters[ReadCount++];
 		}
-		if (ReadCount != Counters.size()) {
+		if (!Map && ReadCount != Counters.size()) {
 			errs() << "WARNING: profile information is inconsistent with "
 				<< "the current program!\n";
 		}
@@ -223,6 +438,9 @@ bool ProfileInfoLoaderPass::runOnModule(Module &M) {
 		std::vector<BasicBlock*> BBMap;
 		std::unordered_map<BasicBlock*, int> reverse_BBmap;
 		label_basic_blocks(M,BBMap,reverse_BBmap);
+		std::vector<Instruction*> MemMap;
+		std::unordered_map<Instruction*, int> reverse_MemMap;
+		label_memory_operations(M,MemMap,reverse_MemMap);
 		for(size_t i=0; i<trace.size(); i++) {
 			BBTraceStream::Packet packet;
 			
@@ -235,6 +453,24 @@ bool ProfileInfoLoaderPass::runOnModule(Module &M) {
 				}
 				packet.ptype=BBTraceStream::PacketType::MemOp;
 				packet.MemAddr=trace[i];
+				packet.memKind=BBTraceStream::MemUnknown;
+				packet.memSize=0;
+				packet.memInstr=NULL;
+			}else if(BBTraceStream::isMemRecord(bbid)) {
+				i++;
+				if(i>=trace.size()) {
+					errs()<<"Error, truncated MemOp packet in Basic Block trace stream\n";
+					exit(1);
+				}
+				if(BBTraceStream::getMemRecordInstr(bbid)>=MemMap.size()) {
+					errs() <<"Error, bad memory operation ID in MemOp packet in Basic Block Trace\n";
+					exit(1);
+				}
+				packet.ptype=BBTraceStream::PacketType::MemOp;
+				packet.MemAddr=trace[i];
+				packet.memKind=BBTraceStream::getMemRecordKind(bbid);
+				packet.memSize=BBTraceStream::getMemRecordSize(bbid);
+				packet.memInstr=MemMap[BBTraceStream::getMemRecordInstr(bbid)];
 			}else if(bbid==BBTraceStream::FunCallID) {
 				i++;
 				if(i>=trace.size()) {
@@ -249,6 +485,14 @@ bool ProfileInfoLoaderPass::runOnModule(Module &M) {
 				packet.BB=BBMap[trace[i]];
 			} else if(bbid==BBTraceStream::FunRetID) {
 				packet.ptype=BBTraceStream::FunRet;
+			} else if(bbid==BBTraceStream::BurstID) {
+				i++;
+				if(i>=trace.size()) {
+					errs()<<"Error, truncated Burst packet in Basic Block trace stream\n";
+					exit(1);
+				}
+				packet.ptype=BBTraceStream::Burst;
+				packet.EventIndex=trace[i];
 			} else {
 				packet.ptype=BBTraceStream::BB;
 					if(bbid>BBMap.size()) {
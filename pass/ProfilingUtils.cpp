@@ -15,21 +15,51 @@
 //===----------------------------------------------------------------------===//
 
 #include "ProfilingUtils.h"
+#include "ProfileCommon.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Analysis/CFG.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/MDBuilder.h"
 #include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/SSAUpdater.h"
+using namespace llvm;
 
-void llvm::InsertProfilingInitCall(Function *MainFn, const char *FnName,
-                                   GlobalValue *Array,
-                                   PointerType *arrayType) {
-  LLVMContext &Context = MainFn->getContext();
+static cl::opt<bool>
+DormantProbes("profile-dormant", cl::init(false),
+  cl::desc("Only run the probes while llvm_profile_enabled is set at run "
+           "time"),
+  cl::Hidden);
+
+static cl::opt<unsigned>
+SampleInterval("profile-sample-interval", cl::init(0),
+  cl::desc("Run the uninstrumented copy of the functions for this many "
+           "checks between bursts of instrumented code (0 = never)"),
+  cl::Hidden);
+
+static cl::opt<unsigned>
+SampleBurst("profile-sample-burst", cl::init(1),
+  cl::desc("Number of checks a burst of instrumented code lasts"),
+  cl::Hidden);
+
+// CreateProfilingInitCall - Call the runtime entry point FnName with a null
+// argc and argv and the given counter array before InsertPos.
+static CallInst *CreateProfilingInitCall(Module &M, const char *FnName,
+                                         GlobalValue *Array,
+                                         PointerType *arrayType,
+                                         Instruction *InsertPos) {
+  LLVMContext &Context = M.getContext();
   Type *ArgVTy =
     PointerType::getUnqual(Type::getInt8PtrTy(Context));
   PointerType *UIntPtr = arrayType ? arrayType :
     Type::getInt64PtrTy(Context);
-  Module &M = *MainFn->getParent();
   Constant *InitFn = M.getOrInsertFunction(FnName, Type::getInt32Ty(Context),
                                            Type::getInt32Ty(Context),
                                            ArgVTy, UIntPtr,
@@ -42,11 +72,6 @@ void llvm::InsertProfilingInitCall(Function *MainFn, const char *FnName,
   Args[0] = Constant::getNullValue(Type::getInt32Ty(Context));
   Args[1] = Constant::getNullValue(ArgVTy);
 
-  // Skip over any allocas in the entry block.
-  BasicBlock *Entry = MainFn->begin();
-  BasicBlock::iterator InsertPos = Entry->begin();
-  while (isa<AllocaInst>(InsertPos)) ++InsertPos;
-
   std::vector<Constant*> GEPIndices(2,
                              Constant::getNullValue(Type::getInt64Ty(Context)));
   unsigned NumElements = 0;
@@ -61,7 +86,23 @@ void llvm::InsertProfilingInitCall(Function *MainFn, const char *FnName,
   }
   Args[3] = ConstantInt::get(Type::getInt64Ty(Context), NumElements);
 
-  CallInst *InitCall = CallInst::Create(InitFn, Args, "newargc", InsertPos);
+  return CallInst::Create(InitFn, Args, "newargc", InsertPos);
+}
+
+void llvm::InsertProfilingInitCall(Function *MainFn, const char *FnName,
+                                   GlobalValue *Array,
+                                   PointerType *arrayType) {
+  LLVMContext &Context = MainFn->getContext();
+  Type *ArgVTy =
+    PointerType::getUnqual(Type::getInt8PtrTy(Context));
+
+  // Skip over any allocas in the entry block.
+  BasicBlock *Entry = MainFn->begin();
+  BasicBlock::iterator InsertPos = Entry->begin();
+  while (isa<AllocaInst>(InsertPos)) ++InsertPos;
+
+  CallInst *InitCall = CreateProfilingInitCall(*MainFn->getParent(), FnName,
+                                               Array, arrayType, InsertPos);
 
   // If argc or argv are not available in main, just pass null values in.
   Function::arg_iterator AI;
@@ -104,15 +145,25 @@ void llvm::InsertProfilingInitCall(Function *MainFn, const char *FnName,
   }
 }
 
-void llvm::IncrementCounterInBlock(BasicBlock *BB, uint64_t CounterNum,
-                                   GlobalValue *CounterArray, bool beginning) {
+llvm::Instruction *llvm::GetCounterInsertionPoint(BasicBlock *BB,
+                                                  bool beginning) {
   // Insert the increment after any alloca or PHI instructions...
   BasicBlock::iterator InsertPos = beginning ? BB->getFirstInsertionPt() :
                                    BB->getTerminator();
   while (isa<AllocaInst>(InsertPos))
     ++InsertPos;
+  return InsertPos;
+}
+
+void llvm::IncrementCounterInBlock(BasicBlock *BB, uint64_t CounterNum,
+                                   GlobalValue *CounterArray, bool beginning) {
+  IncrementCounterBefore(GetCounterInsertionPoint(BB, beginning), CounterNum,
+                         CounterArray);
+}
 
-  LLVMContext &Context = BB->getContext();
+void llvm::IncrementCounterBefore(Instruction *InsertPos, uint64_t CounterNum,
+                                  GlobalValue *CounterArray) {
+  LLVMContext &Context = InsertPos->getContext();
 
   // Create the getelementptr constant expression
   std::vector<Constant*> Indices(2);
@@ -122,48 +173,475 @@ void llvm::IncrementCounterInBlock(BasicBlock *BB, uint64_t CounterNum,
     ConstantExpr::getGetElementPtr(CounterArray, Indices);
 
   // Load, increment and store the value back.
-  Value *OldVal = new LoadInst(ElementPtr, "OldFuncCounter", InsertPos);
-  Value *NewVal = BinaryOperator::Create(Instruction::Add, OldVal,
+  Instruction *OldVal = new LoadInst(ElementPtr, "OldFuncCounter", InsertPos);
+  Instruction *NewVal = BinaryOperator::Create(Instruction::Add, OldVal,
                                  ConstantInt::get(Type::getInt64Ty(Context), 1),
                                          "NewFuncCounter", InsertPos);
-  new StoreInst(NewVal, ElementPtr, InsertPos);
+  MarkProbe(OldVal);
+  MarkProbe(NewVal);
+  MarkProbe(new StoreInst(NewVal, ElementPtr, InsertPos));
 }
 
-void llvm::InsertProfilingShutdownCall(Function *Callee, Module *Mod) {
-  // llvm.global_dtors is an array of type { i32, void ()* }. Prepare those
-  // types.
-  Type *GlobalDtorElems[2] = {
+// InsertProbeGuard - Branch around the code before InsertPos unless the
+// probes are enabled at run time, and return the position to insert the
+// probe at.  Splits the block of InsertPos.
+static Instruction *InsertProbeGuard(Instruction *InsertPos) {
+  LLVMContext &Context = InsertPos->getContext();
+  Module *M = InsertPos->getParent()->getParent()->getParent();
+  Constant *Flag = M->getOrInsertGlobal("llvm_profile_enabled",
+                                        Type::getInt32Ty(Context));
+
+  // The flag is changed behind the program's back.
+  Value *Enabled = new LoadInst(Flag, "ProfileEnabled", true, InsertPos);
+  Value *On = new ICmpInst(InsertPos, ICmpInst::ICMP_NE, Enabled,
+                           ConstantInt::get(Type::getInt32Ty(Context), 0),
+                           "ProfileOn");
+  MDNode *Weights = MDBuilder(Context).createBranchWeights(1, 1 << 20);
+  return SplitBlockAndInsertIfThen(On, InsertPos, false, Weights);
+}
+
+static unsigned getProbeKind(LLVMContext &Context) {
+  return Context.getMDKindID("prof.probe");
+}
+
+void llvm::MarkProbe(Instruction *I) {
+  if (DormantProbes)
+    I->setMetadata(getProbeKind(I->getContext()),
+                   MDNode::get(I->getContext(), ArrayRef<Value*>()));
+}
+
+void llvm::InsertProbeGuards(Module &M) {
+  if (!DormantProbes)
+    return;
+  unsigned ProbeKind = getProbeKind(M.getContext());
+
+  // Find the runs of probe instructions first, the guards split the blocks.
+  std::vector<std::pair<Instruction*, Instruction*> > Runs;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F)
+    for (Function::iterator BB = F->begin(), BE = F->end(); BB != BE; ++BB)
+      for (BasicBlock::iterator I = BB->begin(), IE = BB->end(); I != IE; ++I) {
+        if (!I->getMetadata(ProbeKind))
+          continue;
+        // Terminators are never marked, every run ends in its block.
+        BasicBlock::iterator End = I;
+        while (End->getMetadata(ProbeKind))
+          ++End;
+        Runs.push_back(std::make_pair(&*I, &*End));
+        I = --End;
+      }
+
+  for (unsigned i = 0, e = Runs.size(); i != e; ++i) {
+    std::vector<Instruction*> Run;
+    for (BasicBlock::iterator I = Runs[i].first; &*I != Runs[i].second; ++I)
+      Run.push_back(I);
+    Instruction *ProbePos = InsertProbeGuard(Run.front());
+    for (unsigned r = 0, re = Run.size(); r != re; ++r) {
+      Run[r]->moveBefore(ProbePos);
+      Run[r]->setMetadata(ProbeKind, 0);
+    }
+  }
+}
+
+// SetCoverageFlagBefore - Set a byte flag, guarded by a check of the flag so
+// that the probe always loads it but only stores it while it is still clear.
+// Splits the block of InsertPos.
+void llvm::SetCoverageFlagBefore(Instruction *InsertPos, uint64_t FlagNum,
+                                 GlobalValue *FlagArray) {
+  LLVMContext &Context = InsertPos->getContext();
+  if (DormantProbes)
+    InsertPos = InsertProbeGuard(InsertPos);
+
+  std::vector<Constant*> Indices(2);
+  Indices[0] = Constant::getNullValue(Type::getInt64Ty(Context));
+  Indices[1] = ConstantInt::get(Type::getInt64Ty(Context), FlagNum);
+  Constant *ElementPtr = ConstantExpr::getGetElementPtr(FlagArray, Indices);
+
+  Value *Flag = new LoadInst(ElementPtr, "CoverageFlag", InsertPos);
+  Value *Unset = new ICmpInst(InsertPos, ICmpInst::ICMP_EQ, Flag,
+                              ConstantInt::get(Type::getInt8Ty(Context), 0),
+                              "CoverageUnset");
+
+  // The flag is stored once at most, the branch is very unlikely.
+  MDNode *Weights = MDBuilder(Context).createBranchWeights(1, 1 << 20);
+  TerminatorInst *SetPos =
+    SplitBlockAndInsertIfThen(Unset, InsertPos, false, Weights);
+  new StoreInst(ConstantInt::get(Type::getInt8Ty(Context), 1), ElementPtr,
+                SetPos);
+}
+
+// AppendToGlobalFunctionArray - Add Fn to llvm.global_ctors or
+// llvm.global_dtors, which are arrays of type { i32, void ()* }.
+static void AppendToGlobalFunctionArray(Module *Mod, const char *ArrayName,
+                                        Function *Fn) {
+  // Prepare the element types.
+  Type *GlobalElems[2] = {
     Type::getInt32Ty(Mod->getContext()),
     FunctionType::get(Type::getVoidTy(Mod->getContext()), false)->getPointerTo()
   };
-  StructType *GlobalDtorElemTy =
-      StructType::get(Mod->getContext(), GlobalDtorElems, false);
+  StructType *GlobalElemTy =
+      StructType::get(Mod->getContext(), GlobalElems, false);
 
   // Construct the new element we'll be adding.
   Constant *Elem[2] = {
     ConstantInt::get(Type::getInt32Ty(Mod->getContext()), 65535),
-    ConstantExpr::getBitCast(Callee, GlobalDtorElems[1])
+    ConstantExpr::getBitCast(Fn, GlobalElems[1])
   };
 
-  // If llvm.global_dtors exists, make a copy of the things in its list and
-  // delete it, to replace it with one that has a larger array type.
-  std::vector<Constant *> dtors;
-  if (GlobalVariable *GlobalDtors = Mod->getNamedGlobal("llvm.global_dtors")) {
+  // If the array exists, make a copy of the things in its list and delete
+  // it, to replace it with one that has a larger array type.
+  std::vector<Constant *> Elems;
+  if (GlobalVariable *GlobalArray = Mod->getNamedGlobal(ArrayName)) {
     if (ConstantArray *InitList =
-        dyn_cast<ConstantArray>(GlobalDtors->getInitializer())) {
+        dyn_cast<ConstantArray>(GlobalArray->getInitializer())) {
       for (unsigned i = 0, e = InitList->getType()->getNumElements();
            i != e; ++i)
-        dtors.push_back(cast<Constant>(InitList->getOperand(i)));
+        Elems.push_back(cast<Constant>(InitList->getOperand(i)));
     }
-    GlobalDtors->eraseFromParent();
+    GlobalArray->eraseFromParent();
+  }
+
+  // Build up the array with our new item in it.
+  Elems.push_back(ConstantStruct::get(GlobalElemTy, Elem));
+  ArrayType *ATy = ArrayType::get(GlobalElemTy, Elems.size());
+  new GlobalVariable(*Mod, ATy, false, GlobalValue::AppendingLinkage,
+                     ConstantArray::get(ATy, Elems), ArrayName);
+}
+
+void llvm::InsertProfilingShutdownCall(Function *Callee, Module *Mod) {
+  AppendToGlobalFunctionArray(Mod, "llvm.global_dtors", Callee);
+}
+
+// GetProfilingModuleCtor - The global constructor starting the
+// instrumentation of a module without main.  It registers the module with the
+// runtime under the stem of the module identifier, calls the entry points of
+// the runtime, and returns to the main program.  A global destructor is added
+// along with it, which has the runtime write out and forget the data of the
+// module before it is unloaded.
+static Function *GetProfilingModuleCtor(Module &M) {
+  const char *CtorName = "__llvm_profiling_module_init";
+  if (Function *Ctor = M.getFunction(CtorName))
+    return Ctor;
+
+  LLVMContext &Context = M.getContext();
+  Type *VoidPtrTy = Type::getInt8PtrTy(Context);
+  Function *Ctor =
+    Function::Create(FunctionType::get(Type::getVoidTy(Context), false),
+                     GlobalValue::InternalLinkage, CtorName, &M);
+  BasicBlock *Entry = BasicBlock::Create(Context, "entry", Ctor);
+
+  std::string ModuleName = sys::path::stem(M.getModuleIdentifier()).str();
+  if (ModuleName.empty())
+    ModuleName = "module";
+  Constant *Name = ConstantDataArray::getString(Context, ModuleName);
+  GlobalVariable *NameVar =
+    new GlobalVariable(M, Name->getType(), true, GlobalValue::PrivateLinkage,
+                       Name, "__llvm_profiling_module_name");
+  std::vector<Constant*> Indices(2,
+                             Constant::getNullValue(Type::getInt64Ty(Context)));
+
+  Constant *NamePtr = ConstantExpr::getGetElementPtr(NameVar, Indices);
+
+  Constant *ModuleFn = M.getOrInsertFunction("llvm_profiling_module",
+                                             Type::getVoidTy(Context),
+                                             VoidPtrTy, (Type *)0);
+  CallInst::Create(ModuleFn, NamePtr, "", Entry);
+  CallInst::Create(ModuleFn, Constant::getNullValue(VoidPtrTy), "", Entry);
+  ReturnInst::Create(Context, Entry);
+
+  AppendToGlobalFunctionArray(&M, "llvm.global_ctors", Ctor);
+
+  Function *Dtor =
+    Function::Create(FunctionType::get(Type::getVoidTy(Context), false),
+                     GlobalValue::InternalLinkage,
+                     "__llvm_profiling_module_fini", &M);
+  BasicBlock *DtorEntry = BasicBlock::Create(Context, "entry", Dtor);
+  Constant *ExitFn = M.getOrInsertFunction("llvm_profiling_module_exit",
+                                           Type::getVoidTy(Context),
+                                           VoidPtrTy, (Type *)0);
+  CallInst::Create(ExitFn, NamePtr, "", DtorEntry);
+  ReturnInst::Create(Context, DtorEntry);
+
+  InsertProfilingShutdownCall(Dtor, &M);
+  return Ctor;
+}
+
+void llvm::InsertProfilingInit(Module &M, const char *FnName,
+                               GlobalValue *Array, PointerType *arrayType) {
+  if (Function *Main = M.getFunction("main")) {
+    InsertProfilingInitCall(Main, FnName, Array, arrayType);
+    return;
+  }
+
+  // Start the instrumentation between the calls registering the module and
+  // returning to the main program.
+  Function *Ctor = GetProfilingModuleCtor(M);
+  BasicBlock::iterator InsertPos = Ctor->getEntryBlock().getTerminator();
+  --InsertPos;
+  CreateProfilingInitCall(M, FnName, Array, arrayType, InsertPos);
+}
+
+void llvm::ProfiledFunctions::add(const Function &F, uint64_t FirstCounter,
+                                  uint64_t NumCounters) {
+  FunctionMapEntry Entry = { getFunctionGUID(F), getFunctionCFGHash(F),
+                             FirstCounter, NumCounters };
+  Entries.push_back(Entry);
+  appendBlockMap(F, Blocks);
+}
+
+// InsertMapArray - Emit the words of a map record as a constant array and
+// register it with the runtime through FnName.
+static void InsertMapArray(Module &M, const char *FnName, const char *Name,
+                           const std::vector<uint64_t> &Words,
+                           Function *MainFn) {
+  Constant *Init = ConstantDataArray::get(M.getContext(), Words);
+  GlobalVariable *Map =
+    new GlobalVariable(M, Init->getType(), true, GlobalValue::InternalLinkage,
+                       Init, Name);
+  if (MainFn)
+    InsertProfilingInitCall(MainFn, FnName, Map);
+  else
+    InsertProfilingInit(M, FnName, Map);
+}
+
+void llvm::InsertFunctionMap(Module &M, ProfilingType PT,
+                             const ProfiledFunctions &Functions,
+                             Function *MainFn) {
+  std::vector<uint64_t> Words(1, PT);
+  for (unsigned i = 0, e = Functions.Entries.size(); i != e; ++i) {
+    Words.push_back(Functions.Entries[i].guid);
+    Words.push_back(Functions.Entries[i].cfgHash);
+    Words.push_back(Functions.Entries[i].firstCounter);
+    Words.push_back(Functions.Entries[i].numCounters);
+  }
+  InsertMapArray(M, "llvm_register_function_map", "FunctionProfileMap", Words,
+                 MainFn);
+
+  Words.resize(1);
+  Words.insert(Words.end(), Functions.Blocks.begin(), Functions.Blocks.end());
+  InsertMapArray(M, "llvm_register_block_map", "BlockProfileMap", Words,
+                 MainFn);
+}
+
+Function *llvm::CloneForSampling(Function *F, ValueToValueMapTy &VMap) {
+  if (SampleInterval == 0 || SampleBurst == 0)
+    return 0;
+  // The copies could not tell whose blocks an indirect branch goes to.
+  for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB)
+    if (BB->hasAddressTaken())
+      return 0;
+  return CloneFunction(F, VMap, false);
+}
+
+// The blocks of a switch between the copies of a sampled function.  Check
+// counts down and continues in the uninstrumented copy, unless a burst is
+// due: then Burst continues in the instrumented copy, or Reset restarts the
+// countdown once the burst is over.
+struct SampleCheck {
+  BasicBlock *Check, *Burst, *Reset;
+};
+
+static SampleCheck InsertSampleCheck(BasicBlock *Check, Constant *Countdown,
+                                     BasicBlock *Clean,
+                                     BasicBlock *Instrumented) {
+  Function *F = Check->getParent();
+  LLVMContext &Context = F->getContext();
+  Type *Int64 = Type::getInt64Ty(Context);
+  SampleCheck Result = { Check,
+                         BasicBlock::Create(Context, "sample.burst", F),
+                         BasicBlock::Create(Context, "sample.reset", F) };
+  MDBuilder MDB(Context);
+
+  Value *Old = new LoadInst(Countdown, "sample.countdown", Check);
+  Value *New = BinaryOperator::Create(Instruction::Sub, Old,
+                                      ConstantInt::get(Int64, 1),
+                                      "sample.countdown", Check);
+  new StoreInst(New, Countdown, Check);
+  Value *Due = new ICmpInst(*Check, ICmpInst::ICMP_SLE, New,
+                            ConstantInt::get(Int64, 0), "sample.due");
+  BranchInst::Create(Result.Burst, Clean, Due, Check)
+    ->setMetadata(LLVMContext::MD_prof,
+                  MDB.createBranchWeights(SampleBurst, SampleInterval));
+
+  Value *Over = new ICmpInst(*Result.Burst, ICmpInst::ICMP_SLE, New,
+                             ConstantInt::getSigned(Int64, -(int64_t)SampleBurst),
+                             "sample.over");
+  BranchInst::Create(Result.Reset, Instrumented, Over, Result.Burst);
+
+  new StoreInst(ConstantInt::get(Int64, SampleInterval), Countdown,
+                Result.Reset);
+  BranchInst::Create(Clean, Result.Reset);
+  return Result;
+}
+
+// MoveBackEdgeValues - Move the incoming values of PN from the blocks in
+// Sources into Merged, the PHI of the check which replaces those edges.
+static void MoveBackEdgeValues(PHINode *PN,
+                               const SmallPtrSet<BasicBlock*, 8> &Sources,
+                               PHINode *Merged) {
+  for (unsigned i = PN->getNumIncomingValues(); i-- != 0; ) {
+    if (!Sources.count(PN->getIncomingBlock(i)))
+      continue;
+    Merged->addIncoming(PN->getIncomingValue(i), PN->getIncomingBlock(i));
+    PN->removeIncomingValue(i, false);
+  }
+}
+
+// InsertBackEdgeChecks - Send the back edges of both copies into H, the
+// instrumented header, and into its uninstrumented copy through one check.
+static void InsertBackEdgeChecks(BasicBlock *H, BasicBlock *CleanH,
+                                 const SmallPtrSet<BasicBlock*, 8> &Sources,
+                                 const SmallPtrSet<BasicBlock*, 8> &CleanSources,
+                                 ValueToValueMapTy &VMap,
+                                 Constant *Countdown) {
+  // Bail out on headers whose PHIs do not pair up, they only continue the
+  // copy they are in.
+  if (H->isLandingPad())
+    return;
+  for (BasicBlock::iterator I = H->begin(); isa<PHINode>(I); ++I)
+    if (!VMap.count(I))
+      return;
+
+  Function *F = H->getParent();
+  BasicBlock *Check =
+    BasicBlock::Create(F->getContext(), "sample.check", F, CleanH);
+  SampleCheck SC = InsertSampleCheck(Check, Countdown, CleanH, H);
+
+  for (BasicBlock::iterator I = H->begin(); isa<PHINode>(I); ++I) {
+    PHINode *PN = cast<PHINode>(I);
+    PHINode *CleanPN = cast<PHINode>(VMap[PN]);
+    PHINode *Merged = PHINode::Create(PN->getType(), 0,
+                                      PN->getName() + ".sample",
+                                      Check->begin());
+    MoveBackEdgeValues(PN, Sources, Merged);
+    MoveBackEdgeValues(CleanPN, CleanSources, Merged);
+    PN->addIncoming(Merged, SC.Burst);
+    CleanPN->addIncoming(Merged, Check);
+    CleanPN->addIncoming(Merged, SC.Reset);
+  }
+
+  for (SmallPtrSet<BasicBlock*, 8>::const_iterator I = Sources.begin(),
+       E = Sources.end(); I != E; ++I) {
+    TerminatorInst *TI = (*I)->getTerminator();
+    for (unsigned s = 0, e = TI->getNumSuccessors(); s != e; ++s)
+      if (TI->getSuccessor(s) == H)
+        TI->setSuccessor(s, Check);
+  }
+  for (SmallPtrSet<BasicBlock*, 8>::const_iterator I = CleanSources.begin(),
+       E = CleanSources.end(); I != E; ++I) {
+    TerminatorInst *TI = (*I)->getTerminator();
+    for (unsigned s = 0, e = TI->getNumSuccessors(); s != e; ++s)
+      if (TI->getSuccessor(s) == CleanH)
+        TI->setSuccessor(s, Check);
+  }
+}
+
+// RepairSSA - Control now moves between the copies, so the uses of a value
+// are reached by its definitions in both.  Join them where they meet.
+static void RepairSSA(Instruction *I, Instruction *CleanI) {
+  if (!I->isUsedOutsideOfBlock(I->getParent()) &&
+      !CleanI->isUsedOutsideOfBlock(CleanI->getParent()))
+    return;
+
+  SSAUpdater SSA;
+  SSA.Initialize(I->getType(), I->getName());
+  SSA.AddAvailableValue(I->getParent(), I);
+  SSA.AddAvailableValue(CleanI->getParent(), CleanI);
+
+  std::vector<Use*> Uses;
+  for (Value::use_iterator UI = I->use_begin(), UE = I->use_end();
+       UI != UE; ++UI)
+    Uses.push_back(&*UI);
+  for (Value::use_iterator UI = CleanI->use_begin(), UE = CleanI->use_end();
+       UI != UE; ++UI)
+    Uses.push_back(&*UI);
+
+  for (unsigned i = 0, e = Uses.size(); i != e; ++i) {
+    Instruction *User = cast<Instruction>(Uses[i]->getUser());
+    // Uses after the definition in its own block need no update.
+    if (!isa<PHINode>(User) &&
+        User->getParent() == cast<Instruction>(Uses[i]->get())->getParent())
+      continue;
+    SSA.RewriteUse(*Uses[i]);
+  }
+}
+
+void llvm::InsertSampling(Function *F, Function *Clean,
+                          ValueToValueMapTy &VMap, bool AtBackEdges) {
+  LLVMContext &Context = F->getContext();
+  Constant *Countdown =
+    F->getParent()->getOrInsertGlobal("llvm_profile_sample_countdown",
+                                      Type::getInt64Ty(Context));
+
+  // Find the back edges while the copies are still apart.
+  SmallVector<std::pair<const BasicBlock*, const BasicBlock*>, 16> BackEdges;
+  SmallVector<std::pair<const BasicBlock*, const BasicBlock*>, 16>
+    CleanBackEdges;
+  if (AtBackEdges) {
+    FindFunctionBackedges(*F, BackEdges);
+    FindFunctionBackedges(*Clean, CleanBackEdges);
+  }
+
+  DenseMap<BasicBlock*, BasicBlock*> InstrumentedOf;
+  std::vector<std::pair<Instruction*, Instruction*> > Pairs;
+  for (ValueToValueMapTy::iterator I = VMap.begin(), E = VMap.end();
+       I != E; ++I) {
+    if (!I->second)
+      continue;
+    if (const BasicBlock *BB = dyn_cast<BasicBlock>(I->first))
+      InstrumentedOf[cast<BasicBlock>(I->second)] = const_cast<BasicBlock*>(BB);
+    else if (const Instruction *Inst = dyn_cast<Instruction>(I->first))
+      Pairs.push_back(std::make_pair(const_cast<Instruction*>(Inst),
+                                     cast<Instruction>(I->second)));
+  }
+
+  for (Function::arg_iterator A = F->arg_begin(), E = F->arg_end();
+       A != E; ++A)
+    VMap[A]->replaceAllUsesWith(A);
+  BasicBlock *Entry = &F->getEntryBlock();
+  BasicBlock *CleanEntry = &Clean->getEntryBlock();
+  F->getBasicBlockList().splice(F->end(), Clean->getBasicBlockList());
+  delete Clean;
+
+  // Both copies share the static allocas, which move into the new entry.
+  BasicBlock *Switch = BasicBlock::Create(Context, "sample.entry", F, Entry);
+  SmallPtrSet<Instruction*, 8> Merged;
+  for (BasicBlock::iterator I = Entry->begin(), E = Entry->end(); I != E; ) {
+    AllocaInst *AI = dyn_cast<AllocaInst>(I++);
+    if (!AI || !isa<Constant>(AI->getArraySize()) || !VMap.count(AI))
+      continue;
+    AllocaInst *CleanAI = cast<AllocaInst>(VMap[AI]);
+    if (CleanAI->getParent() != CleanEntry)
+      continue;
+    CleanAI->replaceAllUsesWith(AI);
+    CleanAI->eraseFromParent();
+    Merged.insert(AI);
+    AI->removeFromParent();
+    Switch->getInstList().push_back(AI);
+  }
+  InsertSampleCheck(Switch, Countdown, CleanEntry, Entry);
+
+  if (!AtBackEdges)
+    return;
+
+  // Group the back edges of both copies by the instrumented header.
+  std::map<BasicBlock*, SmallPtrSet<BasicBlock*, 8> > Sources, CleanSources;
+  for (unsigned i = 0, e = BackEdges.size(); i != e; ++i) {
+    BasicBlock *H = const_cast<BasicBlock*>(BackEdges[i].second);
+    if (VMap.count(H))
+      Sources[H].insert(const_cast<BasicBlock*>(BackEdges[i].first));
+  }
+  for (unsigned i = 0, e = CleanBackEdges.size(); i != e; ++i) {
+    BasicBlock *H =
+      InstrumentedOf.lookup(const_cast<BasicBlock*>(CleanBackEdges[i].second));
+    if (H)
+      CleanSources[H].insert(const_cast<BasicBlock*>(CleanBackEdges[i].first));
   }
+  for (std::map<BasicBlock*, SmallPtrSet<BasicBlock*, 8> >::iterator
+       I = Sources.begin(), E = Sources.end(); I != E; ++I)
+    InsertBackEdgeChecks(I->first, cast<BasicBlock>(VMap[I->first]),
+                         I->second, CleanSources[I->first], VMap, Countdown);
 
-  // Build up llvm.global_dtors with our new item in it.
-  GlobalVariable *GlobalDtors = new GlobalVariable(
-      *Mod, ArrayType::get(GlobalDtorElemTy, 1), false,
-      GlobalValue::AppendingLinkage, NULL, "llvm.global_dtors");
-                                    
-  dtors.push_back(ConstantStruct::get(GlobalDtorElemTy, Elem));
-  GlobalDtors->setInitializer(ConstantArray::get(
-      cast<ArrayType>(GlobalDtors->getType()->getElementType()), dtors));
+  for (unsigned i = 0, e = Pairs.size(); i != e; ++i)
+    if (!Merged.count(Pairs[i].first))
+      RepairSSA(Pairs[i].first, Pairs[i].second);
 }
@@ -16,22 +16,69 @@
 
 #ifndef PROFILINGUTILS_H
 #define PROFILINGUTILS_H
+#include "ProfileInfoTypes.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
 #include <stdint.h>
+#include <vector>
 
 namespace llvm {
   class BasicBlock;
   class Function;
   class GlobalValue;
+  class Instruction;
   class Module;
   class PointerType;
 
   void InsertProfilingInitCall(Function *MainFn, const char *FnName,
                                GlobalValue *Arr = 0,
                                PointerType *arrayType = 0);
+  // InsertProfilingInit - Start the instrumentation from main, or for modules
+  // without main, such as shared libraries and plugins, from a global
+  // constructor which registers the module with the runtime.
+  void InsertProfilingInit(Module &M, const char *FnName,
+                           GlobalValue *Arr = 0, PointerType *arrayType = 0);
   void IncrementCounterInBlock(BasicBlock *BB, uint64_t CounterNum,
                                GlobalValue *CounterArray,
                                bool beginning = true);
+  void IncrementCounterBefore(Instruction *InsertPos, uint64_t CounterNum,
+                              GlobalValue *CounterArray);
+  Instruction *GetCounterInsertionPoint(BasicBlock *BB, bool beginning = true);
+  void SetCoverageFlagBefore(Instruction *InsertPos, uint64_t FlagNum,
+                             GlobalValue *FlagArray);
   void InsertProfilingShutdownCall(Function *Callee, Module *Mod);
+  // MarkProbe - With -profile-dormant, mark I as part of a probe which only
+  // runs while profiling is enabled at run time.  Probes must not be used
+  // outside of the instructions next to them.
+  void MarkProbe(Instruction *I);
+  // InsertProbeGuards - Guard every run of marked probe instructions with a
+  // check of the run time enable flag.  Called once the module is fully
+  // instrumented, as it splits blocks.
+  void InsertProbeGuards(Module &M);
+  // ProfiledFunctions - The identities and control flow graphs of the
+  // functions profiled by some counters, taken before they are instrumented.
+  struct ProfiledFunctions {
+    std::vector<FunctionMapEntry> Entries;
+    std::vector<uint64_t> Blocks; // BlockMapInfo words after the type
+
+    void add(const Function &F, uint64_t FirstCounter, uint64_t NumCounters);
+  };
+  // InsertFunctionMap - Emit the function and block maps of the functions
+  // profiled by counters of type PT, to be written out along with them.  The
+  // maps are registered from MainFn if given, else as by InsertProfilingInit.
+  void InsertFunctionMap(Module &M, ProfilingType PT,
+                         const ProfiledFunctions &Functions,
+                         Function *MainFn = 0);
+  // CloneForSampling - With -profile-sample-interval, copy the body of F
+  // before it is instrumented, to be merged back by InsertSampling.  Returns
+  // null if F is not sampled.
+  Function *CloneForSampling(Function *F, ValueToValueMapTy &VMap);
+  // InsertSampling - Merge the uninstrumented copy Clean of the instrumented
+  // F back into F and switch between the two copies at the entry, and at the
+  // back edges if AtBackEdges.  Every switch counts down a global, the
+  // instrumented copy runs for -profile-sample-burst switches every
+  // -profile-sample-interval switches.
+  void InsertSampling(Function *F, Function *Clean, ValueToValueMapTy &VMap,
+                      bool AtBackEdges);
 }
 
 #endif
@@ -11,6 +11,21 @@
 // library that cause it to output a trace of basic blocks as a side effect
 // of normal execution.
 //
+// Every call passes the trace handle of the module, which the runtime fills
+// when the tracing of the module starts, so that the modules of a process
+// are traced into their own profile files.
+//
+// With -trace-mem every load, store and atomic operation is traced by one
+// more call, passing a memory record of its kind, its access size and its
+// number among the memory operations of the module, and the address.
+//
+// With -trace-sample-burst the runtime only records bursts of events, every
+// -trace-sample-period events or every -trace-sample-timer-ms milliseconds.
+// The sampling is stored in the trace handle of the module.
+//
+// With -trace-coverage no trace is written.  Every block sets a byte flag
+// instead, which is only stored while it is still clear.
+//
 //===----------------------------------------------------------------------===//
 
 #include "ProfilingUtils.h"
@@ -19,31 +34,45 @@
 #include "llvm/Pass.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
 #include "llvm/Transforms/Instrumentation.h"
+#include "llvm/IR/DataLayout.h"
 #include "llvm/IR/Instructions.h"
 
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/Compiler.h"
 #include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
 
 #include "BBTraceStream.h"
+#include "ProfileCommon.h"
+#include "ProfileInfoTypes.h"
 
 #include <set>
 using namespace llvm;
 
 static cl::opt<bool> TraceMemoryOpt ("trace-mem", cl::desc("Enable load/store tracing"));
+static cl::opt<bool> TraceCoverageOpt ("trace-coverage", cl::desc("Only record which basic blocks ran"));
+static cl::opt<unsigned> TraceSampleBurst ("trace-sample-burst", cl::init(0), cl::desc("Only trace bursts of this many events (0 = trace all events)"));
+static cl::opt<unsigned> TraceSamplePeriod ("trace-sample-period", cl::init(1000000), cl::desc("Start a burst of tracing every this many events"));
+static cl::opt<unsigned> TraceSampleTimer ("trace-sample-timer-ms", cl::init(0), cl::desc("Start a burst of tracing every this many milliseconds instead"));
 
 namespace {
 	class TraceBasicBlocks : public ModulePass {
 		bool TraceMemory;
+		bool TraceCoverage;
 		LLVMContext* Context;
-		void InsertMemoryTracingCall(BasicBlock*BB, Constant* InstrFn);
+		const DataLayout* DL;
+		Constant* TraceHandle;
+		std::unordered_map<Instruction*, int> MemNumbers; //As in the memory records
+		void InsertTraceCall(Constant* InstrFn, Value* Label, Instruction* InsertPos);
+		void InsertMemoryTracingCall(BasicBlock*BB, Constant* MemFn);
 		void InsertRetInstrumentationCall(TerminatorInst* TI, Constant* InstrFn);
 		void InsertInstrumentationCall(BasicBlock* BB, Constant* InstrFn, uint64_t BBNumber);	  
+		void InsertCoverageFlags(Module &M);
 		bool runOnModule(Module &M);
 		public:
 			static char ID; // Pass identification, replacement for typeid
-			TraceBasicBlocks() :ModulePass(ID) {TraceMemory=TraceMemoryOpt;}
-			TraceBasicBlocks(bool TraceMem) : ModulePass(ID) {TraceMemory=TraceMem;}
+			TraceBasicBlocks() :ModulePass(ID) {TraceMemory=TraceMemoryOpt; TraceCoverage=TraceCoverageOpt;}
+			TraceBasicBlocks(bool TraceMem) : ModulePass(ID) {TraceMemory=TraceMem; TraceCoverage=false;}
 	};
 
 	// Register the path profiler as a pass
@@ -52,9 +81,16 @@ namespace {
 	                                 "Insert instrumentation for basic block tracing");
 }
 
+void TraceBasicBlocks::InsertTraceCall(Constant* InstrFn, Value* Label, Instruction* InsertPos) {
+	std::vector<Value*> Args(2);
+	Args[0] = TraceHandle;
+	Args[1] = Label;
+	MarkProbe(CallInst::Create(InstrFn, Args, "", InsertPos));
+}
+
 void TraceBasicBlocks::InsertRetInstrumentationCall(TerminatorInst* TI, Constant* InstrFn) {
-	CallInst::Create(InstrFn, ConstantInt::get (Type::getInt64Ty(*Context), BBTraceStream::FunRetID),
-	                 "", TI);
+	InsertTraceCall(InstrFn, ConstantInt::get (Type::getInt64Ty(*Context), BBTraceStream::FunRetID),
+	                TI);
 }
 void TraceBasicBlocks::InsertInstrumentationCall (BasicBlock *BB,
                                                   Constant* InstrFn,
@@ -63,48 +99,119 @@ void TraceBasicBlocks::InsertInstrumentationCall (BasicBlock *BB,
 	// Insert the call after any alloca or PHI instructions.i
 	BasicBlock::iterator InsertPos = BB->getFirstInsertionPt();
 	while (isa<AllocaInst>(InsertPos))  ++InsertPos;
-	CallInst::Create(InstrFn, ConstantInt::get (Type::getInt64Ty(*Context), BBNumber), "", InsertPos);
+	InsertTraceCall(InstrFn, ConstantInt::get (Type::getInt64Ty(*Context), BBNumber), InsertPos);
 }
 
-static Value* getMemInstrAddress(Instruction* I) {
+//Returns the address accessed by I, and sets the kind of the access and the type accessed.
+static Value* getMemInstrAddress(Instruction* I, BBTraceStream::MemOpKind& kind, Type*& accessTy) {
 	if(LoadInst* li=dyn_cast<LoadInst>(I)) {
+		kind=BBTraceStream::MemLoad;
+		accessTy=li->getType();
 		return li->getPointerOperand();
 	}
 	if(StoreInst* li=dyn_cast<StoreInst>(I)) {
+		kind=BBTraceStream::MemStore;
+		accessTy=li->getValueOperand()->getType();
 		return li->getPointerOperand();
 	}
 	if(AtomicCmpXchgInst* li=dyn_cast<AtomicCmpXchgInst>(I)) {
+		kind=BBTraceStream::MemCmpXchg;
+		accessTy=li->getCompareOperand()->getType();
 		return li->getPointerOperand();
 	}
 	if(AtomicRMWInst* li=dyn_cast<AtomicRMWInst>(I)) {
+		kind=BBTraceStream::MemAtomicRMW;
+		accessTy=li->getValOperand()->getType();
 		return li->getPointerOperand();
 	}
 	return NULL;
 }
  
-void TraceBasicBlocks::InsertMemoryTracingCall(BasicBlock*BB, Constant* InstrFn) {
+//Emits one call per memory operation, with its record and the address accessed.
+void TraceBasicBlocks::InsertMemoryTracingCall(BasicBlock*BB, Constant* MemFn) {
 	for(BasicBlock::iterator it = BB->getFirstInsertionPt(), e=BB->end(); it!=e; ++it) {
-		if(Value* MemAddress=getMemInstrAddress(it)) {
-			CallInst::Create(InstrFn, ConstantInt::get (Type::getInt64Ty(*Context), BBTraceStream::MemOpID),"", it);
-			 PtrToIntInst* castInstr=new PtrToIntInst (MemAddress, Type::getInt64Ty(*Context),"", it);
-			CallInst::Create(InstrFn,castInstr,"", it);
+		BBTraceStream::MemOpKind kind;
+		Type* accessTy;
+		if(Value* MemAddress=getMemInstrAddress(it, kind, accessTy)) {
+			uint64_t size = DL ? DL->getTypeStoreSize(accessTy) : accessTy->getPrimitiveSizeInBits()/8;
+			uint64_t record = BBTraceStream::encodeMemRecord(kind, size, MemNumbers[it]);
+
+			PtrToIntInst* castInstr=new PtrToIntInst (MemAddress, Type::getInt64Ty(*Context),"", it);
+			MarkProbe(castInstr);
+			std::vector<Value*> Args(3);
+			Args[0] = TraceHandle;
+			Args[1] = ConstantInt::get (Type::getInt64Ty(*Context), record);
+			Args[2] = castInstr;
+			MarkProbe(CallInst::Create(MemFn, Args, "", it));
 		}
 	}
 	
 }
 
+//Sets a flag per basic block, numbered like the trace.  The flags split their blocks, so all
+//blocks are numbered before the first one is inserted.
+void TraceBasicBlocks::InsertCoverageFlags(Module &M) {
+	std::vector<std::pair<Instruction*, uint64_t> > Probes;
+	uint64_t BBNumber = 0;
+	for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+		if(F->empty()) { continue; }
+		for (Function::iterator BB = F->begin(), E = F->end(); BB != E; ++BB) {
+			Probes.push_back(std::make_pair(GetCounterInsertionPoint(BB), BBNumber++));
+		}
+	}
+
+	Type *ATy = ArrayType::get(Type::getInt8Ty(*Context), BBNumber);
+	GlobalVariable *Flags =
+		new GlobalVariable(M, ATy, false, GlobalValue::InternalLinkage,
+		                   Constant::getNullValue(ATy), "BlockCoverageFlags");
+	for (unsigned i = 0, e = Probes.size(); i != e; ++i) {
+		SetCoverageFlagBefore(Probes[i].first, Probes[i].second, Flags);
+	}
+
+	InsertProfilingInit(M, "llvm_start_block_coverage", Flags, Type::getInt8PtrTy(*Context));
+}
+
 bool TraceBasicBlocks::runOnModule(Module &M)  {
 	Context =&M.getContext();
-	Function *Main = M.getFunction("main");
-	if (Main == 0) {
-		errs() << "WARNING: cannot insert basic-block trace instrumentation"
-			<< " into a module with no main function!\n";
-		return false;  // No main, no instrumentation!
+	if(TraceCoverage) {
+		if(TraceMemory)
+			errs() << "WARNING: -trace-coverage only records which blocks ran,"
+			       << " memory operations are not traced!\n";
+		InsertCoverageFlags(M);
+		return true;
 	}
+
+	//The runtime stores the trace of the module in its handle, and reads the sampling from it
+	Type *Int64Ty = Type::getInt64Ty(*Context);
+	std::vector<Constant*> HandleInit(sizeof(BBTraceHandle) / sizeof(uint64_t));
+	HandleInit[0] = ConstantInt::get(Int64Ty, 0);
+	HandleInit[1] = ConstantInt::get(Int64Ty, TraceSampleBurst);
+	HandleInit[2] = ConstantInt::get(Int64Ty, TraceSamplePeriod);
+	HandleInit[3] = ConstantInt::get(Int64Ty, TraceSampleTimer);
+	ArrayType *HandleTy = ArrayType::get(Int64Ty, HandleInit.size());
+	GlobalVariable *Handle =
+		new GlobalVariable(M, HandleTy, false, GlobalValue::InternalLinkage,
+		                   ConstantArray::get(HandleTy, HandleInit), "BBTraceHandle");
+	std::vector<Constant*> Indices(2, Constant::getNullValue(Type::getInt64Ty(*Context)));
+	TraceHandle = ConstantExpr::getGetElementPtr(Handle, Indices);
+
 	const char* FnName="llvm_trace_basic_block";
 	Constant *InstrFn = M.getOrInsertFunction (FnName, Type::getVoidTy(*Context),
+	                                           Type::getInt64PtrTy(*Context),
 	                                           Type::getInt64Ty(*Context), NULL);
 
+	Constant *MemFn = 0;
+	if(TraceMemory) {
+		MemFn = M.getOrInsertFunction ("llvm_trace_memop", Type::getVoidTy(*Context),
+		                               Type::getInt64PtrTy(*Context),
+		                               Type::getInt64Ty(*Context), // record
+		                               Type::getInt64Ty(*Context), // address
+		                               NULL);
+		DL = M.getDataLayout();
+		std::vector<Instruction*> MemOps;
+		label_memory_operations(M, MemOps, MemNumbers);
+	}
+
 	unsigned BBNumber = 0;
 	for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
 		if(F->empty()) { continue; }
@@ -120,7 +227,7 @@ bool TraceBasicBlocks::runOnModule(Module &M)  {
 			}
 			InsertInstrumentationCall (BB, InstrFn, BBNumber);
 			if(TraceMemory) {
-				InsertMemoryTracingCall (BB,InstrFn);
+				InsertMemoryTracingCall (BB,MemFn);
 			}
 			++BBNumber;
 		}
@@ -129,9 +236,12 @@ bool TraceBasicBlocks::runOnModule(Module &M)  {
 		InsertInstrumentationCall (EntryBlock, InstrFn, BBTraceStream::FunCallID);
 	}
 
-	// Add the initialization call to main.
+	// Run the probes only while tracing is enabled, with -profile-dormant.
+	InsertProbeGuards(M);
+
+	// Add the initialization call to main, or to a constructor of the module.
 
-	InsertProfilingInitCall(Main, "llvm_start_basic_block_tracing");
+	InsertProfilingInit(M, "llvm_start_basic_block_tracing", Handle);
 	return true;
 }
 
@@ -0,0 +1,201 @@
+//===- ValueProfileInfo.cpp -----------------------------------*- C++ -*---===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file defines the interface used by optimizers to load value profiles,
+// and provides a loader pass which reads them from a profile file.
+//
+//===----------------------------------------------------------------------===//
+#define DEBUG_TYPE "value-profile-info"
+
+#include "ValueProfileInfo.h"
+#include "ProfileInfoLoader.h"
+#include "ProfileInfoTypes.h"
+#include "Passes.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+
+using namespace llvm;
+
+static cl::opt<std::string>
+ValueProfileFilename("value-profile-file", cl::init("llvmprof.out"),
+  cl::value_desc("filename"),
+  cl::desc("Profile file loaded by -value-profile-loader"), cl::Hidden);
+
+// ----------------------------------------------------------------------------
+// ValueProfileInfo implementation
+//
+
+// Pass identification
+char llvm::ValueProfileInfo::ID = 0;
+
+ValueProfileInfo::ValueProfileInfo() {}
+
+ValueProfileInfo::~ValueProfileInfo() {}
+
+Value* ValueProfileInfo::getProfiledValue(Instruction* I, unsigned& kind) {
+  Value* value = 0;
+
+  if (MemIntrinsic* MI = dyn_cast<MemIntrinsic>(I)) {
+    value = MI->getLength();
+    kind = MemIntrinsicSizeValue;
+  } else if (SwitchInst* SI = dyn_cast<SwitchInst>(I)) {
+    value = SI->getCondition();
+    kind = SwitchConditionValue;
+  } else if (BinaryOperator* BO = dyn_cast<BinaryOperator>(I)) {
+    switch (BO->getOpcode()) {
+    case Instruction::UDiv:
+    case Instruction::SDiv:
+    case Instruction::URem:
+    case Instruction::SRem:
+      value = BO->getOperand(1);
+      kind = DivisorValue;
+      break;
+    default:
+      break;
+    }
+  }
+
+  // Constants need no profile, and wider values do not fit the record.
+  if (!value || isa<Constant>(value) || !value->getType()->isIntegerTy() ||
+      value->getType()->getIntegerBitWidth() > 64)
+    return 0;
+
+  return value;
+}
+
+bool ValueProfileInfo::isSignedValue(unsigned kind) {
+  return kind == SwitchConditionValue;
+}
+
+uint64_t ValueProfileInfo::getExecutionCount(const Instruction* I) const {
+  DenseMap<const Instruction*, uint64_t>::const_iterator count =
+    _executionCounts.find(I);
+  return count == _executionCounts.end() ? 0 : count->second;
+}
+
+const ValueProfileInfo::ValueVector&
+ValueProfileInfo::getValues(const Instruction* I) const {
+  DenseMap<const Instruction*, ValueVector>::const_iterator values =
+    _values.find(I);
+  return values == _values.end() ? _noValues : values->second;
+}
+
+// ----------------------------------------------------------------------------
+// ValueProfileLoaderPass implementation
+//
+
+namespace {
+  class ValueProfileLoaderPass : public ModulePass, public ValueProfileInfo {
+  public:
+    static char ID; // Pass identification
+    ValueProfileLoaderPass() : ModulePass(ID) { }
+
+    // this pass doesn't change anything (only loads information)
+    virtual void getAnalysisUsage(AnalysisUsage &AU) const {
+      AU.setPreservesAll();
+    }
+
+    virtual const char* getPassName() const {
+      return "Value Profiling Information Loader";
+    }
+
+    // required since this pass implements multiple inheritance
+    virtual void *getAdjustedAnalysisPointer(AnalysisID PI) {
+      if (PI == &ValueProfileInfo::ID)
+        return (ValueProfileInfo*)this;
+      return this;
+    }
+
+    bool runOnModule(Module &M);
+  };
+
+  // Orders values by decreasing count.
+  struct MoreFrequent {
+    bool operator()(const std::pair<uint64_t, uint64_t>& LHS,
+                    const std::pair<uint64_t, uint64_t>& RHS) const {
+      return LHS.second > RHS.second;
+    }
+  };
+}
+
+char ValueProfileLoaderPass::ID = 0;
+
+static RegisterAnalysisGroup<ValueProfileInfo> P("Value Profile Information");
+static RegisterPass<ValueProfileLoaderPass> X("value-profile-loader",
+                   "Load value profile information from file", false, true);
+static RegisterAnalysisGroup<ValueProfileInfo> R(X);
+
+char &llvm::ValueProfileLoaderPassID = ValueProfileLoaderPass::ID;
+
+bool ValueProfileLoaderPass::runOnModule(Module &M) {
+  ProfileInfoLoader PIL("value-profile-loader", ValueProfileFilename);
+  const std::vector<ValueSiteCounts>& sites = PIL.getRawValueCounts();
+
+  uint64_t site = 0;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (F->isDeclaration()) continue;
+    for (inst_iterator I = inst_begin(F), IE = inst_end(F); I != IE; ++I) {
+      unsigned kind;
+      if (!getProfiledValue(&*I, kind)) continue;
+
+      if (site < sites.size()) {
+        if (sites[site].Kind != kind)
+          errs() << "WARNING: value profile site " << site
+                 << " does not match the module\n";
+
+        _executionCounts[&*I] = sites[site].Total;
+        ValueVector& values = _values[&*I];
+        values.assign(sites[site].Values.begin(), sites[site].Values.end());
+        std::stable_sort(values.begin(), values.end(), MoreFrequent());
+      }
+
+      ++site;
+    }
+  }
+
+  if (site != sites.size())
+    errs() << "WARNING: " << sites.size() << " value sites in the profile, "
+           << site << " in the module\n";
+
+  return false;
+}
+
+//===----------------------------------------------------------------------===//
+//  NoProfile ValueProfileInfo implementation
+//
+
+namespace {
+  struct NoValueProfileInfo : public ImmutablePass, public ValueProfileInfo {
+    static char ID; // Class identification, replacement for typeinfo
+    NoValueProfileInfo() : ImmutablePass(ID) {
+    }
+
+    virtual void *getAdjustedAnalysisPointer(AnalysisID PI) {
+      if (PI == &ValueProfileInfo::ID)
+        return (ValueProfileInfo*)this;
+      return this;
+    }
+
+    virtual const char *getPassName() const {
+      return "NoValueProfileInfo";
+    }
+  };
+}  // End of anonymous namespace
+
+char NoValueProfileInfo::ID = 0;
+// Register this pass...
+static RegisterPass<NoValueProfileInfo> Y("no-value-profile",
+                   "No Value Profile Information", false, true);
+static RegisterAnalysisGroup<ValueProfileInfo, true> S(Y);
@@ -0,0 +1,113 @@
+//===- ValueProfiling.cpp - Insert instrumentation for value profiling ----===//
+//
+//                      The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This pass instruments the specified program to record the most frequent
+// values of memcpy, memmove and memset lengths, switch conditions and
+// divisors, so hot code can be specialized on them.  Every site owns a
+// ValueProfileSiteEntry in a table which the runtime fills with the
+// space-saving algorithm.
+//
+// Sites are numbered in module order, see ValueProfileInfo for the operands
+// recorded.
+//
+//===----------------------------------------------------------------------===//
+#define DEBUG_TYPE "insert-value-profiling"
+
+#include "ValueProfileInfo.h"
+#include "ProfileInfoTypes.h"
+#include "ProfilingUtils.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/raw_ostream.h"
+using namespace llvm;
+
+STATISTIC(NumValueSites, "The # of value profiling sites inserted.");
+
+namespace {
+  class ValueProfiler : public ModulePass {
+    bool runOnModule(Module &M);
+  public:
+    static char ID; // Pass identification, replacement for typeid
+    ValueProfiler() : ModulePass(ID) { }
+
+    virtual const char *getPassName() const {
+      return "Value Profiler";
+    }
+  };
+}
+
+char ValueProfiler::ID = 0;
+
+static llvm::RegisterPass<ValueProfiler> X("insert-value-profiling", "Insert instrumentation for value profiling", false, false);
+
+bool ValueProfiler::runOnModule(Module &M) {
+  LLVMContext &Context = M.getContext();
+  Type *Int64Ty = Type::getInt64Ty(Context);
+
+  std::vector<Instruction*> Sites;
+  std::vector<unsigned> Kinds;
+  for (Module::iterator F = M.begin(), E = M.end(); F != E; ++F) {
+    if (F->isDeclaration()) continue;
+    for (inst_iterator I = inst_begin(F), IE = inst_end(F); I != IE; ++I) {
+      unsigned Kind;
+      if (ValueProfileInfo::getProfiledValue(&*I, Kind)) {
+        Sites.push_back(&*I);
+        Kinds.push_back(Kind);
+      }
+    }
+  }
+  NumValueSites = Sites.size();
+
+  // The site tables, laid out as ValueProfileSiteEntry.
+  const unsigned EntryWords = sizeof(ValueProfileSiteEntry) / sizeof(uint64_t);
+  std::vector<Constant*> Entries(Sites.size() * EntryWords,
+                                 ConstantInt::get(Int64Ty, 0));
+  for (unsigned i = 0, e = Sites.size(); i != e; ++i)
+    Entries[EntryWords * i] = ConstantInt::get(Int64Ty, Kinds[i]);
+
+  ArrayType *TableTy = ArrayType::get(Int64Ty, Entries.size());
+  GlobalVariable *Table =
+    new GlobalVariable(M, TableTy, false, GlobalValue::InternalLinkage,
+                       ConstantArray::get(TableTy, Entries),
+                       "ValueProfTable");
+
+  Constant *ProfileValue =
+    M.getOrInsertFunction("llvm_profile_value",
+                          Type::getVoidTy(Context),
+                          Type::getInt64PtrTy(Context), // site entry
+                          Int64Ty, // value
+                          NULL);
+
+  // Record the value before every site...
+  for (unsigned i = 0, e = Sites.size(); i != e; ++i) {
+    Instruction *I = Sites[i];
+    unsigned Kind;
+    Value *Profiled = ValueProfileInfo::getProfiledValue(I, Kind);
+
+    std::vector<Constant*> Indices(2);
+    Indices[0] = Constant::getNullValue(Int64Ty);
+    Indices[1] = ConstantInt::get(Int64Ty, EntryWords * i);
+
+    std::vector<Value*> Args(2);
+    Args[0] = ConstantExpr::getGetElementPtr(Table, Indices);
+    Args[1] = CastInst::CreateIntegerCast(Profiled, Int64Ty,
+                                          ValueProfileInfo::isSignedValue(Kind),
+                                          "value", I);
+    CallInst::Create(ProfileValue, Args, "", I);
+  }
+
+  // Add the initialization call to main, or to a constructor of the module.
+  InsertProfilingInit(M, "llvm_start_value_profiling", Table);
+  return true;
+}
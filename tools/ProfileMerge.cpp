@@ -0,0 +1,468 @@
+//===- ProfileMerge.cpp - Merge llvmprof.out files ------------------------===//
+//
+//                      The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// llvm-prof-merge reads any number of profile dump files, sums their function,
+// block, edge, optimal edge, path, extended path, call site, loop trip count,
+// function timing and region timing counters and writes a single dump file
+// with one record of each kind, preceded by the argument records of all runs.
+// Indirect call targets and profiled values are summed per site, the most
+// frequent ones are kept.  Edge and block coverage bitmaps are or'ed.
+// Function and block maps are carried over, one per type of counters.
+//
+// The inputs are loaded by a pool of threads, each accumulating the files it
+// loaded into its own partial profile.  The partial profiles are then merged
+// pairwise in parallel until one is left.
+//
+// Basic block traces can not be summed and are not merged.
+//
+//===----------------------------------------------------------------------===//
+
+#include "ProfileInfoLoader.h"
+#include "ProfileInfoTypes.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+using namespace llvm;
+
+static cl::list<std::string>
+InputFilenames(cl::Positional, cl::OneOrMore,
+               cl::desc("<profile files to merge>"));
+
+static cl::opt<std::string>
+OutputFilename("o", cl::init("llvmprof.out"), cl::value_desc("filename"),
+               cl::desc("Merged profile file"));
+
+static cl::opt<unsigned>
+NumThreads("j", cl::init(0), cl::value_desc("threads"),
+           cl::desc("Number of merge threads (default: one per core)"));
+
+namespace {
+  // MergedProfile - The sum of the counters of any number of profile files.
+  struct MergedProfile {
+    std::vector<std::string> CommandLines;
+    std::vector<uint64_t> FunctionCounts;
+    std::vector<uint64_t> BlockCounts;
+    std::vector<uint64_t> EdgeCounts;
+    std::vector<uint64_t> OptimalEdgeCounts;
+    std::map<uint64_t, PathCounterMap> PathCounts;
+    ExtendedPathCounterMap ExtendedPathCounts;
+    std::vector<uint64_t> CallSiteCounts;
+    std::map<uint64_t, IndirectCallTargetMap> IndirectCallTargets;
+    std::vector<ValueSiteCounts> ValueCounts;
+    std::vector<uint64_t> LoopTripCounts;
+    std::vector<uint64_t> FunctionTimings;
+    RegionTimingMap RegionTimings;
+    std::vector<bool> EdgeCoverage;
+    std::vector<bool> BlockCoverage;
+    std::map<uint64_t, FunctionMap> FunctionMaps;
+    std::map<uint64_t, std::vector<uint64_t> > BlockMaps;
+    bool HasBBTrace;
+
+    MergedProfile() : HasBBTrace(false) {}
+
+    void add(const ProfileInfoLoader &PIL);
+    void add(const MergedProfile &Other);
+  };
+}
+
+// addCounts - Accumulate 'Src' into 'Data'.  Counter blocks of different runs
+// may differ in length, missing entries are Uncounted.
+static void addCounts(std::vector<uint64_t> &Data,
+                      const std::vector<uint64_t> &Src) {
+  if (Src.empty()) return;
+  if (Data.size() < Src.size())
+    Data.resize(Src.size(), ProfileInfoLoader::Uncounted);
+  AccumulateCounts(&Data[0], &Src[0], Src.size(), false);
+}
+
+// addCounterMaps - Accumulate 'Src' into 'Data', for path counters of
+// functions and target counters of indirect call sites alike.
+static void addCounterMaps(std::map<uint64_t, PathCounterMap> &Data,
+                           const std::map<uint64_t, PathCounterMap> &Src) {
+  for (std::map<uint64_t, PathCounterMap>::const_iterator FI = Src.begin(),
+       FE = Src.end(); FI != FE; ++FI) {
+    PathCounterMap &Counters = Data[FI->first];
+    for (PathCounterMap::const_iterator PI = FI->second.begin(),
+         PE = FI->second.end(); PI != PE; ++PI)
+      Counters[PI->first] += PI->second;
+  }
+}
+
+static void addExtendedPathCounts(ExtendedPathCounterMap &Data,
+                                  const ExtendedPathCounterMap &Src) {
+  for (ExtendedPathCounterMap::const_iterator PI = Src.begin(),
+       PE = Src.end(); PI != PE; ++PI)
+    Data[PI->first] += PI->second;
+}
+
+static void addRegionTimings(RegionTimingMap &Data,
+                             const RegionTimingMap &Src) {
+  for (RegionTimingMap::const_iterator RI = Src.begin(), RE = Src.end();
+       RI != RE; ++RI) {
+    std::pair<uint64_t, uint64_t> &Timing = Data[RI->first];
+    Timing.first += RI->second.first;
+    Timing.second += RI->second.second;
+  }
+}
+
+static void addValueCounts(std::vector<ValueSiteCounts> &Data,
+                           const std::vector<ValueSiteCounts> &Src) {
+  if (Data.size() < Src.size())
+    Data.resize(Src.size());
+  for (size_t i = 0, e = Src.size(); i != e; ++i) {
+    Data[i].Kind = Src[i].Kind;
+    Data[i].Total += Src[i].Total;
+    for (std::map<uint64_t, uint64_t>::const_iterator
+         VI = Src[i].Values.begin(), VE = Src[i].Values.end(); VI != VE; ++VI)
+      Data[i].Values[VI->first] += VI->second;
+  }
+}
+
+// addCoverage - Or 'Src' into 'Data'.
+static void addCoverage(std::vector<bool> &Data, const std::vector<bool> &Src) {
+  if (Data.size() < Src.size())
+    Data.resize(Src.size(), false);
+  for (size_t i = 0, e = Src.size(); i != e; ++i)
+    if (Src[i])
+      Data[i] = true;
+}
+
+// addFunctionMaps - Add the functions of 'Src' missing from 'Data'.  Runs of
+// the same program have the same maps.
+static void addFunctionMaps(std::map<uint64_t, FunctionMap> &Data,
+                            const std::map<uint64_t, FunctionMap> &Src) {
+  for (std::map<uint64_t, FunctionMap>::const_iterator MI = Src.begin(),
+       ME = Src.end(); MI != ME; ++MI)
+    Data[MI->first].insert(MI->second.begin(), MI->second.end());
+}
+
+void MergedProfile::add(const ProfileInfoLoader &PIL) {
+  for (unsigned i = 0, e = PIL.getNumExecutions(); i != e; ++i)
+    CommandLines.push_back(PIL.getExecution(i));
+  addCounts(FunctionCounts, PIL.getRawFunctionCounts());
+  addCounts(BlockCounts, PIL.getRawBlockCounts());
+  addCounts(EdgeCounts, PIL.getRawEdgeCounts());
+  addCounts(OptimalEdgeCounts, PIL.getRawOptimalEdgeCounts());
+  addCounterMaps(PathCounts, PIL.getRawPathCounts());
+  addExtendedPathCounts(ExtendedPathCounts, PIL.getRawExtendedPathCounts());
+  addCounts(CallSiteCounts, PIL.getRawCallSiteCounts());
+  addCounterMaps(IndirectCallTargets, PIL.getRawIndirectCallTargets());
+  addValueCounts(ValueCounts, PIL.getRawValueCounts());
+  addCounts(LoopTripCounts, PIL.getRawLoopTripCounts());
+  addCounts(FunctionTimings, PIL.getRawFunctionTimings());
+  addRegionTimings(RegionTimings, PIL.getRawRegionTimings());
+  addCoverage(EdgeCoverage, PIL.getRawEdgeCoverage());
+  addCoverage(BlockCoverage, PIL.getRawBlockCoverage());
+  addFunctionMaps(FunctionMaps, PIL.getFunctionMaps());
+  BlockMaps.insert(PIL.getRawBlockMaps().begin(), PIL.getRawBlockMaps().end());
+  HasBBTrace |= !PIL.getRawBBTrace().empty();
+}
+
+void MergedProfile::add(const MergedProfile &Other) {
+  CommandLines.insert(CommandLines.end(), Other.CommandLines.begin(),
+                      Other.CommandLines.end());
+  addCounts(FunctionCounts, Other.FunctionCounts);
+  addCounts(BlockCounts, Other.BlockCounts);
+  addCounts(EdgeCounts, Other.EdgeCounts);
+  addCounts(OptimalEdgeCounts, Other.OptimalEdgeCounts);
+  addCounterMaps(PathCounts, Other.PathCounts);
+  addExtendedPathCounts(ExtendedPathCounts, Other.ExtendedPathCounts);
+  addCounts(CallSiteCounts, Other.CallSiteCounts);
+  addCounterMaps(IndirectCallTargets, Other.IndirectCallTargets);
+  addValueCounts(ValueCounts, Other.ValueCounts);
+  addCounts(LoopTripCounts, Other.LoopTripCounts);
+  addCounts(FunctionTimings, Other.FunctionTimings);
+  addRegionTimings(RegionTimings, Other.RegionTimings);
+  addCoverage(EdgeCoverage, Other.EdgeCoverage);
+  addCoverage(BlockCoverage, Other.BlockCoverage);
+  addFunctionMaps(FunctionMaps, Other.FunctionMaps);
+  BlockMaps.insert(Other.BlockMaps.begin(), Other.BlockMaps.end());
+  HasBBTrace |= Other.HasBBTrace;
+}
+
+static void writeWords(FILE *F, const uint64_t *Data, size_t NumWords) {
+  if (NumWords && fwrite(Data, sizeof(uint64_t), NumWords, F) != NumWords) {
+    errs() << "llvm-prof-merge: unable to write to '" << OutputFilename
+           << "'!\n";
+    exit(1);
+  }
+}
+
+// writeArguments - Write an argument record in the layout used by
+// getOutFile() in CommonProfiling.c.
+static void writeArguments(FILE *F, const std::string &Args) {
+  uint64_t Header[2] = { ArgumentInfo, Args.size() };
+  writeWords(F, Header, 2);
+
+  // Pad out to a multiple of eight bytes.
+  std::vector<char> Chars(Args.begin(), Args.end());
+  Chars.resize((Args.size() + 7) & ~7, 0);
+  if (!Chars.empty() && fwrite(&Chars[0], 1, Chars.size(), F) != Chars.size()) {
+    errs() << "llvm-prof-merge: unable to write to '" << OutputFilename
+           << "'!\n";
+    exit(1);
+  }
+}
+
+static void writeCounts(FILE *F, ProfilingType PT,
+                        const std::vector<uint64_t> &Counts) {
+  if (Counts.empty()) return;
+  uint64_t Header[2] = { PT, Counts.size() };
+  writeWords(F, Header, 2);
+  writeWords(F, &Counts[0], Counts.size());
+}
+
+// writePathCounts - Write a path record in the layout used by
+// pathProfAtExitHandler() in PathProfiling.c.
+static void writePathCounts(FILE *F,
+                            const std::map<uint64_t, PathCounterMap> &Paths) {
+  if (Paths.empty()) return;
+  uint64_t Header[2] = { PathInfo, Paths.size() };
+  writeWords(F, Header, 2);
+
+  for (std::map<uint64_t, PathCounterMap>::const_iterator FI = Paths.begin(),
+       FE = Paths.end(); FI != FE; ++FI) {
+    uint64_t FunctionHeader[2] = { FI->first, FI->second.size() };
+    writeWords(F, FunctionHeader, 2);
+    for (PathCounterMap::const_iterator PI = FI->second.begin(),
+         PE = FI->second.end(); PI != PE; ++PI) {
+      uint64_t Entry[2] = { PI->first, PI->second };
+      writeWords(F, Entry, 2);
+    }
+  }
+}
+
+// writeExtendedPathCounts - Write an extended path record in the layout used
+// by writeExtendedPaths() in PathProfiling.c.
+static void writeExtendedPathCounts(FILE *F,
+                                    const ExtendedPathCounterMap &Paths) {
+  if (Paths.empty()) return;
+  uint64_t Header[2] = { ExtendedPathInfo, Paths.size() };
+  writeWords(F, Header, 2);
+
+  for (ExtendedPathCounterMap::const_iterator PI = Paths.begin(),
+       PE = Paths.end(); PI != PE; ++PI) {
+    const std::vector<uint64_t> &Key = PI->first;
+    uint64_t PathHeader[3] = { Key[0], (Key.size() - 1) / 2, PI->second };
+    writeWords(F, PathHeader, 3);
+    writeWords(F, &Key[1], Key.size() - 1);
+  }
+}
+
+// writeRegionTimings - Write a region timing record in the layout used by
+// TimingAtExitHandler() in FunctionTiming.c.
+static void writeRegionTimings(FILE *F, const RegionTimingMap &Regions) {
+  if (Regions.empty()) return;
+  const size_t EntryWords = sizeof(RegionTimingEntry) / sizeof(uint64_t);
+  uint64_t Header[2] = { RegionTimingInfo, Regions.size() * EntryWords };
+  writeWords(F, Header, 2);
+
+  for (RegionTimingMap::const_iterator RI = Regions.begin(),
+       RE = Regions.end(); RI != RE; ++RI) {
+    RegionTimingEntry Entry = { RI->first.first, RI->first.second,
+                                RI->second.first, RI->second.second };
+    writeWords(F, (const uint64_t *)&Entry, EntryWords);
+  }
+}
+
+static bool moreFrequent(const std::pair<uint64_t, uint64_t> &LHS,
+                      const std::pair<uint64_t, uint64_t> &RHS) {
+  return LHS.second > RHS.second;
+}
+
+// writeIndirectCallTargets - Write an indirect call record in the layout used
+// by CallSiteProfAtExitHandler() in CallSiteProfiling.c, keeping the most
+// frequent targets of every call site.
+static void writeIndirectCallTargets(
+    FILE *F, const std::map<uint64_t, IndirectCallTargetMap> &Sites) {
+  if (Sites.empty()) return;
+
+  std::vector<IndirectCallSiteEntry> Entries;
+  for (std::map<uint64_t, IndirectCallTargetMap>::const_iterator
+       SI = Sites.begin(), SE = Sites.end(); SI != SE; ++SI) {
+    std::vector<std::pair<uint64_t, uint64_t> > Targets(SI->second.begin(),
+                                                        SI->second.end());
+    std::stable_sort(Targets.begin(), Targets.end(), moreFrequent);
+
+    IndirectCallSiteEntry Entry;
+    memset(&Entry, 0, sizeof(Entry));
+    Entry.siteNumber = SI->first;
+    for (unsigned t = 0; t != INDIRECT_CALL_TOP_TARGETS &&
+         t != Targets.size(); ++t) {
+      Entry.targets[t].target = Targets[t].first;
+      Entry.targets[t].count = Targets[t].second;
+    }
+    Entries.push_back(Entry);
+  }
+
+  uint64_t NumWords =
+    Entries.size() * sizeof(IndirectCallSiteEntry) / sizeof(uint64_t);
+  uint64_t Header[2] = { IndirectCallInfo, NumWords };
+  writeWords(F, Header, 2);
+  writeWords(F, (const uint64_t *)&Entries[0], NumWords);
+}
+
+// writeValueCounts - Write a value record in the layout used by
+// ValueProfAtExitHandler() in ValueProfiling.c, keeping the most frequent
+// values of every site.
+static void writeValueCounts(FILE *F,
+                             const std::vector<ValueSiteCounts> &Sites) {
+  if (Sites.empty()) return;
+
+  std::vector<ValueProfileSiteEntry> Entries(Sites.size());
+  memset(&Entries[0], 0, Entries.size() * sizeof(ValueProfileSiteEntry));
+  for (size_t i = 0, e = Sites.size(); i != e; ++i) {
+    std::vector<std::pair<uint64_t, uint64_t> > Values(Sites[i].Values.begin(),
+                                                       Sites[i].Values.end());
+    std::stable_sort(Values.begin(), Values.end(), moreFrequent);
+
+    Entries[i].kind = Sites[i].Kind;
+    Entries[i].total = Sites[i].Total;
+    for (unsigned v = 0; v != VALUE_PROFILE_TOP_VALUES &&
+         v != Values.size(); ++v) {
+      Entries[i].values[v].value = Values[v].first;
+      Entries[i].values[v].count = Values[v].second;
+    }
+  }
+
+  uint64_t NumWords =
+    Entries.size() * sizeof(ValueProfileSiteEntry) / sizeof(uint64_t);
+  uint64_t Header[2] = { ValueInfo, NumWords };
+  writeWords(F, Header, 2);
+  writeWords(F, (const uint64_t *)&Entries[0], NumWords);
+}
+
+// writeCoverage - Write a coverage record in the layout used by
+// WriteCoverageBitmap() in CoverageProfiling.c.
+static void writeCoverage(FILE *F, ProfilingType PT,
+                          const std::vector<bool> &Flags) {
+  if (Flags.empty()) return;
+
+  std::vector<uint64_t> Bitmap(1 + (Flags.size() + 63) / 64, 0);
+  Bitmap[0] = Flags.size();
+  for (size_t i = 0, e = Flags.size(); i != e; ++i)
+    if (Flags[i])
+      Bitmap[1 + i / 64] |= 1ULL << (i % 64);
+
+  writeCounts(F, PT, Bitmap);
+}
+
+// writeFunctionMaps - Write a function map record per type of counters in
+// the layout used by InsertFunctionMap() in ProfilingUtils.cpp.
+static void writeFunctionMaps(FILE *F,
+                              const std::map<uint64_t, FunctionMap> &Maps) {
+  for (std::map<uint64_t, FunctionMap>::const_iterator MI = Maps.begin(),
+       ME = Maps.end(); MI != ME; ++MI) {
+    std::vector<uint64_t> Words(1, MI->first);
+    for (FunctionMap::const_iterator FI = MI->second.begin(),
+         FE = MI->second.end(); FI != FE; ++FI) {
+      Words.push_back(FI->second.guid);
+      Words.push_back(FI->second.cfgHash);
+      Words.push_back(FI->second.firstCounter);
+      Words.push_back(FI->second.numCounters);
+    }
+    writeCounts(F, FunctionMapInfo, Words);
+  }
+}
+
+// writeBlockMaps - Write a block map record per type of counters in the
+// layout used by InsertFunctionMap() in ProfilingUtils.cpp.
+static void writeBlockMaps(
+    FILE *F, const std::map<uint64_t, std::vector<uint64_t> > &Maps) {
+  for (std::map<uint64_t, std::vector<uint64_t> >::const_iterator
+       MI = Maps.begin(), ME = Maps.end(); MI != ME; ++MI) {
+    std::vector<uint64_t> Words(1, MI->first);
+    Words.insert(Words.end(), MI->second.begin(), MI->second.end());
+    writeCounts(F, BlockMapInfo, Words);
+  }
+}
+
+int main(int argc, char **argv) {
+  cl::ParseCommandLineOptions(argc, argv, "llvm profile merge tool\n");
+
+  unsigned Threads = NumThreads;
+  if (Threads == 0)
+    Threads = std::thread::hardware_concurrency();
+  if (Threads == 0)
+    Threads = 1;
+  if (Threads > InputFilenames.size())
+    Threads = InputFilenames.size();
+
+  // Load the inputs.  Every thread takes the next unloaded file and adds it to
+  // its own partial profile.
+  std::vector<MergedProfile> Partial(Threads);
+  std::atomic<size_t> NextFile(0);
+  std::vector<std::thread> Pool;
+  for (unsigned t = 0; t != Threads; ++t) {
+    Pool.push_back(std::thread([&, t]() {
+      for (size_t i = NextFile++; i < InputFilenames.size(); i = NextFile++) {
+        ProfileInfoLoader PIL("llvm-prof-merge", InputFilenames[i]);
+        Partial[t].add(PIL);
+      }
+    }));
+  }
+  for (unsigned t = 0; t != Threads; ++t)
+    Pool[t].join();
+
+  // Tree reduction: in every round the upper half of the partial profiles is
+  // merged into the lower half, one thread per pair.
+  for (size_t Size = Partial.size(); Size > 1; Size = (Size + 1) / 2) {
+    size_t Half = (Size + 1) / 2;
+    Pool.clear();
+    for (size_t i = Half; i != Size; ++i) {
+      Pool.push_back(std::thread([&Partial, i, Half]() {
+        Partial[i - Half].add(Partial[i]);
+        Partial[i] = MergedProfile();
+      }));
+    }
+    for (size_t i = 0, e = Pool.size(); i != e; ++i)
+      Pool[i].join();
+  }
+  MergedProfile &Result = Partial[0];
+
+  if (Result.HasBBTrace)
+    errs() << "llvm-prof-merge: Warning, basic block traces can not be merged "
+           << "and are dropped\n";
+
+  FILE *F = fopen(OutputFilename.c_str(), "wb");
+  if (F == 0) {
+    errs() << "llvm-prof-merge: Error opening '" << OutputFilename << "': ";
+    perror(0);
+    return 1;
+  }
+
+  for (size_t i = 0, e = Result.CommandLines.size(); i != e; ++i)
+    writeArguments(F, Result.CommandLines[i]);
+  writeCounts(F, FunctionInfo, Result.FunctionCounts);
+  writeCounts(F, BlockInfo, Result.BlockCounts);
+  writeCounts(F, EdgeInfo, Result.EdgeCounts);
+  writeCounts(F, OptEdgeInfo, Result.OptimalEdgeCounts);
+  writePathCounts(F, Result.PathCounts);
+  writeExtendedPathCounts(F, Result.ExtendedPathCounts);
+  writeCounts(F, CallSiteInfo, Result.CallSiteCounts);
+  writeIndirectCallTargets(F, Result.IndirectCallTargets);
+  writeValueCounts(F, Result.ValueCounts);
+  writeCounts(F, LoopTripInfo, Result.LoopTripCounts);
+  writeCounts(F, TimingInfo, Result.FunctionTimings);
+  writeRegionTimings(F, Result.RegionTimings);
+  writeCoverage(F, EdgeCoverageInfo, Result.EdgeCoverage);
+  writeCoverage(F, BlockCoverageInfo, Result.BlockCoverage);
+  writeFunctionMaps(F, Result.FunctionMaps);
+  writeBlockMaps(F, Result.BlockMaps);
+
+  fclose(F);
+  return 0;
+}